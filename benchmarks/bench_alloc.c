@@ -0,0 +1,69 @@
+#include <bench.h>
+
+#include <via/type-utils.h>
+#include <via/vm.h>
+
+#include <stdlib.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#define LIVE_CELLS 1000000
+#define ROUNDS 10
+
+// Builds a list of LIVE_CELLS integers rooted in the accumulator, and then
+// discards it, collecting the garbage after each round.
+static void bench_allocator(enum via_allocator allocator, const char* name) {
+    const struct via_vm_options options = { .allocator = allocator };
+    struct via_vm* vm = via_create_vm_with_options(&options);
+    if (!vm) {
+        return;
+    }
+
+    char label[64];
+    double elapsed = 0;
+    for (size_t round = 0; round < ROUNDS; ++round) {
+        const double start = bench_now();
+        vm->acc = NULL;
+        for (size_t i = 0; i < LIVE_CELLS / 2; ++i) {
+            vm->acc = via_make_pair(vm, via_make_int(vm, i), vm->acc);
+        }
+        elapsed += bench_now() - start;
+
+        vm->acc = NULL;
+        via_garbage_collect(vm);
+    }
+
+    snprintf(label, sizeof(label), "%s allocation", name);
+    BENCH_REPORT(label, (double) LIVE_CELLS * ROUNDS, "cell", elapsed);
+
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    printf("%-32s %12ld KiB max RSS\n", name, usage.ru_maxrss);
+
+    via_free_vm(vm);
+}
+
+int main(void) {
+    static const struct {
+        enum via_allocator allocator;
+        const char* name;
+    } allocators[] = {
+        { VIA_ALLOC_MALLOC, "malloc" },
+        { VIA_ALLOC_SLAB, "slab" }
+    };
+
+    // Every allocator is measured in a separate process, to keep the RSS
+    // figures independent.
+    for (size_t i = 0; i < sizeof(allocators) / sizeof(*allocators); ++i) {
+        fflush(stdout);
+        const pid_t pid = fork();
+        if (pid == 0) {
+            bench_allocator(allocators[i].allocator, allocators[i].name);
+            return 0;
+        }
+        waitpid(pid, NULL, 0);
+    }
+
+    return 0;
+}
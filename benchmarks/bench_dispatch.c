@@ -0,0 +1,93 @@
+#include <bench.h>
+
+#include <via/assembler.h>
+#include <via/parse.h>
+#include <via/type-utils.h>
+#include <via/vm.h>
+
+#include <stdlib.h>
+#include <string.h>
+
+#define BLOCK_REPEAT 256
+#define RUNS 20000
+
+// Measures raw instruction dispatch throughput by repeatedly running a long
+// block of cheap register instructions.
+static void bench_straight_line(struct via_vm* vm) {
+    static const char* const block =
+        "    load !expr\n"
+        "    set !proc\n"
+        "    loadnil\n"
+        "    setret\n"
+        "    loadret\n"
+        "    nop\n"
+        "    set !args\n"
+        "    load !proc\n";
+    const size_t block_len = strlen(block);
+    const size_t block_ops = 8;
+
+    char* source = malloc(block_len * BLOCK_REPEAT + 64);
+    char* cursor = source;
+    cursor += sprintf(cursor, "bench-dispatch-proc:\n");
+    for (size_t i = 0; i < BLOCK_REPEAT; ++i) {
+        memcpy(cursor, block, block_len);
+        cursor += block_len;
+    }
+    sprintf(cursor, "    return\n");
+
+    struct via_assembly_result result = via_assemble(vm, source);
+    free(source);
+    if (result.status != VIA_ASM_SUCCESS) {
+        fprintf(stderr, "Assembly failed: %s\n", result.err_ptr);
+        return;
+    }
+
+    const double start = bench_now();
+    for (size_t run = 0; run < RUNS; ++run) {
+        via_reg_pc(vm)->v_int = result.addr;
+        via_run(vm);
+    }
+    const double elapsed = bench_now() - start;
+
+    BENCH_REPORT(
+        "straight-line dispatch",
+        (double) RUNS * (block_ops * BLOCK_REPEAT + 1),
+        "instr",
+        elapsed
+    );
+}
+
+// Measures a complete evaluation of a tail recursive loop.
+static void bench_eval_loop(struct via_vm* vm) {
+    static const char* const source =
+        "(begin"
+        "  (set-proc! iterate (num)"
+        "             (if (= num 0)"
+        "                 0"
+        "                 (iterate (- num 1))))"
+        "  (iterate 20000))";
+
+    via_set_expr(
+        vm,
+        via_parse_ctx_program(via_parse(vm, source, NULL))->v_car
+    );
+
+    const double start = bench_now();
+    via_run_eval(vm);
+    const double elapsed = bench_now() - start;
+
+    BENCH_REPORT("tail recursive loop", 20000, "iter", elapsed);
+}
+
+int main(void) {
+    struct via_vm* vm = via_create_vm();
+    if (!vm) {
+        return 1;
+    }
+
+    bench_straight_line(vm);
+    bench_eval_loop(vm);
+
+    via_free_vm(vm);
+    return 0;
+}
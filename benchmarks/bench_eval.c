@@ -0,0 +1,66 @@
+#include <bench.h>
+
+#include <via/parse.h>
+#include <via/vm.h>
+
+// Measures evaluation of a non tail recursive procedure, which spends most of
+// its time applying procedures and evaluating their arguments.
+static void bench_fib(struct via_vm* vm) {
+    static const char* const source =
+        "(begin"
+        "  (set-proc! fib (n)"
+        "             (if (< n 2)"
+        "                 n"
+        "                 (+ (fib (- n 1)) (fib (- n 2)))))"
+        "  (fib 20))";
+    // Number of applications of fib for n = 20.
+    const double calls = 21891;
+
+    via_set_expr(
+        vm,
+        via_parse_ctx_program(via_parse(vm, source, NULL))->v_car
+    );
+
+    const double start = bench_now();
+    via_run_eval(vm);
+    const double elapsed = bench_now() - start;
+
+    BENCH_REPORT("recursive fib", calls, "call", elapsed);
+}
+
+// Measures a tail recursive loop doing nothing but arithmetic, on integers
+// too large to be shared.
+static void bench_sum(struct via_vm* vm) {
+    static const char* const source =
+        "(begin"
+        "  (set-proc! sum (i acc)"
+        "             (if (< i 1)"
+        "                 acc"
+        "                 (sum (- i 1) (+ acc (* i 1000)))))"
+        "  (sum 100000 0))";
+    const double iterations = 100000;
+
+    via_set_expr(
+        vm,
+        via_parse_ctx_program(via_parse(vm, source, NULL))->v_car
+    );
+
+    const double start = bench_now();
+    via_run_eval(vm);
+    const double elapsed = bench_now() - start;
+
+    BENCH_REPORT("arithmetic loop", iterations, "iteration", elapsed);
+}
+
+int main(void) {
+    struct via_vm* vm = via_create_vm();
+    if (!vm) {
+        return 1;
+    }
+
+    bench_fib(vm);
+    bench_sum(vm);
+
+    via_free_vm(vm);
+    return 0;
+}
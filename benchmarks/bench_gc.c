@@ -0,0 +1,60 @@
+#include <bench.h>
+
+#include <via/type-utils.h>
+#include <via/vm.h>
+
+#define MAX_LIVE_CELLS (4 * 1024 * 1024)
+#define PROBE_CELLS (64 * 1024)
+
+// Drops the COUNT oldest elements of the list, which occupy the lowest heap
+// slots, leaving a run of holes below the rest of the live heap once
+// collected.
+static void drop_oldest(
+    const struct via_value* list,
+    size_t length,
+    size_t count
+) {
+    for (size_t i = 1; i < length - count; ++i) {
+        list = list->v_cdr;
+    }
+    ((struct via_value*) list)->v_cdr = NULL;
+}
+
+// Grows a live list in the accumulator, and after each step measures the
+// latency of allocating cells once a collection has left holes below the
+// live heap: the holes are filled first, after which allocation continues
+// past the top of the heap.
+int main(void) {
+    struct via_vm* vm = via_create_vm();
+    if (!vm) {
+        return 1;
+    }
+
+    size_t live_cells = 0;
+    for (size_t target = 256 * 1024; target <= MAX_LIVE_CELLS; target *= 2) {
+        for (; live_cells < target; live_cells += 2) {
+            vm->acc = via_make_pair(vm, via_make_int(vm, live_cells), vm->acc);
+        }
+        // Every dropped list element frees two cells.
+        drop_oldest(vm->acc, live_cells / 2, PROBE_CELLS / 4);
+        live_cells -= PROBE_CELLS / 2;
+        via_garbage_collect(vm);
+
+        const double start = bench_now();
+        for (size_t i = 0; i < PROBE_CELLS; ++i) {
+            (void) via_make_value(vm);
+        }
+        const double elapsed = bench_now() - start;
+
+        printf(
+            "live cells %9zu: %8.1f ns/alloc\n",
+            live_cells,
+            elapsed * 1e9 / PROBE_CELLS
+        );
+
+        via_garbage_collect(vm);
+    }
+
+    via_free_vm(vm);
+    return 0;
+}
@@ -0,0 +1,103 @@
+#include <bench.h>
+
+#include <via/parse.h>
+#include <via/type-utils.h>
+#include <via/vm.h>
+
+#include <stdlib.h>
+
+#define LENGTH (1024 * 1024)
+#define ROUNDS 16
+#define PROGRAM_ROUNDS 2
+
+// Builds a list of LENGTH integers whose pairs are linked in shuffled order,
+// so that walking it jumps around the heap, and binds it to big.
+static via_bool make_scattered_list(struct via_vm* vm) {
+    const struct via_value** pairs = malloc(LENGTH * sizeof(*pairs));
+    if (!pairs) {
+        return false;
+    }
+    for (size_t i = 0; i < LENGTH; ++i) {
+        pairs[i] = via_make_pair(vm, via_make_int(vm, i), NULL);
+    }
+    srand(1);
+    for (size_t i = LENGTH - 1; i > 0; --i) {
+        const size_t j = (size_t) rand() % (i + 1);
+        const struct via_value* tmp = pairs[i];
+        pairs[i] = pairs[j];
+        pairs[j] = tmp;
+    }
+    for (size_t i = 1; i < LENGTH; ++i) {
+        ((struct via_value*) pairs[i - 1])->v_cdr = pairs[i];
+    }
+    via_env_set(vm, via_sym(vm, "big"), pairs[0]);
+    free(pairs);
+    return true;
+}
+
+// Walks the list bound to big from C and from a program, after a full
+// collection with the given collector has had the chance to move it.
+static void bench_collector(enum via_collector collector, const char* name) {
+    const struct via_vm_options options = {
+        .allocator = VIA_ALLOC_SLAB,
+        .collector = collector
+    };
+    struct via_vm* vm = via_create_vm_with_options(&options);
+    if (!vm || !make_scattered_list(vm)) {
+        goto cleanup;
+    }
+    via_garbage_collect(vm);
+
+    char label[64];
+    via_int sum = 0;
+    double start = bench_now();
+    for (size_t round = 0; round < ROUNDS; ++round) {
+        // The collection may have moved the list.
+        const struct via_value* list = via_get(vm, "big");
+        for (; list; list = list->v_cdr) {
+            sum += via_value_int(list->v_car);
+        }
+    }
+    double elapsed = bench_now() - start;
+    snprintf(label, sizeof(label), "%s C walk", name);
+    BENCH_REPORT(label, (double) LENGTH * ROUNDS, "pair", elapsed);
+
+    static const char* const source =
+        "(begin"
+        "  (set-proc! walk (l acc)"
+        "             (if (nil? l)"
+        "                 acc"
+        "                 (walk (cdr l) (+ acc (car l)))))"
+        "  (walk big 0))";
+    // The program is bound, as collections during a round may free or move
+    // values only referenced from C.
+    via_env_set(
+        vm,
+        via_sym(vm, "walk-program"),
+        via_parse_ctx_program(via_parse(vm, source, NULL))->v_car
+    );
+    start = bench_now();
+    for (size_t round = 0; round < PROGRAM_ROUNDS; ++round) {
+        via_set_expr(vm, via_get(vm, "walk-program"));
+        sum += via_value_int(via_run_eval(vm));
+    }
+    elapsed = bench_now() - start;
+    snprintf(label, sizeof(label), "%s program walk", name);
+    BENCH_REPORT(label, (double) LENGTH * PROGRAM_ROUNDS, "pair", elapsed);
+
+    // Keeps the walks from being optimized away.
+    if (!sum) {
+        printf("%lld\n", (long long) sum);
+    }
+
+cleanup:
+    if (vm) {
+        via_free_vm(vm);
+    }
+}
+
+int main(void) {
+    bench_collector(VIA_GC_MARK_SWEEP, "mark-sweep");
+    bench_collector(VIA_GC_COPYING, "copying");
+    return 0;
+}
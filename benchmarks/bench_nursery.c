@@ -0,0 +1,70 @@
+#include <bench.h>
+
+#include <via/type-utils.h>
+#include <via/vm.h>
+
+#define MAX_OLD_CELLS (4 * 1024 * 1024)
+#define NURSERY_CELLS (32 * 1024)
+#define ROUNDS 16
+
+// Fills the nursery with NURSERY_CELLS cells, of which the list rooted in the
+// return register survives, and returns the time taken by the collection.
+static double collect_round(
+    struct via_vm* vm,
+    size_t survivors,
+    void(*collect)(struct via_vm*)
+) {
+    vm->ret = NULL;
+    for (size_t i = 0; i < survivors / 2; ++i) {
+        vm->ret = via_make_pair(vm, via_make_int(vm, i), vm->ret);
+    }
+    for (size_t i = survivors; i < NURSERY_CELLS; ++i) {
+        (void) via_make_value(vm);
+    }
+
+    const double start = bench_now();
+    collect(vm);
+    return bench_now() - start;
+}
+
+// Compares the pause of a minor collection with that of a full collection,
+// for a growing old generation held in the accumulator, and for a varying
+// number of nursery survivors.
+int main(void) {
+    struct via_vm* vm = via_create_vm();
+    if (!vm) {
+        return 1;
+    }
+    struct via_gc_policy policy = via_get_gc_policy(vm);
+    policy.enabled = false;
+    via_set_gc_policy(vm, &policy);
+
+    size_t old_cells = 0;
+    for (size_t target = 256 * 1024; target <= MAX_OLD_CELLS; target *= 4) {
+        for (; old_cells < target; old_cells += 2) {
+            vm->acc = via_make_pair(vm, via_make_int(vm, old_cells), vm->acc);
+        }
+        via_garbage_collect(vm);
+
+        for (size_t survivors = 0; survivors <= 4096; survivors += 1024) {
+            double minor = 0;
+            double full = 0;
+            for (size_t round = 0; round < ROUNDS; ++round) {
+                minor += collect_round(vm, survivors, via_collect_nursery);
+                full += collect_round(vm, survivors, via_garbage_collect);
+            }
+
+            printf(
+                "old cells %8zu, survivors %5zu: "
+                "minor %8.1f us, full %8.1f us\n",
+                old_cells,
+                survivors,
+                minor * 1e6 / ROUNDS,
+                full * 1e6 / ROUNDS
+            );
+        }
+    }
+
+    via_free_vm(vm);
+    return 0;
+}
@@ -0,0 +1,58 @@
+#include <bench.h>
+
+#include <via/type-utils.h>
+#include <via/vm.h>
+
+#define TREE_DEPTH 21
+#define MAX_THREADS 8
+#define ROUNDS 8
+
+// Builds a complete binary tree of pairs, which gives the marking threads
+// plenty of subtrees to steal.
+static const struct via_value* make_tree(struct via_vm* vm, int depth) {
+    if (!depth) {
+        return via_make_int(vm, depth);
+    }
+    const struct via_value* left = make_tree(vm, depth - 1);
+    return via_make_pair(vm, left, make_tree(vm, depth - 1));
+}
+
+// Measures full collections of a heap where every value is live, which makes
+// them all about marking, for an increasing number of marking threads.
+int main(void) {
+    double serial = 0;
+    for (size_t threads = 1; threads <= MAX_THREADS; threads *= 2) {
+        const struct via_vm_options options = {
+            .allocator = VIA_ALLOC_SLAB,
+            .collector = VIA_GC_MARK_SWEEP,
+            .mark_threads = threads
+        };
+        struct via_vm* vm = via_create_vm_with_options(&options);
+        if (!vm) {
+            return 1;
+        }
+        vm->acc = make_tree(vm, TREE_DEPTH);
+        via_garbage_collect(vm);
+
+        const double start = bench_now();
+        for (size_t round = 0; round < ROUNDS; ++round) {
+            via_garbage_collect(vm);
+        }
+        const double elapsed = (bench_now() - start) / ROUNDS;
+        if (threads == 1) {
+            serial = elapsed;
+        }
+
+        printf(
+            "%zu threads, %zu live cells: %8.2f ms, speedup %5.2f\n",
+            threads,
+            vm->heap_cells,
+            elapsed * 1e3,
+            serial / elapsed
+        );
+
+        via_free_vm(vm);
+    }
+
+    return 0;
+}
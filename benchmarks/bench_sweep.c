@@ -0,0 +1,49 @@
+#include <bench.h>
+
+#include <via/type-utils.h>
+#include <via/vm.h>
+
+#define LIVE_CELLS (1024 * 1024)
+#define DEAD_STRINGS (1024 * 1024)
+#define ROUNDS 8
+
+// Measures the pause of full collections that find a large number of dead
+// strings, with the strings freed during the pause or in the background.
+static void bench_sweep(via_bool background, const char* name) {
+    const struct via_vm_options options = {
+        .allocator = VIA_ALLOC_SLAB,
+        .collector = VIA_GC_MARK_SWEEP,
+        .background_sweep = background
+    };
+    struct via_vm* vm = via_create_vm_with_options(&options);
+    if (!vm) {
+        return;
+    }
+    for (size_t i = 0; i < LIVE_CELLS / 2; ++i) {
+        vm->acc = via_make_pair(vm, via_make_int(vm, i), vm->acc);
+    }
+
+    double pause = 0;
+    for (size_t round = 0; round < ROUNDS; ++round) {
+        for (size_t i = 0; i < DEAD_STRINGS; ++i) {
+            (void) via_make_string(vm, "a string that does not survive");
+        }
+        const double start = bench_now();
+        via_garbage_collect(vm);
+        pause += bench_now() - start;
+    }
+
+    printf(
+        "%-12s sweep: %8.2f ms pause per collection\n",
+        name,
+        pause * 1e3 / ROUNDS
+    );
+
+    via_free_vm(vm);
+}
+
+int main(void) {
+    bench_sweep(false, "synchronous");
+    bench_sweep(true, "background");
+    return 0;
+}
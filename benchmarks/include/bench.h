@@ -0,0 +1,21 @@
+#pragma once
+
+#include <stdio.h>
+#include <time.h>
+
+// Minimal helpers shared by the benchmark programs.
+
+static double bench_now(void) {
+    struct timespec ts;
+    timespec_get(&ts, TIME_UTC);
+    return (double) ts.tv_sec + (double) ts.tv_nsec * 1e-9;
+}
+
+#define BENCH_REPORT(NAME, COUNT, UNIT, SECONDS)\
+    printf(\
+        "%-32s %12.0f %s/s (%.3f s)\n",\
+        NAME,\
+        (double) (COUNT) / (SECONDS),\
+        UNIT,\
+        SECONDS\
+    )
@@ -25,10 +25,19 @@ struct via_assembly_result via_assemble(struct via_vm* vm, const char* source);
 
 const char* via_asm_error_string(enum via_assembly_status status);
 
+// Returns the address of a part of the program of the given size, reusing a
+// released part if one is large enough.
 via_int via_asm_reserve_prg(struct via_vm* vm, via_int size);
 
+// Releases a part of the program that nothing runs anymore, for reuse.
+void via_asm_release_prg(struct via_vm* vm, via_int addr, via_int size);
+
 via_int via_asm_label_lookup(struct via_vm* vm, const char* label);
 
+// Rewrites sequences of instructions in the given range of the program into
+// superinstructions.
+void via_asm_peephole(struct via_vm* vm, via_int addr, size_t size);
+
 #ifdef __cplusplus
 }
 #endif
@@ -6,6 +6,7 @@
 extern "C" {
 #endif
 
+struct via_value;
 struct via_vm;
 
 void via_f_syntax_transform(struct via_vm* vm);
@@ -28,6 +29,16 @@ void via_p_parse(struct via_vm* vm);
 
 void via_p_throw(struct via_vm* vm);
 
+// Applies one of the operators that have an opcode of their own (VIA_OP_ADD
+// through VIA_OP_GTE) to two values, and leaves the result in the return
+// register. Throws like the procedure bound to the operator would.
+void via_apply_operator(
+    struct via_vm* vm,
+    via_int op,
+    const struct via_value* a,
+    const struct via_value* b
+);
+
 void via_p_eq(struct via_vm* vm);
 
 void via_p_gt(struct via_vm* vm);
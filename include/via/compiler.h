@@ -0,0 +1,52 @@
+#pragma once
+
+#include <via/defs.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct via_value;
+struct via_vm;
+
+void via_init_compiler(struct via_vm* vm);
+
+// Adds a constant that the VM keeps alive, and returns its slot.
+via_int via_add_const(struct via_vm* vm, const struct via_value* value);
+
+// Adds an empty lookup cache for the symbol, and returns its index.
+via_int via_add_lookup_cache(
+    struct via_vm* vm,
+    const struct via_value* symbol
+);
+
+via_int via_compile(struct via_vm* vm, const struct via_value* expr);
+
+// Returns the code compiled for the expression, or NULL if there is none.
+const struct via_compiled_code* via_find_compiled(
+    const struct via_vm* vm,
+    const struct via_value* expr
+);
+
+// Points the compiled code table at the copy of the expression, made by a
+// copying collection into the same heap slot.
+void via_move_compiled(
+    struct via_vm* vm,
+    const struct via_value* expr,
+    const struct via_value* copy
+);
+
+// Returns the index of the first code span that the program counter is in,
+// or right past the end of, where a frame returns to after calling out from
+// the end of the code. The span after that one may start at the counter.
+size_t via_find_code_span(const struct via_vm* vm, via_int pc);
+
+// Drops the code at the index of the compiled code table, and releases its
+// part of the program, constants and lookup caches for reuse. Another entry
+// of the table may take its place. The code span is left for the caller to
+// remove.
+void via_drop_compiled(struct via_vm* vm, size_t index);
+
+#ifdef __cplusplus
+}
+#endif
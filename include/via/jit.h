@@ -0,0 +1,41 @@
+#pragma once
+
+#include <via/defs.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct via_vm;
+
+// Number of times an address has to be branched to before the JIT translates
+// the code at the address. Can be overridden by the VIA_JIT_THRESHOLD
+// environment variable, or by setting via_vm.jit_threshold.
+#define VIA_JIT_DEFAULT_THRESHOLD 64
+
+struct via_jit_block;
+struct via_jit_chunk;
+
+typedef via_int(*via_jit_code)(struct via_vm* vm);
+
+// Native translation of a straight-line sequence of instructions. The code
+// returns the address where the interpreter should resume execution.
+struct via_jit_block {
+    via_jit_code code;
+    via_int length;
+    via_opcode ops[];
+};
+
+void via_jit_init(struct via_vm* vm);
+
+void via_jit_free(struct via_vm* vm);
+
+via_bool via_jit_compile(struct via_vm* vm, via_int addr);
+
+// Counts a branch to the address, and executes any native code available for
+// it. Returns the address where interpretation should continue.
+via_int via_jit_enter(struct via_vm* vm, via_int addr);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,27 @@
+#pragma once
+
+#include <via/defs.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct via_vm;
+
+struct via_mark_pool;
+
+// Starts the threads that help the collecting thread mark during full
+// collections, for a total of thread_count marking threads. Returns false if
+// the pool could not be set up, in which case marking stays serial.
+via_bool via_parallel_mark_init(struct via_vm* vm, size_t thread_count);
+
+void via_parallel_mark_free(struct via_vm* vm);
+
+// Marks everything reachable from the values on the mark stack of the VM,
+// which are shared out among the marking threads. Work is balanced by the
+// threads stealing from one another.
+void via_parallel_mark(struct via_vm* vm);
+
+#ifdef __cplusplus
+}
+#endif
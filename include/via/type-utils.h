@@ -58,6 +58,14 @@ const struct via_value* via_make_env(
     const struct via_value* parent
 );
 
+// Makes an environment with room for the given number of bindings before it
+// has to grow.
+const struct via_value* via_make_env_sized(
+    struct via_vm* vm,
+    const struct via_value* parent,
+    size_t bindings
+);
+
 const struct via_value* via_escape_string(
     struct via_vm* vm,
     const struct via_value* value
@@ -23,7 +23,8 @@ enum via_type {
     VIA_V_BUILTIN,
     VIA_V_FRAME,
     VIA_V_HANDLE,
-    VIA_V_SYMBOL
+    VIA_V_SYMBOL,
+    VIA_V_ENV
 };
 
 enum via_op {
@@ -52,18 +53,67 @@ enum via_op {
     VIA_OP_DROP,
     VIA_OP_PUSHARG,
     VIA_OP_POPARG,
+    VIA_OP_LOADK,
+    VIA_OP_EQK,
+    VIA_OP_LOADL,
+    VIA_OP_LOADG,
+    VIA_OP_TYPESWITCH,
+    VIA_OP_NATIVEP,
+    // Operators applied to a value popped off the stack and the accumulator,
+    // like the procedures bound to them by default.
+    VIA_OP_ADD,
+    VIA_OP_SUB,
+    VIA_OP_MUL,
+    VIA_OP_DIV,
+    VIA_OP_EQ,
+    VIA_OP_NEQ,
+    VIA_OP_LT,
+    VIA_OP_GT,
+    VIA_OP_LTE,
+    VIA_OP_GTE,
+    // Superinstructions, which the assembler writes over the first instruction
+    // of the sequence they stand for. The rest of the sequence is left in
+    // place, to be branched into as before, and provides the operands of the
+    // instructions that follow the first.
+    VIA_OP_SKIPNT,
+    VIA_OP_LOADKSET,
+    VIA_OP_LOADKL,
+    VIA_OP_CALLBR,
     VIA_OP_DEBUG
 };
 
+// Garbage collector state of a value cell. Mark state is kept apart, in a
+// bitmap indexed by heap slot.
+enum via_cell_flags {
+    // Survived a collection, and is no longer part of the nursery.
+    VIA_CELL_OLD = 1,
+    // Recorded in the remembered set since the last collection.
+    VIA_CELL_REMEMBERED = 2,
+    // Owned by the VM rather than the heap, like the booleans and the frames
+    // on the control stack. Never collected, nor remembered.
+    VIA_CELL_IMMORTAL = 4,
+    // Expression with compiled code, whose constants are marked along with
+    // it.
+    VIA_CELL_COMPILED = 8
+};
+
 struct via_value {
     enum via_type type;
+    uint32_t slot;
     union {
         uintptr_t v_op;
         via_int v_int;
         via_float v_float;
         via_bool v_bool;
         const char* v_string;
-        const char* v_symbol;
+        struct {
+            const char* v_symbol;
+            // Hash of the name, by which the symbol is interned.
+            uint32_t v_symbol_hash;
+            // Set once the symbol has been bound in an environment other than
+            // the outermost one, which rules out caching its lookups.
+            via_bool v_symbol_scoped;
+        };
         struct {
             const struct via_value* v_car;
             const struct via_value* v_cdr;
@@ -74,9 +124,34 @@ struct via_value {
         };
         void* v_handle;
     };
-    uint8_t generation;
+    uint8_t flags;
 };
 
+// Integers in this range are not kept in cells, but in the value pointers
+// themselves, shifted left by one and tagged by setting the lowest bit, which
+// is always clear in the address of a cell. Such values have to be inspected
+// through the accessors below rather than by being dereferenced.
+#define VIA_FIXNUM_MIN ((via_int) (INTPTR_MIN >> 1))
+#define VIA_FIXNUM_MAX ((via_int) (INTPTR_MAX >> 1))
+
+static inline via_bool via_is_fixnum(const struct via_value* value) {
+    return (uintptr_t) value & 1;
+}
+
+static inline const struct via_value* via_fixnum(via_int v_int) {
+    return (const struct via_value*) (((uintptr_t) v_int << 1) | 1);
+}
+
+static inline enum via_type via_value_type(const struct via_value* value) {
+    return via_is_fixnum(value) ? VIA_V_INT : value->type;
+}
+
+static inline via_int via_value_int(const struct via_value* value) {
+    return via_is_fixnum(value)
+        ? (via_int) ((intptr_t) value >> 1)
+        : value->v_int;
+}
+
 #ifdef __cplusplus
 }
 #endif
@@ -24,49 +24,349 @@ enum via_reg {
     VIA_REG_COUNT
 };
 
+// Inline cache of a compiled lookup of a symbol in the outermost environment.
+// The cached binding is valid for as long as the lookup epoch of the VM stays
+// the same.
+struct via_lookup_cache {
+    // Constant slot of the symbol.
+    via_int symbol;
+    size_t epoch;
+    size_t slot;
+};
+
+// Code compiled for an expression, along with the constants and lookup caches
+// that only the code refers to. They are released together once the
+// expression is found dead.
+struct via_compiled_code {
+    via_int addr;
+    via_int size;
+    // Constant slots followed by lookup cache indices.
+    via_int* owned;
+    size_t consts_count;
+    size_t caches_count;
+};
+
+// Part of the program released by code that was dropped.
+struct via_program_range {
+    via_int addr;
+    via_int size;
+};
+
+// Part of the program holding the code compiled for the expression at the
+// heap slot.
+struct via_code_span {
+    via_int addr;
+    via_int size;
+    via_int slot;
+};
+
+// Layout of an environment: an array headed by the parent environment and the
+// number of bindings, followed by each bound symbol and its value. Procedure
+// applications keep their bindings in the order they were made, starting with
+// the formals, while an environment without a parent (the outermost one)
+// keeps them in an open addressing table keyed by symbol hash.
+enum via_env_slot {
+    VIA_ENV_PARENT,
+    VIA_ENV_COUNT,
+    VIA_ENV_BINDINGS
+};
+
 struct via_vm;
 typedef void(*via_bindable)(void* user_data);
 
+// Register frame on the control stack of the VM. It is headed by a frame
+// value, which is not a heap cell, and refers to the registers and program
+// counter behind it. Frames only leave the stack for the heap when captured.
+struct via_frame {
+    struct via_value value;
+    const struct via_value* regs[VIA_REG_COUNT];
+    struct via_value pc;
+};
+
+struct via_slab_chunk;
+struct via_mark_pool;
+struct via_sweeper;
+
+// Strategy used for allocating value cells.
+enum via_allocator {
+    // Cells are handed out from large chunks, and recycled on sweep.
+    VIA_ALLOC_SLAB,
+    // Every cell is allocated individually using via_calloc.
+    VIA_ALLOC_MALLOC
+};
+
+// Algorithm used for full garbage collections.
+enum via_collector {
+    // Values stay in place, and the dead ones are swept.
+    VIA_GC_MARK_SWEEP,
+    // Live values are evacuated into fresh slab chunks in the order they are
+    // reached, which lays out lists sequentially in memory. Values move, so
+    // the host has to refer to them by handle across collections. Requires
+    // the slab allocator, and makes every full collection stop the world.
+    VIA_GC_COPYING
+};
+
+// Policy for automatic garbage collection. Allocating a value requests a full
+// collection once the number of cells on the heap reaches the number that
+// survived the previous full collection multiplied by the growth factor, but
+// never before the heap holds min_heap_cells. In between, a minor collection
+// of the nursery is requested whenever nursery_cells values have been
+// allocated since the previous collection; zero disables minor collections.
+// Collections take place at the next safe point of the running program, once
+// no C function holds temporary values. With a non-zero step_cells, full
+// collections are incremental, and every safe point does that many units of
+// marking or sweeping work until the cycle is complete.
+struct via_gc_policy {
+    via_bool enabled;
+    via_float growth_factor;
+    size_t min_heap_cells;
+    size_t nursery_cells;
+    size_t step_cells;
+};
+
+enum via_gc_phase {
+    VIA_GC_IDLE,
+    VIA_GC_MARKING,
+    VIA_GC_SWEEPING
+};
+
+enum via_gc_pause_kind {
+    VIA_GC_PAUSE_MINOR,
+    VIA_GC_PAUSE_FULL,
+    // A slice of an incremental full collection.
+    VIA_GC_PAUSE_STEP
+};
+
+// Called after every garbage collection pause, with its duration.
+typedef void(*via_gc_pause_hook)(
+    struct via_vm* vm,
+    enum via_gc_pause_kind kind,
+    uint64_t duration_ns,
+    void* user_data
+);
+
+// Settings applied when creating a VM. A zero initialized struct holds the
+// default settings.
+struct via_vm_options {
+    enum via_allocator allocator;
+    enum via_collector collector;
+    // Number of threads marking the heap during full mark-sweep collections
+    // of large heaps, including the collecting thread. Zero or one marks on
+    // the collecting thread only, as does a library built without parallel
+    // marking.
+    size_t mark_threads;
+    // Frees the values found dead by full mark-sweep collections on a
+    // background thread, so that the program resumes right after marking.
+    // Requires via_free to be safe to call from another thread. Ignored by a
+    // library built without background sweeping.
+    via_bool background_sweep;
+};
+
+// Addresses of the core routines that the VM and its builtins transfer
+// control to, resolved once when the VM is created.
+struct via_routines {
+    via_int eval_proc;
+    via_int eval_transform_proc;
+    via_int transform_template_proc;
+    via_int lookup_proc;
+    via_int apply_proc;
+    via_int form_expand_proc;
+    via_int env_set_proc;
+    via_int default_except_proc;
+};
+
 struct via_vm {
     const struct via_value** heap;
     via_int heap_top;
-    via_int heap_free;
     via_int heap_cap;
 
+    // Stack of heap slots released by the last sweeps.
+    via_int* free_slots;
+    size_t free_slots_count;
+
+    // Heap slots of the values allocated since the last collection.
+    via_int* nursery;
+    size_t nursery_count;
+    size_t nursery_limit;
+
+    // Old values that may reference young ones, and young values held by
+    // root tables of the VM, which minor collections mark from.
+    const struct via_value** remembered;
+    size_t remembered_count;
+    size_t remembered_cap;
+    via_bool remembered_overflow;
+
+    struct via_gc_policy gc_policy;
+    size_t heap_cells;
+    // Cells on the heap right after the previous full collection, or zero
+    // before the first one.
+    size_t gc_survivors;
+    size_t gc_threshold;
+    size_t gc_count;
+    size_t minor_gc_count;
+    via_bool gc_requested;
+
+    // State of the full collection cycle; bitmap words above the sweep
+    // cursor have been swept.
+    enum via_gc_phase gc_phase;
+    via_int sweep_cursor;
+
+    via_gc_pause_hook gc_pause_hook;
+    void* gc_pause_data;
+
+    // One bit per heap slot, for the slots holding a value, and for the
+    // values reached by the collection in progress.
+    uint64_t* alloc_bits;
+    uint64_t* mark_bits;
+
+    // Work list of marked values whose references remain to be marked.
+    const struct via_value** mark_stack;
+    size_t mark_stack_top;
+    size_t mark_stack_cap;
+    via_bool mark_overflow;
+    // Flags of the values that marking leaves alone.
+    uint8_t mark_skip;
+    // Only used when the library is built with parallel marking.
+    struct via_mark_pool* mark_pool;
+    // Only used when the library is built with background sweeping.
+    struct via_sweeper* sweeper;
+
+    enum via_allocator allocator;
+    enum via_collector collector;
+    struct via_slab_chunk* slab_chunks;
+    struct via_value* slab_free;
+
     via_opcode* program;
     via_int write_cursor;
     size_t program_cap;
+    // Released parts below the write cursor, by address, none adjacent.
+    struct via_program_range* free_ranges;
+    size_t free_ranges_count;
+    size_t free_ranges_cap;
     
     char** labels;
     via_int* label_addrs;
     size_t labels_count;
     size_t labels_cap;
+    // Open addressing table of label indices plus one, keyed by the hashes of
+    // the labels.
+    via_int* label_index;
+    size_t label_index_cap;
+
+    struct via_routines routines;
 
     via_bindable* bound;
     void** bound_data;
+    // Whether each bound function was registered through
+    // via_register_direct_proc().
+    via_bool* bound_direct;
     size_t bound_count;
     size_t bound_cap;
 
-    struct via_value* symbols;
-
+    // Interned symbols, in an open addressing table keyed by the hashes of
+    // their names.
+    const struct via_value** symbols;
+    size_t symbols_count;
+    size_t symbols_cap;
+
+    // Values that are never collected, nor counted as part of the heap: false
+    // and true.
+    struct via_value* immortals;
+
+    // Constants referred to by the program. Those owned by compiled code are
+    // only kept alive by the code, and the rest by the VM.
+    const struct via_value** consts;
+    via_bool* consts_owned;
+    size_t consts_count;
+    size_t consts_cap;
+    // Released constant slots, to be reused, with room for every slot.
+    via_int* free_consts;
+    size_t free_consts_count;
+
+    // The outermost environment, which every other environment is assumed to
+    // descend from. Bumping the epoch invalidates the lookup caches, which
+    // happens when its bindings move, or a symbol first gets bound elsewhere.
+    const struct via_value* globals;
+    size_t lookup_epoch;
+    struct via_lookup_cache* lookup_caches;
+    size_t lookup_caches_count;
+    size_t lookup_caches_cap;
+    // Released lookup caches, to be reused, with room for every cache.
+    via_int* free_caches;
+    size_t free_caches_count;
+
+    // Values kept alive on behalf of the host, once for every time they were
+    // added.
+    const struct via_value** roots;
+    size_t roots_count;
+    size_t roots_cap;
+
+    // Handles of the standard streams, made by the port procedures when first
+    // asked for. They are kept here, out of reach of programs.
+    const struct via_value* stdin_handle;
+    const struct via_value* stdout_handle;
+    const struct via_value* stderr_handle;
+
+    // Open addressing table of the code compiled for each expression, keyed
+    // by the hashes of the expressions. Full collections drop the code of
+    // dead expressions, unless a frame is still running it.
+    const struct via_value** compiled_exprs;
+    struct via_compiled_code* compiled_code;
+    size_t compiled_count;
+    size_t compiled_cap;
+    // The code of the collectable expressions in the table, by address, for
+    // telling which expression a frame is running.
+    struct via_code_span* code_spans;
+    size_t code_spans_count;
+    size_t code_spans_cap;
+
+    // Only used when the library is built with VIA_ENABLE_JIT.
+    struct via_jit_block** jit_blocks;
+    uint32_t* jit_counters;
+    size_t jit_cap;
+    uint32_t jit_threshold;
+    struct via_jit_chunk* jit_chunks;
+
+    // Number of times each opcode was dispatched right after another, indexed
+    // by the first opcode times 256 plus the second. Only used when the
+    // library is built with VIA_ENABLE_OPCODE_PAIRS.
+    uint64_t* opcode_pairs;
+
+    // Current frame, either on the control stack or on the heap. Frames on
+    // the stack are treated as roots, and are above any frame on the heap.
     struct via_value* regs;
+    struct via_frame* frames;
+    size_t frames_top;
+    size_t frames_cap;
     const struct via_value* acc;
     const struct via_value* ret;
 
     const struct via_value** stack;
     size_t stack_size;
-    
-    uint8_t generation;
 };
 
 struct via_vm* via_create_vm();
 
+struct via_vm* via_create_vm_with_options(
+    const struct via_vm_options* options
+);
+
 void via_free_vm(struct via_vm* vm);
 
 struct via_value* via_make_value(struct via_vm* vm);
 
+// Returns a copy of the current frame on the heap, whose parent is the
+// current frame.
 const struct via_value* via_make_frame(struct via_vm* vm);
 
+// Moves the frames on the control stack to the heap, so that the current
+// frame may be referenced from values, and returns it.
+const struct via_value* via_capture_frame(struct via_vm* vm);
+
+// Hashes a name (32-bit FNV-1a), as done for symbols and labels. Symbols keep
+// the whole hash in their cells.
+uint32_t via_hash_name(const char* name);
+
 const struct via_value* via_sym(struct via_vm* vm, const char* name);
 
 void via_return_outer(struct via_vm* vm, const struct via_value* value);
@@ -99,6 +399,17 @@ void via_register_proc_context(
     void* user_data
 );
 
+// Registers a procedure whose bound function takes no formals, and binds
+// nothing in the environment it runs in. It is called directly on the
+// arguments on the stack, in the environment the procedure closes over,
+// rather than in one made for the application as via_register_proc() does.
+void via_register_direct_proc(
+    struct via_vm* vm,
+    const char* symbol,
+    const char* asm_label,
+    via_bindable func
+);
+
 void via_register_native_proc(
     struct via_vm* vm,
     const char* symbol,
@@ -143,10 +454,22 @@ void via_push(struct via_vm* vm, const struct via_value* value);
 
 const struct via_value* via_pop(struct via_vm* vm);
 
+// Arguments are passed on the stack. The !args register of a frame holds the
+// height of the stack where the frame started out, and the arguments are the
+// values pushed above it.
 void via_push_arg(struct via_vm* vm, const struct via_value* val);
 
+// Removes the first argument and returns it, or NULL if there is none.
 const struct via_value* via_pop_arg(struct via_vm* vm);
 
+size_t via_arg_count(struct via_vm* vm);
+
+// Returns the argument at the index, or NULL if there is none.
+const struct via_value* via_arg(struct via_vm* vm, size_t index);
+
+// Returns a list of the arguments from the index on.
+const struct via_value* via_arg_list(struct via_vm* vm, size_t index);
+
 void via_apply(struct via_vm* vm);
 
 void via_expand_form(struct via_vm* vm);
@@ -191,6 +514,49 @@ void via_b_env_set(struct via_vm* vm);
 
 void via_garbage_collect(struct via_vm* vm);
 
+void via_collect_nursery(struct via_vm* vm);
+
+// Does garbage collection work for about budget_us microseconds, starting a
+// full collection cycle unless one is in progress. Returns true once the cycle
+// is complete.
+via_bool via_gc_step(struct via_vm* vm, uint64_t budget_us);
+
+void via_set_gc_policy(struct via_vm* vm, const struct via_gc_policy* policy);
+
+struct via_gc_policy via_get_gc_policy(struct via_vm* vm);
+
+void via_set_gc_pause_hook(
+    struct via_vm* vm,
+    via_gc_pause_hook hook,
+    void* user_data
+);
+
+// Handles identify values across collections that move them. A handle does
+// not keep its value alive.
+via_int via_value_handle(const struct via_value* value);
+
+const struct via_value* via_handle_value(struct via_vm* vm, via_int handle);
+
+// Roots keep values alive on behalf of the host, which otherwise loses any
+// value it holds on to between runs to the collections of the next run. A
+// value stays alive until it has been removed as many times as it was added.
+// As the copying collector moves values, the host should keep track of rooted
+// values through their handles. Returns false if the root could not be added.
+via_bool via_add_root(struct via_vm* vm, const struct via_value* value);
+
+void via_remove_root(struct via_vm* vm, const struct via_value* value);
+
+// Has to accompany every store of a value into a cell that may have survived
+// a collection, where previous is the value being overwritten. A NULL
+// container stands for a root table of the VM, which minor collections do not
+// scan.
+void via_write_barrier(
+    struct via_vm* vm,
+    const struct via_value* container,
+    const struct via_value* previous,
+    const struct via_value* value
+);
+
 void via_catch(
     struct via_vm* vm,
     const struct via_value* expr,
@@ -206,6 +572,11 @@ const struct via_value* via_backtrace(
 
 void via_default_exception_handler(struct via_vm* vm);
 
+// Evaluates the expression in the expression register, and returns its value,
+// or the exception it threw. Every run starts out in the outermost
+// environment with no exception handler, whatever the previous run left in
+// the frame. An environment or handler set with via_set_env() or
+// via_set_exh() before the call is replaced.
 const struct via_value* via_run_eval(struct via_vm* vm);
 
 const struct via_value* via_run(struct via_vm* vm);
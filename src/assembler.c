@@ -1,6 +1,7 @@
 #include <via/assembler.h>
 
 #include <via/alloc.h>
+#include <via/value.h>
 #include <via/vm.h>
 
 #include <stdio.h>
@@ -8,6 +9,7 @@
 #include <string.h>
 
 #define INITIAL_SIZE 16
+#define INITIAL_FREE_RANGES_CAP 16
 
 struct via_program {
     via_opcode* code;
@@ -102,14 +104,15 @@ static struct via_program* via_asm_parse_instr(
     struct via_program* p,
     via_bool generate_code
 ) {
-    char op[9];
+    char op[11];
     char arg[81];
     int len = 0;
     via_bool has_arg = true;
     const char* c = p->cursor;
 
-    static const char const* op_arg_f = "%8[a-zA-Z]%*[ \t]%80[a-zA-Z0-9@!_-]%n";
-    static const char const* op_f = "%8[a-zA-Z]%n";
+    static const char const* op_arg_f =
+        "%10[a-zA-Z]%*[ \t]%80[a-zA-Z0-9@!_-]%n";
+    static const char const* op_f = "%10[a-zA-Z]%n";
     // Instruction with operand.
     if (!sscanf(c, op_arg_f, op, arg, &len) || len == 0) {
         // Try parsing without operand.
@@ -161,6 +164,26 @@ static struct via_program* via_asm_parse_instr(
                 *dest = VIA_OP_SNAP | ((arg == end) ? rel_arg : num_arg);
             } else if (strcmp("jmp", op) == 0) {
                 *dest = VIA_OP_JMP | ((arg == end) ? rel_arg : num_arg);
+            } else if (strcmp("loadk", op) == 0) {
+                *dest = VIA_OP_LOADK | num_arg;
+            } else if (strcmp("eqk", op) == 0) {
+                *dest = VIA_OP_EQK | num_arg;
+            } else if (strcmp("loadl", op) == 0) {
+                *dest = VIA_OP_LOADL | num_arg;
+            } else if (strcmp("loadg", op) == 0) {
+                *dest = VIA_OP_LOADG | num_arg;
+            } else if (strcmp("typeswitch", op) == 0) {
+                *dest = VIA_OP_TYPESWITCH | num_arg;
+            } else if (strcmp("nativep", op) == 0) {
+                *dest = VIA_OP_NATIVEP | num_arg;
+            } else if (strcmp("skipnt", op) == 0) {
+                *dest = VIA_OP_SKIPNT | num_arg;
+            } else if (strcmp("loadkset", op) == 0) {
+                *dest = VIA_OP_LOADKSET | num_arg;
+            } else if (strcmp("loadkl", op) == 0) {
+                *dest = VIA_OP_LOADKL | num_arg;
+            } else if (strcmp("callbr", op) == 0) {
+                *dest = VIA_OP_CALLBR | num_arg;
             } else if (strcmp("debug", op) == 0) {
                 *dest = VIA_OP_DEBUG | num_arg;
             } else {
@@ -205,6 +228,26 @@ static struct via_program* via_asm_parse_instr(
                 *dest = VIA_OP_PUSHARG;
             } else if (strcmp("poparg", op) == 0) {
                 *dest = VIA_OP_POPARG;
+            } else if (strcmp("add", op) == 0) {
+                *dest = VIA_OP_ADD;
+            } else if (strcmp("sub", op) == 0) {
+                *dest = VIA_OP_SUB;
+            } else if (strcmp("mul", op) == 0) {
+                *dest = VIA_OP_MUL;
+            } else if (strcmp("div", op) == 0) {
+                *dest = VIA_OP_DIV;
+            } else if (strcmp("eq", op) == 0) {
+                *dest = VIA_OP_EQ;
+            } else if (strcmp("neq", op) == 0) {
+                *dest = VIA_OP_NEQ;
+            } else if (strcmp("lt", op) == 0) {
+                *dest = VIA_OP_LT;
+            } else if (strcmp("gt", op) == 0) {
+                *dest = VIA_OP_GT;
+            } else if (strcmp("lte", op) == 0) {
+                *dest = VIA_OP_LTE;
+            } else if (strcmp("gte", op) == 0) {
+                *dest = VIA_OP_GTE;
             } else {
                 p->status = VIA_ASM_SYNTAX_ERROR;
                 return p;
@@ -348,6 +391,44 @@ static struct via_program* via_asm_second_pass(
     return p;
 }
 
+// Adds the label at the given index of the VM to the label index, unless an
+// earlier label by the same name is already there.
+static void via_asm_index_label(struct via_vm* vm, size_t index) {
+    const size_t mask = vm->label_index_cap - 1;
+    const char* label = vm->labels[index];
+    size_t i = via_hash_name(label) & mask;
+    for (; vm->label_index[i]; i = (i + 1) & mask) {
+        if (strcmp(label, vm->labels[vm->label_index[i] - 1]) == 0) {
+            return;
+        }
+    }
+    vm->label_index[i] = index + 1;
+}
+
+// Grows the label index to hold the given number of labels, and rebuilds it.
+static via_bool via_asm_reserve_index(struct via_vm* vm, size_t count) {
+    size_t cap = vm->label_index_cap ? vm->label_index_cap : INITIAL_SIZE;
+    while (count * 2 > cap) {
+        cap *= 2;
+    }
+    if (cap == vm->label_index_cap) {
+        return true;
+    }
+
+    via_int* index = via_calloc(cap, sizeof(via_int));
+    if (!index) {
+        return false;
+    }
+    via_free(vm->label_index);
+    vm->label_index = index;
+    vm->label_index_cap = cap;
+    for (size_t i = 0; i < vm->labels_count; ++i) {
+        via_asm_index_label(vm, i);
+    }
+
+    return true;
+}
+
 struct via_assembly_result via_assemble(struct via_vm* vm, const char* source) {
     struct via_program* program = via_calloc(sizeof(struct via_program), 1);
     if (!program) {
@@ -385,6 +466,7 @@ struct via_assembly_result via_assemble(struct via_vm* vm, const char* source) {
     for (size_t i = 0; i < program->code_size; ++i) {
         vm->program[program->target_addr + i] = program->code[i];
     }
+    via_asm_peephole(vm, program->target_addr, program->code_size);
 
     while (vm->labels_count + program->labels_count > vm->labels_cap) {
         char** labels = via_realloc(
@@ -405,12 +487,17 @@ struct via_assembly_result via_assemble(struct via_vm* vm, const char* source) {
         vm->label_addrs = addrs;
         vm->labels_cap *= 2;
     }
+    if (!via_asm_reserve_index(vm, vm->labels_count + program->labels_count)) {
+        program->status = VIA_ASM_OUT_OF_MEMORY;
+        goto cleanup_code;
+    }
 
     for (size_t i = 0, j = vm->labels_count; i < program->labels_count; ++i) {
         if (program->labels[i][0] != '@') {
             vm->labels[j] = program->labels[i];
-            vm->label_addrs[j++] =
+            vm->label_addrs[j] =
                 program->label_addrs[i] + program->target_addr;
+            via_asm_index_label(vm, j++);
             vm->labels_count++;
         } else {
             via_free(program->labels[i]);
@@ -455,6 +542,25 @@ const char* via_asm_error_string(enum via_assembly_status status) {
 }
 
 via_int via_asm_reserve_prg(struct via_vm* vm, via_int size) {
+    for (size_t i = 0; i < vm->free_ranges_count; ++i) {
+        struct via_program_range* range = &vm->free_ranges[i];
+        if (range->size >= size) {
+            const via_int addr = range->addr;
+            range->addr += size;
+            range->size -= size;
+            if (!range->size) {
+                memmove(
+                    range,
+                    range + 1,
+                    sizeof(struct via_program_range)
+                        * (vm->free_ranges_count - i - 1)
+                );
+                vm->free_ranges_count--;
+            }
+            return addr;
+        }
+    }
+
     via_int cursor = vm->write_cursor;
     while (cursor + size > vm->program_cap) {
         via_opcode* new_program = via_realloc(
@@ -464,18 +570,142 @@ via_int via_asm_reserve_prg(struct via_vm* vm, via_int size) {
         if (!new_program) {
             return -1;
         }
+        vm->program = new_program;
         vm->program_cap *= 2;
     }
     vm->write_cursor += size;
     return cursor;
 }
 
+void via_asm_release_prg(struct via_vm* vm, via_int addr, via_int size) {
+    struct via_program_range* ranges = vm->free_ranges;
+
+    // Find the first range above the released one.
+    size_t lo = 0;
+    size_t hi = vm->free_ranges_count;
+    while (lo < hi) {
+        const size_t mid = lo + (hi - lo) / 2;
+        if (ranges[mid].addr < addr) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    const via_bool joins_below = lo > 0
+        && ranges[lo - 1].addr + ranges[lo - 1].size == addr;
+    const via_bool joins_above = lo < vm->free_ranges_count
+        && addr + size == ranges[lo].addr;
+    if (joins_below && joins_above) {
+        ranges[lo - 1].size += size + ranges[lo].size;
+        memmove(
+            &ranges[lo],
+            &ranges[lo + 1],
+            sizeof(struct via_program_range)
+                * (vm->free_ranges_count - lo - 1)
+        );
+        vm->free_ranges_count--;
+    } else if (joins_below) {
+        ranges[lo - 1].size += size;
+    } else if (joins_above) {
+        ranges[lo].addr = addr;
+        ranges[lo].size += size;
+    } else {
+        if (vm->free_ranges_count == vm->free_ranges_cap) {
+            const size_t new_cap = vm->free_ranges_cap
+                ? vm->free_ranges_cap * 2
+                : INITIAL_FREE_RANGES_CAP;
+            struct via_program_range* new_ranges = via_realloc(
+                ranges,
+                sizeof(struct via_program_range) * new_cap
+            );
+            if (!new_ranges) {
+                // The range is lost to reuse, but nothing else is.
+                return;
+            }
+            vm->free_ranges = ranges = new_ranges;
+            vm->free_ranges_cap = new_cap;
+        }
+        memmove(
+            &ranges[lo + 1],
+            &ranges[lo],
+            sizeof(struct via_program_range) * (vm->free_ranges_count - lo)
+        );
+        ranges[lo] = (struct via_program_range) { addr, size };
+        vm->free_ranges_count++;
+    }
+
+    // A range at the end of the program goes back to the write cursor.
+    struct via_program_range* last = &ranges[vm->free_ranges_count - 1];
+    if (last->addr + last->size == vm->write_cursor) {
+        vm->write_cursor = last->addr;
+        vm->free_ranges_count--;
+    }
+}
+
 via_int via_asm_label_lookup(struct via_vm* vm, const char* label) {
-    for (size_t i = 0; i < vm->labels_count; ++i) {
-        if (strcmp(label, vm->labels[i]) == 0) {
-            return vm->label_addrs[i];
+    if (!vm->label_index_cap) {
+        return -1;
+    }
+
+    const size_t mask = vm->label_index_cap - 1;
+    size_t i = via_hash_name(label) & mask;
+    for (; vm->label_index[i]; i = (i + 1) & mask) {
+        const via_int index = vm->label_index[i] - 1;
+        if (strcmp(label, vm->labels[index]) == 0) {
+            return vm->label_addrs[index];
         }
     }
     return -1;
 }
 
+
+// Returns the type tested by the type predicate opcode, or -1 if the opcode
+// is something else.
+static via_int via_asm_predicate_type(via_opcode op) {
+    switch (op & 0xff) {
+    case VIA_OP_PAIRP:
+        return VIA_V_PAIR;
+    case VIA_OP_SYMBOLP:
+        return VIA_V_SYMBOL;
+    case VIA_OP_FORMP:
+        return VIA_V_FORM;
+    case VIA_OP_FRAMEP:
+        return VIA_V_FRAME;
+    case VIA_OP_BUILTINP:
+        return VIA_V_BUILTIN;
+    default:
+        return -1;
+    }
+}
+
+// The sequences were picked from the opcode pair counts of the test programs
+// (see VIA_ENABLE_OPCODE_PAIRS). Only the first instruction of a sequence is
+// replaced, so any branch into the sequence still lands on what it expects.
+void via_asm_peephole(struct via_vm* vm, via_int addr, size_t size) {
+    via_opcode* code = &vm->program[addr];
+    for (size_t i = 0; i < size; ++i) {
+        const via_int operand = ((via_int) code[i]) >> 8;
+        const via_int next = (i + 1 < size) ? (code[i + 1] & 0xff) : -1;
+        const via_int type = via_asm_predicate_type(code[i]);
+
+        if (type >= 0 && next == VIA_OP_SKIPZ) {
+            // A type test, and a branch on the result.
+            code[i] = VIA_OP_SKIPNT | (type << 8);
+        } else if ((code[i] & 0xff) == VIA_OP_LOADK && next == VIA_OP_SET) {
+            // A constant stored in a register, usually the expression.
+            code[i] = VIA_OP_LOADKSET | (operand << 8);
+        } else if ((code[i] & 0xff) == VIA_OP_LOADK && next == VIA_OP_LOADL) {
+            // A lookup of a binding of the procedure scope.
+            code[i] = VIA_OP_LOADKL | (operand << 8);
+        } else if (
+            (code[i] & 0xff) == VIA_OP_CALL
+                && operand >= 0
+                && operand < vm->write_cursor
+                && (vm->program[operand] & 0xff) == VIA_OP_CALLB
+        ) {
+            // A call to a bound routine, such as apply-proc.
+            code[i] = VIA_OP_CALLBR | (operand << 8);
+        }
+    }
+}
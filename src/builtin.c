@@ -16,63 +16,75 @@
 #include <stdlib.h>
 #include <string.h>
 
-#define OP(INTOP, FLOATOP)\
-    if (!via_reg_args(vm) || !via_reg_args(vm)->v_cdr) {\
+#define REQUIRE_TWO_ARGS()\
+    if (via_arg_count(vm) < 2) {\
         via_throw(vm, via_except_argument_error(vm, TWO_ARGS));\
         return;\
-    }\
-    const struct via_value* a = via_pop_arg(vm);\
-    const struct via_value* b = via_pop_arg(vm);\
+    }
+
+#define REQUIRE_NUMBERS()\
+    const enum via_type a_type = via_value_type(a);\
+    const enum via_type b_type = via_value_type(b);\
     if (\
-        (a->type < VIA_V_INT || a->type > VIA_V_FLOAT)\
-            || (b->type < VIA_V_INT || b->type > VIA_V_FLOAT)\
+        (a_type < VIA_V_INT || a_type > VIA_V_FLOAT)\
+            || (b_type < VIA_V_INT || b_type > VIA_V_FLOAT)\
     ) {\
         via_throw(vm, via_except_invalid_type(vm, ARITH_NUMERIC));\
         return;\
-    }\
-    if (a->type == VIA_V_FLOAT || b->type == VIA_V_FLOAT) {\
+    }
+
+#define OP(INTOP, FLOATOP)\
+    REQUIRE_NUMBERS()\
+    if (a_type == VIA_V_FLOAT || b_type == VIA_V_FLOAT) {\
         vm->ret = via_make_float(vm, FLOATOP);\
     } else {\
         vm->ret = via_make_int(vm, INTOP);\
     }
 
-#define INFIX_OP(OPERATOR)\
-    OP(\
-        a->v_int OPERATOR b->v_int,\
-        (a->type == VIA_V_INT ? a->v_int : a->v_float)\
-            OPERATOR (b->type == VIA_V_INT ? b->v_int : b->v_float)\
-    )
+#define NUMBER(VALUE, TYPE)\
+    (TYPE == VIA_V_INT ? via_value_int(VALUE) : VALUE->v_float)
+
+// INT_OP(a, b, &result) computes the result for a pair of integers, and
+// evaluates to whether it overflowed, like the __builtin_*_overflow functions
+// do. Overflow throws rather than wrapping around.
+#define INFIX_OP(OPERATOR, INT_OP)\
+    REQUIRE_NUMBERS()\
+    if (a_type == VIA_V_FLOAT || b_type == VIA_V_FLOAT) {\
+        vm->ret = via_make_float(\
+            vm,\
+            NUMBER(a, a_type) OPERATOR NUMBER(b, b_type)\
+        );\
+    } else {\
+        via_int result;\
+        if (INT_OP(via_value_int(a), via_value_int(b), &result)) {\
+            via_throw(vm, via_except_runtime_error(vm, INT_OVERFLOW));\
+            return;\
+        }\
+        vm->ret = via_make_int(vm, result);\
+    }
 
 #define PREFIX_OP(OPERATOR)\
     OP(\
-        OPERATOR(a->v_int, b->v_int),\
-        OPERATOR(\
-            a->type == VIA_V_INT ? a->v_int : a->v_float,\
-            b->type == VIA_V_INT ? b->v_int : b->v_float\
-        )\
+        OPERATOR(via_value_int(a), via_value_int(b)),\
+        OPERATOR(NUMBER(a, a_type), NUMBER(b, b_type))\
     )
 
 #define COMPARISON(OPERATOR)\
-    if (!via_reg_args(vm) || !via_reg_args(vm)->v_cdr) {\
-        via_throw(vm, via_except_argument_error(vm, TWO_ARGS));\
-        return;\
-    }\
-    const struct via_value* a = via_pop_arg(vm);\
-    const struct via_value* b = via_pop_arg(vm);\
+    const enum via_type a_type = via_value_type(a);\
+    const enum via_type b_type = via_value_type(b);\
     if (\
-        a->type >= VIA_V_INT && b->type >= VIA_V_INT\
-            && a->type <= VIA_V_FLOAT && b->type <= VIA_V_FLOAT\
+        a_type >= VIA_V_INT && b_type >= VIA_V_INT\
+            && a_type <= VIA_V_FLOAT && b_type <= VIA_V_FLOAT\
     ) {\
         vm->ret = via_make_bool(\
             vm,\
-            (a->type == VIA_V_INT ? a->v_int : a->v_float)\
-                OPERATOR (b->type == VIA_V_INT ? b->v_int : b->v_float)\
+            NUMBER(a, a_type) OPERATOR NUMBER(b, b_type)\
         );\
-    } else if (a->type == b->type && a->type == VIA_V_BOOL) {\
+    } else if (a_type == b_type && a_type == VIA_V_BOOL) {\
         vm->ret = via_make_bool(vm, a->v_bool OPERATOR b->v_bool);\
     } else if (\
-        a->type == b->type\
-            && (a->type == VIA_V_STRING || a->type == VIA_V_STRINGVIEW)\
+        a_type == b_type\
+            && (a_type == VIA_V_STRING || a_type == VIA_V_STRINGVIEW)\
     ) {\
         vm->ret = via_make_bool(\
             vm,\
@@ -82,6 +94,10 @@
         vm->ret = via_make_bool(vm, a OPERATOR b);\
     }
 
+#define APPLY_OPERATOR(OP)\
+    REQUIRE_TWO_ARGS()\
+    via_apply_operator(vm, OP, via_arg(vm, 0), via_arg(vm, 1));
+
 static const struct via_value* via_expand_lookup(
     const struct via_value* symbol,
     const struct via_value* meta_var
@@ -100,9 +116,9 @@ static const struct via_value* via_expand_recurse(
 ) {
     if (!value) {
         return NULL;
-    } else if (value->type == VIA_V_SYMBOL) {
+    } else if (via_value_type(value) == VIA_V_SYMBOL) {
         return via_expand_lookup(value, meta_var);
-    } else if (value->type == VIA_V_PAIR) {
+    } else if (via_value_type(value) == VIA_V_PAIR) {
         return via_make_pair(
             vm,
             via_expand_recurse(vm, meta_var, value->v_car),
@@ -141,32 +157,13 @@ static void via_expand_template(struct via_vm* vm) {
 }
 
 static void via_transform_template(struct via_vm* vm) {
-    // TODO: Improve address caching.
-    static struct via_vm* cached_instance = NULL;
-    static via_int eval_transform_proc = -1;
-    if (vm != cached_instance) {
-        cached_instance = vm;
-        eval_transform_proc = via_asm_label_lookup(vm, "eval-transform-proc");
-    }
-
     via_expand_template(vm);
 
     via_set_expr(vm, vm->ret);
-    via_reg_pc(vm)->v_int = eval_transform_proc;
+    via_reg_pc(vm)->v_int = vm->routines.eval_transform_proc;
 }
 
 void via_f_syntax_transform(struct via_vm* vm) {
-    // TODO: Improve address caching.
-    static struct via_vm* cached_instance = NULL;
-    static via_int transform_template_proc = -1;
-    if (vm != cached_instance) {
-        cached_instance = vm;
-        transform_template_proc = via_asm_label_lookup(
-            vm,
-            "transform-template-proc"
-        );
-    }
-
     const struct via_value* ctxt = via_reg_ctxt(vm)->v_cdr;
 
     if (!ctxt) {
@@ -184,7 +181,7 @@ void via_f_syntax_transform(struct via_vm* vm) {
             vm,
             formals,
             body,
-            via_make_builtin(vm, transform_template_proc)
+            via_make_builtin(vm, vm->routines.transform_template_proc)
         )
     );
 }
@@ -221,11 +218,11 @@ void via_f_lambda(struct via_vm* vm) {
         via_throw(vm, via_except_syntax_error(vm, ""));
         return;
     }
-    if (ctxt->type != VIA_V_PAIR) {
+    if (via_value_type(ctxt) != VIA_V_PAIR) {
         goto throw_syntax_error;
     }
     const struct via_value* formals = ctxt->v_car;
-    if (ctxt->v_cdr->type != VIA_V_PAIR) {
+    if (via_value_type(ctxt->v_cdr) != VIA_V_PAIR) {
         goto throw_syntax_error;
     }
     const struct via_value* body = ctxt->v_cdr->v_car;
@@ -241,59 +238,46 @@ throw_syntax_error:
 }
 
 void via_f_catch(struct via_vm* vm) {
-    // TODO: Improve address caching.
-    static struct via_vm* cached_instance = NULL;
-    static via_int eval_proc = -1;
-    if (vm != cached_instance) {
-        cached_instance = vm;
-        eval_proc = via_asm_label_lookup(vm, "eval-proc");
-    }
-
     const struct via_value* ctxt = via_reg_ctxt(vm)->v_cdr;
     if (!ctxt) {
         via_throw(vm, via_except_syntax_error(vm, ""));
         return;
     }
     if (
-        ctxt->type != VIA_V_PAIR
+        via_value_type(ctxt) != VIA_V_PAIR
             || !ctxt->v_cdr
-            || ctxt->v_cdr->type != VIA_V_PAIR
+            || via_value_type(ctxt->v_cdr) != VIA_V_PAIR
     ) {
         via_throw(vm, via_except_syntax_error(vm, MALFORMED_CATCH));
         return;
     }
     via_catch(vm, ctxt->v_car, ctxt->v_cdr->v_car);
-    via_reg_pc(vm)->v_int = eval_proc;
+    via_reg_pc(vm)->v_int = vm->routines.eval_proc;
 }
 
 void via_p_eval(struct via_vm* vm) {
-    // TODO: Improve address caching.
-    static struct via_vm* cached_instance = NULL;
-    static via_int eval_proc = -1;
-    if (vm != cached_instance) {
-        cached_instance = vm;
-        eval_proc = via_asm_label_lookup(vm, "eval-proc");
-    }
-
-    via_set_env(vm, via_reg_env(vm)->v_car);
-    via_set_expr(vm, via_pop_arg(vm));
-    via_reg_pc(vm)->v_int = eval_proc;
+    // Evaluates in the environment the procedure closes over, which it runs
+    // in as a direct procedure.
+    via_set_expr(vm, via_arg(vm, 0));
+    via_reg_pc(vm)->v_int = vm->routines.eval_proc;
 }
 
 void via_p_parse(struct via_vm* vm) {
-    const struct via_value* args = via_reg_args(vm);
-    if (!args || args->v_cdr) {
+    if (via_arg_count(vm) != 1) {
         via_throw(vm, via_except_argument_error(vm, ONE_ARG));
         return;
     }
 
-    const struct via_value* source = via_pop_arg(vm);
-    if (source->type != VIA_V_STRING && source->type != VIA_V_STRINGVIEW) {
+    const struct via_value* source = via_arg(vm, 0);
+    if (
+        via_value_type(source) != VIA_V_STRING
+            && via_value_type(source) != VIA_V_STRINGVIEW
+    ) {
         via_throw(vm, via_except_invalid_type(vm, STRING_REQUIRED));
         return;
     }
 
-    const struct via_value* file_path = via_pop_arg(vm);
+    const struct via_value* file_path = via_arg(vm, 1);
     const struct via_value* result = via_parse(
         vm,
         source->v_string,
@@ -311,8 +295,8 @@ void via_p_parse(struct via_vm* vm) {
 }
 
 void via_p_throw(struct via_vm* vm) {
-    const struct via_value* excn = via_pop_arg(vm);
-    if (!excn || via_reg_args(vm)) {
+    const struct via_value* excn = via_arg(vm, 0);
+    if (!excn || via_arg_count(vm) != 1) {
         via_throw(vm, via_except_argument_error(vm, ONE_ARG));
         return;
     }
@@ -324,37 +308,105 @@ void via_p_throw(struct via_vm* vm) {
     via_throw(vm, excn);
 }
 
+// Divides two integers, the divisor not being zero, and returns whether the
+// quotient overflowed, which only INT64_MIN / -1 does.
+static via_bool via_div_overflow(via_int a, via_int b, via_int* result) {
+    if (a == INT64_MIN && b == -1) {
+        return true;
+    }
+    *result = a / b;
+    return false;
+}
+
+void via_apply_operator(
+    struct via_vm* vm,
+    via_int op,
+    const struct via_value* a,
+    const struct via_value* b
+) {
+    switch (op) {
+    case VIA_OP_ADD: {
+        INFIX_OP(+, __builtin_add_overflow)
+        break;
+    }
+    case VIA_OP_SUB: {
+        INFIX_OP(-, __builtin_sub_overflow)
+        break;
+    }
+    case VIA_OP_MUL: {
+        INFIX_OP(*, __builtin_mul_overflow)
+        break;
+    }
+    case VIA_OP_DIV: {
+        if (
+            via_value_type(a) == VIA_V_INT
+                && via_value_type(b) == VIA_V_INT
+                && via_value_int(b) == 0
+        ) {
+            via_throw(vm, via_except_runtime_error(vm, DIVIDE_BY_ZERO));
+            return;
+        }
+        INFIX_OP(/, via_div_overflow)
+        break;
+    }
+    case VIA_OP_EQ: {
+        COMPARISON(==)
+        break;
+    }
+    case VIA_OP_NEQ: {
+        COMPARISON(!=)
+        break;
+    }
+    case VIA_OP_LT: {
+        COMPARISON(<)
+        break;
+    }
+    case VIA_OP_GT: {
+        COMPARISON(>)
+        break;
+    }
+    case VIA_OP_LTE: {
+        COMPARISON(<=)
+        break;
+    }
+    case VIA_OP_GTE: {
+        COMPARISON(>=)
+        break;
+    }
+    }
+}
+
 void via_p_eq(struct via_vm* vm) {
-    COMPARISON(==)
+    APPLY_OPERATOR(VIA_OP_EQ)
 }
 
 void via_p_gt(struct via_vm* vm) {
-    COMPARISON(>)
+    APPLY_OPERATOR(VIA_OP_GT)
 }
 
 void via_p_lt(struct via_vm* vm) {
-    COMPARISON(<)
+    APPLY_OPERATOR(VIA_OP_LT)
 }
 
 void via_p_gte(struct via_vm* vm) {
-    COMPARISON(>=)
+    APPLY_OPERATOR(VIA_OP_GTE)
 }
 
 void via_p_lte(struct via_vm* vm) {
-    COMPARISON(<=)
+    APPLY_OPERATOR(VIA_OP_LTE)
 }
 
 void via_p_neq(struct via_vm* vm) {
-    COMPARISON(!=)
+    APPLY_OPERATOR(VIA_OP_NEQ)
 }
 
 void via_p_not(struct via_vm* vm) {
-    const struct via_value* arg = via_pop_arg(vm);
-    if (!arg || via_reg_args(vm)) {
+    const struct via_value* arg = via_arg(vm, 0);
+    if (!arg || via_arg_count(vm) != 1) {
         via_throw(vm, via_except_argument_error(vm, ONE_ARG));
         return;
     }
-    if (arg->type != VIA_V_BOOL) {
+    if (via_value_type(arg) != VIA_V_BOOL) {
         via_throw(vm, via_except_invalid_type(vm, BOOL_REQUIRED));
         return;
     }
@@ -362,7 +414,7 @@ void via_p_not(struct via_vm* vm) {
 }
 
 void via_p_context(struct via_vm* vm) {
-    if (via_reg_args(vm)) {
+    if (via_arg_count(vm)) {
         via_throw(vm, via_except_argument_error(vm, NO_ARGS));
         return;
     }
@@ -370,18 +422,20 @@ void via_p_context(struct via_vm* vm) {
 }
 
 void via_p_make_exception(struct via_vm* vm) {
-    const struct via_value* args = via_reg_args(vm);
-    if (!args || !args->v_cdr || args->v_cdr->v_cdr) {
+    if (via_arg_count(vm) != 2) {
         via_throw(vm, via_except_argument_error(vm, TWO_ARGS));
         return;
     }
-    const struct via_value* symbol = via_pop_arg(vm);
-    if (symbol->type != VIA_V_SYMBOL) {
+    const struct via_value* symbol = via_arg(vm, 0);
+    if (via_value_type(symbol) != VIA_V_SYMBOL) {
         via_throw(vm, via_except_invalid_type(vm, SYMBOL_REQUIRED));
         return;
     }
-    const struct via_value* message = via_pop_arg(vm);
-    if (message->type != VIA_V_STRING && message->type != VIA_V_STRINGVIEW) {
+    const struct via_value* message = via_arg(vm, 1);
+    if (
+        via_value_type(message) != VIA_V_STRING
+            && via_value_type(message) != VIA_V_STRINGVIEW
+    ) {
         via_throw(vm, via_except_invalid_type(vm, STRING_REQUIRED));
         return;
     }
@@ -390,7 +444,7 @@ void via_p_make_exception(struct via_vm* vm) {
 }
 
 void via_p_exception(struct via_vm* vm) {
-    if (via_reg_args(vm)) {
+    if (via_arg_count(vm)) {
         via_throw(vm, via_except_argument_error(vm, NO_ARGS));
         return;
     }
@@ -398,8 +452,8 @@ void via_p_exception(struct via_vm* vm) {
 }
 
 void via_p_exception_type(struct via_vm* vm) {
-    const struct via_value* excn = via_pop_arg(vm);
-    if (!excn || via_reg_args(vm)) {
+    const struct via_value* excn = via_arg(vm, 0);
+    if (!excn || via_arg_count(vm) != 1) {
         via_throw(vm, via_except_argument_error(vm, ONE_ARG));
         return;
     }
@@ -412,8 +466,8 @@ void via_p_exception_type(struct via_vm* vm) {
 }
 
 void via_p_exception_message(struct via_vm* vm) {
-    const struct via_value* excn = via_pop_arg(vm);
-    if (!excn || via_reg_args(vm)) {
+    const struct via_value* excn = via_arg(vm, 0);
+    if (!excn || via_arg_count(vm) != 1) {
         via_throw(vm, via_except_argument_error(vm, ONE_ARG));
         return;
     }
@@ -426,8 +480,8 @@ void via_p_exception_message(struct via_vm* vm) {
 }
 
 void via_p_exception_frame(struct via_vm* vm) {
-    const struct via_value* excn = via_pop_arg(vm);
-    if (!excn || via_reg_args(vm)) {
+    const struct via_value* excn = via_arg(vm, 0);
+    if (!excn || via_arg_count(vm) != 1) {
         via_throw(vm, via_except_argument_error(vm, ONE_ARG));
         return;
     }
@@ -440,23 +494,22 @@ void via_p_exception_frame(struct via_vm* vm) {
 }
 
 void via_p_cons(struct via_vm* vm) {
-    const struct via_value* args = via_reg_args(vm);
-    if (!args || (args->v_cdr && args->v_cdr->v_cdr)) {
+    if (!via_arg_count(vm) || via_arg_count(vm) > 2) {
         via_throw(vm, via_except_argument_error(vm, TWO_ARGS));
         return;
     }
-    const struct via_value* car = via_pop_arg(vm);
-    const struct via_value* cdr = via_pop_arg(vm);
+    const struct via_value* car = via_arg(vm, 0);
+    const struct via_value* cdr = via_arg(vm, 1);
     vm->ret = via_make_pair(vm, car, cdr);
 }
 
 void via_p_car(struct via_vm* vm) {
-    if (via_reg_args(vm) == NULL) {
+    if (!via_arg_count(vm)) {
         via_throw(vm, via_except_argument_error(vm, ONE_ARG));
         return;
     }
-    const struct via_value* p = via_pop_arg(vm);
-    if (!p || p->type != VIA_V_PAIR) {
+    const struct via_value* p = via_arg(vm, 0);
+    if (!p || via_value_type(p) != VIA_V_PAIR) {
         via_throw(vm, via_except_invalid_type(vm, PAIR_ARG));
         return;
     }
@@ -464,12 +517,12 @@ void via_p_car(struct via_vm* vm) {
 }
 
 void via_p_cdr(struct via_vm* vm) {
-    if (via_reg_args(vm) == NULL) {
+    if (!via_arg_count(vm)) {
         via_throw(vm, via_except_argument_error(vm, ONE_ARG));
         return;
     }
-    const struct via_value* p = via_pop_arg(vm);
-    if (!p || p->type != VIA_V_PAIR) {
+    const struct via_value* p = via_arg(vm, 0);
+    if (!p || via_value_type(p) != VIA_V_PAIR) {
         via_throw(vm, via_except_invalid_type(vm, PAIR_ARG));
         return;
     }
@@ -477,103 +530,112 @@ void via_p_cdr(struct via_vm* vm) {
 }
 
 void via_p_list(struct via_vm* vm) {
-    vm->ret = via_reg_args(vm);
+    vm->ret = via_arg_list(vm, 0);
 }
 
 void via_p_reverse_list(struct via_vm* vm) {
-    const struct via_value* args = via_reg_args(vm);
-    if (args == NULL || args->v_cdr) {
+    if (via_arg_count(vm) != 1) {
         via_throw(vm, via_except_argument_error(vm, ONE_ARG));
         return;
     }
-    vm->ret = via_reverse_list(vm, via_pop_arg(vm));
+    vm->ret = via_reverse_list(vm, via_arg(vm, 0));
 }
 
 void via_p_str_concat(struct via_vm* vm) {
-    const struct via_value* args = via_reg_args(vm);
-    if (args == NULL || !args->v_cdr || args->v_cdr->v_cdr) {
+    if (via_arg_count(vm) != 2) {
         via_throw(vm, via_except_argument_error(vm, TWO_ARGS));
         return;
     }
 
-    const struct via_value* a = via_pop_arg(vm);
-    const struct via_value* b = via_pop_arg(vm);
+    const struct via_value* a = via_arg(vm, 0);
+    const struct via_value* b = via_arg(vm, 1);
     
     vm->ret = via_string_concat(vm, a, b);
 }
 
 void via_p_debug(struct via_vm* vm) {
-    printf("DEBUG: %s\n", via_to_string(vm, via_pop_arg(vm))->v_string);
+    printf("DEBUG: %s\n", via_to_string(vm, via_arg(vm, 0))->v_string);
 }
 
 void via_p_backtrace(struct via_vm* vm) {
-    if (via_reg_args(vm) == NULL || via_reg_args(vm)->v_cdr) {
+    if (via_arg_count(vm) != 1) {
         via_throw(vm, via_except_argument_error(vm, ONE_ARG));
         return;
     }
-    vm->ret = via_backtrace(vm, via_pop_arg(vm));
+    vm->ret = via_backtrace(vm, via_arg(vm, 0));
 }
 
 void via_p_add(struct via_vm* vm) {
-    INFIX_OP(+)
+    APPLY_OPERATOR(VIA_OP_ADD)
 }
 
 void via_p_sub(struct via_vm* vm) {
-    INFIX_OP(-)
+    APPLY_OPERATOR(VIA_OP_SUB)
 }
 
 void via_p_mul(struct via_vm* vm) {
-    INFIX_OP(*)
+    APPLY_OPERATOR(VIA_OP_MUL)
 }
 
 void via_p_div(struct via_vm* vm) {
-    INFIX_OP(/)
+    APPLY_OPERATOR(VIA_OP_DIV)
 }
 
 void via_p_mod(struct via_vm* vm) {
-    if (via_reg_args(vm) == NULL || via_reg_args(vm)->v_cdr == NULL) {
+    if (via_arg_count(vm) < 2) {
         via_throw(vm, via_except_argument_error(vm, TWO_ARGS));
         return;
     }
-    const struct via_value* a = via_pop_arg(vm);
-    const struct via_value* b = via_pop_arg(vm);
-    if (a->type != VIA_V_INT || b->type != VIA_V_INT) {
+    const struct via_value* a = via_arg(vm, 0);
+    const struct via_value* b = via_arg(vm, 1);
+    if (via_value_type(a) != VIA_V_INT || via_value_type(b) != VIA_V_INT) {
         via_throw(vm, via_except_invalid_type(vm, MODULO_INT));
         return;
     }
-    vm->ret = via_make_int(vm, a->v_int % b->v_int);
+    if (via_value_int(b) == 0) {
+        via_throw(vm, via_except_runtime_error(vm, DIVIDE_BY_ZERO));
+        return;
+    }
+    // INT64_MIN % -1 traps like the division does, though it is zero.
+    vm->ret = via_make_int(
+        vm,
+        via_value_int(b) == -1 ? 0 : via_value_int(a) % via_value_int(b)
+    );
 }
 
 void via_p_pow(struct via_vm* vm) {
+    REQUIRE_TWO_ARGS()
+    const struct via_value* a = via_arg(vm, 0);
+    const struct via_value* b = via_arg(vm, 1);
     PREFIX_OP(pow)
 }
 
 void via_p_sin(struct via_vm* vm) {
-    if (via_reg_args(vm) == NULL || via_reg_args(vm)->v_cdr != NULL) {
+    if (via_arg_count(vm) != 1) {
         via_throw(vm, via_except_argument_error(vm, ONE_ARG));
         return;
     }
-    const struct via_value* a = via_pop_arg(vm);
-    if (a->type != VIA_V_FLOAT) {
+    const struct via_value* a = via_arg(vm, 0);
+    if (via_value_type(a) != VIA_V_FLOAT) {
         via_throw(vm, via_except_invalid_type(vm, FLOAT_ARG));
     }
     vm->ret = via_make_float(vm, sin(a->v_float));
 }
 
 void via_p_cos(struct via_vm* vm) {
-    if (via_reg_args(vm) == NULL || via_reg_args(vm)->v_cdr != NULL) {
+    if (via_arg_count(vm) != 1) {
         via_throw(vm, via_except_argument_error(vm, ONE_ARG));
         return;
     }
-    const struct via_value* a = via_pop_arg(vm);
-    if (a->type != VIA_V_FLOAT) {
+    const struct via_value* a = via_arg(vm, 0);
+    if (via_value_type(a) != VIA_V_FLOAT) {
         via_throw(vm, via_except_invalid_type(vm, FLOAT_ARG));
     }
     vm->ret = via_make_float(vm, cos(a->v_float));
 }
 
 void via_p_garbage_collect(struct via_vm* vm) {
-    if (via_reg_args(vm)) {
+    if (via_arg_count(vm)) {
         via_throw(vm, via_except_argument_error(vm, NO_ARGS));
         return;
     }
@@ -581,35 +643,36 @@ void via_p_garbage_collect(struct via_vm* vm) {
 }
 
 void via_p_byte(struct via_vm* vm) {
-    if (via_reg_args(vm) == NULL || via_reg_args(vm)->v_cdr != NULL) {
+    if (via_arg_count(vm) != 1) {
         via_throw(vm, via_except_argument_error(vm, ONE_ARG));
         return;
     }
 
-    const struct via_value* num = via_pop_arg(vm);
+    const struct via_value* num = via_arg(vm, 0);
 
-    if (num->type != VIA_V_INT) {
+    if (via_value_type(num) != VIA_V_INT) {
         via_throw(vm, via_except_invalid_type(vm, INT_REQUIRED));
         return;
     }
 
-    if (num->v_int < -128 || num->v_int > 255) {
+    const via_int v_int = via_value_int(num);
+    if (v_int < -128 || v_int > 255) {
         via_throw(vm, via_except_runtime_error(vm, OUT_OF_RANGE));
         return;
     }
 
-    vm->ret = via_make_int(vm, num->v_int & 0xff);
+    vm->ret = via_make_int(vm, v_int & 0xff);
 }
 
 void via_p_int(struct via_vm* vm) {
-    if (via_reg_args(vm) == NULL || via_reg_args(vm)->v_cdr != NULL) {
+    if (via_arg_count(vm) != 1) {
         via_throw(vm, via_except_argument_error(vm, ONE_ARG));
         return;
     }
 
-    const struct via_value* num = via_pop_arg(vm);
+    const struct via_value* num = via_arg(vm, 0);
 
-    switch (num->type) {
+    switch (via_value_type(num)) {
     case VIA_V_INT:
         vm->ret = num;
         break;
@@ -630,16 +693,16 @@ void via_p_int(struct via_vm* vm) {
 }
 
 void via_p_float(struct via_vm* vm) {
-    if (via_reg_args(vm) == NULL || via_reg_args(vm)->v_cdr != NULL) {
+    if (via_arg_count(vm) != 1) {
         via_throw(vm, via_except_argument_error(vm, ONE_ARG));
         return;
     }
 
-    const struct via_value* num = via_pop_arg(vm);
+    const struct via_value* num = via_arg(vm, 0);
 
-    switch (num->type) {
+    switch (via_value_type(num)) {
     case VIA_V_INT:
-        vm->ret = via_make_float(vm, (via_float) num->v_int);
+        vm->ret = via_make_float(vm, (via_float) via_value_int(num));
         break;
     case VIA_V_FLOAT:
         vm->ret = num;
@@ -658,155 +721,160 @@ void via_p_float(struct via_vm* vm) {
 }
 
 void via_p_string(struct via_vm* vm) {
-    if (via_reg_args(vm) == NULL || via_reg_args(vm)->v_cdr != NULL) {
+    if (via_arg_count(vm) != 1) {
         via_throw(vm, via_except_argument_error(vm, ONE_ARG));
         return;
     }
 
-    vm->ret = via_to_string_raw(vm, via_pop_arg(vm));
+    vm->ret = via_to_string_raw(vm, via_arg(vm, 0));
 }
 
 void via_p_bytep(struct via_vm* vm) {
-    if (via_reg_args(vm) == NULL || via_reg_args(vm)->v_cdr != NULL) {
+    if (via_arg_count(vm) != 1) {
         via_throw(vm, via_except_argument_error(vm, ONE_ARG));
         return;
     }
 
-    const struct via_value* arg = via_pop_arg(vm);
+    const struct via_value* arg = via_arg(vm, 0);
     vm->ret = via_make_bool(
         vm,
-        arg->type == VIA_V_INT && arg->v_int >= -128 && arg->v_int < 256
+        via_value_type(arg) == VIA_V_INT
+            && via_value_int(arg) >= -128
+            && via_value_int(arg) < 256
     );
 }
 
 void via_p_nilp(struct via_vm* vm) {
-    if (via_reg_args(vm) == NULL || via_reg_args(vm)->v_cdr != NULL) {
+    if (via_arg_count(vm) != 1) {
         via_throw(vm, via_except_argument_error(vm, ONE_ARG));
         return;
     }
 
-    const struct via_value* arg = via_pop_arg(vm);
+    const struct via_value* arg = via_arg(vm, 0);
     vm->ret = via_make_bool(vm, arg == NULL);
 }
 
 void via_p_intp(struct via_vm* vm) {
-    if (via_reg_args(vm) == NULL || via_reg_args(vm)->v_cdr != NULL) {
+    if (via_arg_count(vm) != 1) {
         via_throw(vm, via_except_argument_error(vm, ONE_ARG));
         return;
     }
 
-    const struct via_value* arg = via_pop_arg(vm);
-    vm->ret = via_make_bool(vm, arg->type == VIA_V_INT);
+    const struct via_value* arg = via_arg(vm, 0);
+    vm->ret = via_make_bool(vm, via_value_type(arg) == VIA_V_INT);
 }
 
 void via_p_floatp(struct via_vm* vm) {
-    if (via_reg_args(vm) == NULL || via_reg_args(vm)->v_cdr != NULL) {
+    if (via_arg_count(vm) != 1) {
         via_throw(vm, via_except_argument_error(vm, ONE_ARG));
         return;
     }
 
-    const struct via_value* arg = via_pop_arg(vm);
-    vm->ret = via_make_bool(vm, arg->type == VIA_V_FLOAT);
+    const struct via_value* arg = via_arg(vm, 0);
+    vm->ret = via_make_bool(vm, via_value_type(arg) == VIA_V_FLOAT);
 }
 
 void via_p_boolp(struct via_vm* vm) {
-    if (via_reg_args(vm) == NULL || via_reg_args(vm)->v_cdr != NULL) {
+    if (via_arg_count(vm) != 1) {
         via_throw(vm, via_except_argument_error(vm, ONE_ARG));
         return;
     }
 
-    const struct via_value* arg = via_pop_arg(vm);
-    vm->ret = via_make_bool(vm, arg->type == VIA_V_BOOL);
+    const struct via_value* arg = via_arg(vm, 0);
+    vm->ret = via_make_bool(vm, via_value_type(arg) == VIA_V_BOOL);
 }
 
 void via_p_stringp(struct via_vm* vm) {
-    if (via_reg_args(vm) == NULL || via_reg_args(vm)->v_cdr != NULL) {
+    if (via_arg_count(vm) != 1) {
         via_throw(vm, via_except_argument_error(vm, ONE_ARG));
         return;
     }
 
-    const struct via_value* arg = via_pop_arg(vm);
-    vm->ret = via_make_bool(vm, arg->type == VIA_V_STRING);
+    const struct via_value* arg = via_arg(vm, 0);
+    vm->ret = via_make_bool(vm, via_value_type(arg) == VIA_V_STRING);
 }
 
 void via_p_stringviewp(struct via_vm* vm) {
-    if (via_reg_args(vm) == NULL || via_reg_args(vm)->v_cdr != NULL) {
+    if (via_arg_count(vm) != 1) {
         via_throw(vm, via_except_argument_error(vm, ONE_ARG));
         return;
     }
 
-    const struct via_value* arg = via_pop_arg(vm);
-    vm->ret = via_make_bool(vm, arg->type == VIA_V_STRINGVIEW);
+    const struct via_value* arg = via_arg(vm, 0);
+    vm->ret = via_make_bool(vm, via_value_type(arg) == VIA_V_STRINGVIEW);
 }
 
 void via_p_pairp(struct via_vm* vm) {
-    if (via_reg_args(vm) == NULL || via_reg_args(vm)->v_cdr != NULL) {
+    if (via_arg_count(vm) != 1) {
         via_throw(vm, via_except_argument_error(vm, ONE_ARG));
         return;
     }
 
-    const struct via_value* arg = via_pop_arg(vm);
-    vm->ret = via_make_bool(vm, arg != NULL && arg->type == VIA_V_PAIR);
+    const struct via_value* arg = via_arg(vm, 0);
+    vm->ret = via_make_bool(
+        vm,
+        arg != NULL && via_value_type(arg) == VIA_V_PAIR
+    );
 }
 
 void via_p_arrayp(struct via_vm* vm) {
-    if (via_reg_args(vm) == NULL || via_reg_args(vm)->v_cdr != NULL) {
+    if (via_arg_count(vm) != 1) {
         via_throw(vm, via_except_argument_error(vm, ONE_ARG));
         return;
     }
 
-    const struct via_value* arg = via_pop_arg(vm);
-    vm->ret = via_make_bool(vm, arg->type == VIA_V_ARRAY);
+    const struct via_value* arg = via_arg(vm, 0);
+    vm->ret = via_make_bool(vm, via_value_type(arg) == VIA_V_ARRAY);
 }
 
 void via_p_procp(struct via_vm* vm) {
-    if (via_reg_args(vm) == NULL || via_reg_args(vm)->v_cdr != NULL) {
+    if (via_arg_count(vm) != 1) {
         via_throw(vm, via_except_argument_error(vm, ONE_ARG));
         return;
     }
 
-    const struct via_value* arg = via_pop_arg(vm);
-    vm->ret = via_make_bool(vm, arg->type == VIA_V_PROC);
+    const struct via_value* arg = via_arg(vm, 0);
+    vm->ret = via_make_bool(vm, via_value_type(arg) == VIA_V_PROC);
 }
 
 void via_p_formp(struct via_vm* vm) {
-    if (via_reg_args(vm) == NULL || via_reg_args(vm)->v_cdr != NULL) {
+    if (via_arg_count(vm) != 1) {
         via_throw(vm, via_except_argument_error(vm, ONE_ARG));
         return;
     }
 
-    const struct via_value* arg = via_pop_arg(vm);
-    vm->ret = via_make_bool(vm, arg->type == VIA_V_FORM);
+    const struct via_value* arg = via_arg(vm, 0);
+    vm->ret = via_make_bool(vm, via_value_type(arg) == VIA_V_FORM);
 }
 
 void via_p_builtinp(struct via_vm* vm) {
-    if (via_reg_args(vm) == NULL || via_reg_args(vm)->v_cdr != NULL) {
+    if (via_arg_count(vm) != 1) {
         via_throw(vm, via_except_argument_error(vm, ONE_ARG));
         return;
     }
 
-    const struct via_value* arg = via_pop_arg(vm);
-    vm->ret = via_make_bool(vm, arg->type == VIA_V_BUILTIN);
+    const struct via_value* arg = via_arg(vm, 0);
+    vm->ret = via_make_bool(vm, via_value_type(arg) == VIA_V_BUILTIN);
 }
 
 void via_p_framep(struct via_vm* vm) {
-    if (via_reg_args(vm) == NULL || via_reg_args(vm)->v_cdr != NULL) {
+    if (via_arg_count(vm) != 1) {
         via_throw(vm, via_except_argument_error(vm, ONE_ARG));
         return;
     }
 
-    const struct via_value* arg = via_pop_arg(vm);
-    vm->ret = via_make_bool(vm, arg->type == VIA_V_FRAME);
+    const struct via_value* arg = via_arg(vm, 0);
+    vm->ret = via_make_bool(vm, via_value_type(arg) == VIA_V_FRAME);
 }
 
 void via_p_symbolp(struct via_vm* vm) {
-    if (via_reg_args(vm) == NULL || via_reg_args(vm)->v_cdr != NULL) {
+    if (via_arg_count(vm) != 1) {
         via_throw(vm, via_except_argument_error(vm, ONE_ARG));
         return;
     }
 
-    const struct via_value* arg = via_pop_arg(vm);
-    vm->ret = via_make_bool(vm, arg->type == VIA_V_SYMBOL);
+    const struct via_value* arg = via_arg(vm, 0);
+    vm->ret = via_make_bool(vm, via_value_type(arg) == VIA_V_SYMBOL);
 }
 
 void via_add_core_forms(struct via_vm* vm) {
@@ -879,216 +947,214 @@ void via_add_core_forms(struct via_vm* vm) {
 }
 
 void via_add_core_procedures(struct via_vm* vm) {
-    via_register_proc(
+    via_register_direct_proc(
         vm,
         "eval",
         "eval-native-proc",
-        NULL,
         (via_bindable) via_p_eval
     );
-    via_register_proc(
+    via_register_direct_proc(
         vm,
         "parse",
         "parse-proc",
-        NULL,
         (via_bindable) via_p_parse
     );
-    via_register_proc(
+    via_register_direct_proc(
         vm,
         "throw",
         "throw-proc",
-        NULL,
         (via_bindable) via_p_throw
     );
-    via_register_proc(vm, "=", "eq-proc", NULL, (via_bindable) via_p_eq);
-    via_register_proc(vm, ">", "gt-proc", NULL, (via_bindable) via_p_gt);
-    via_register_proc(vm, "<", "lt-proc", NULL, (via_bindable) via_p_lt);
-    via_register_proc(vm, ">=", "gte-proc", NULL, (via_bindable) via_p_gte);
-    via_register_proc(vm, "<=", "lte-proc", NULL, (via_bindable) via_p_lte);
-    via_register_proc(vm, "<>", "neq-proc", NULL, (via_bindable) via_p_neq);
-    via_register_proc(vm, "not", "not-proc", NULL, (via_bindable) via_p_not);
-    via_register_proc(
+    via_register_direct_proc(vm, "=", "eq-proc", (via_bindable) via_p_eq);
+    via_register_direct_proc(vm, ">", "gt-proc", (via_bindable) via_p_gt);
+    via_register_direct_proc(vm, "<", "lt-proc", (via_bindable) via_p_lt);
+    via_register_direct_proc(vm, ">=", "gte-proc", (via_bindable) via_p_gte);
+    via_register_direct_proc(vm, "<=", "lte-proc", (via_bindable) via_p_lte);
+    via_register_direct_proc(vm, "<>", "neq-proc", (via_bindable) via_p_neq);
+    via_register_direct_proc(vm, "not", "not-proc", (via_bindable) via_p_not);
+    via_register_direct_proc(
         vm,
         "context",
         "context-proc",
-        NULL,
         (via_bindable) via_p_context
     );
-    via_register_proc(
+    via_register_direct_proc(
         vm,
         "make-exception",
         "make-exception-proc",
-        NULL,
         (via_bindable) via_p_make_exception
     );
-    via_register_proc(
+    via_register_direct_proc(
         vm,
         "exception",
         "exception-proc",
-        NULL,
         (via_bindable) via_p_exception
     );
-    via_register_proc(
+    via_register_direct_proc(
         vm,
         "exception-type",
         "exception-type-proc",
-        NULL,
         (via_bindable) via_p_exception_type
     );
-    via_register_proc(
+    via_register_direct_proc(
         vm,
         "exception-message",
         "exception-message-proc",
-        NULL,
         (via_bindable) via_p_exception_message
     );
-    via_register_proc(
+    via_register_direct_proc(
         vm,
         "exception-frame",
         "exception-frame-proc",
-        NULL,
         (via_bindable) via_p_exception_frame
     );
-    via_register_proc(vm, "cons", "cons-proc", NULL, (via_bindable) via_p_cons);
-    via_register_proc(vm, "car", "car-proc", NULL, (via_bindable) via_p_car);
-    via_register_proc(vm, "cdr", "cdr-proc", NULL, (via_bindable) via_p_cdr);
-    via_register_proc(vm, "list", "list-proc", NULL, (via_bindable) via_p_list);
-    via_register_proc(
+    via_register_direct_proc(
+        vm,
+        "cons",
+        "cons-proc",
+        (via_bindable) via_p_cons
+    );
+    via_register_direct_proc(vm, "car", "car-proc", (via_bindable) via_p_car);
+    via_register_direct_proc(vm, "cdr", "cdr-proc", (via_bindable) via_p_cdr);
+    via_register_direct_proc(
+        vm,
+        "list",
+        "list-proc",
+        (via_bindable) via_p_list
+    );
+    via_register_direct_proc(
         vm,
         "reverse",
         "reverse-proc",
-        NULL,
         (via_bindable) via_p_reverse_list
     );
-    via_register_proc(
+    via_register_direct_proc(
         vm,
         "str-concat",
         "str-concat-proc",
-        NULL,
         (via_bindable) via_p_str_concat
     );
-    via_register_proc(
+    via_register_direct_proc(
         vm,
         "debug",
         "debug-proc",
-        NULL,
         (via_bindable) via_p_debug
     );
-    via_register_proc(
+    via_register_direct_proc(
         vm,
         "backtrace",
         "backtrace-proc",
-        NULL,
         (via_bindable) via_p_backtrace
     );
-    via_register_proc(vm, "+", "add-proc", NULL, (via_bindable) via_p_add);
-    via_register_proc(vm, "-", "sub-proc", NULL, (via_bindable) via_p_sub);
-    via_register_proc(vm, "*", "mul-proc", NULL, (via_bindable) via_p_mul);
-    via_register_proc(vm, "/", "div-proc", NULL, (via_bindable) via_p_div);
-    via_register_proc(vm, "%", "mod-proc", NULL, (via_bindable) via_p_mod);
-    via_register_proc(vm, "^", "pow-proc", NULL, (via_bindable) via_p_pow);
-    via_register_proc(vm, "sin", "sin-proc", NULL, (via_bindable) via_p_sin);
-    via_register_proc(vm, "cos", "cos-proc", NULL, (via_bindable) via_p_cos);
-    via_register_proc(
+    via_register_direct_proc(vm, "+", "add-proc", (via_bindable) via_p_add);
+    via_register_direct_proc(vm, "-", "sub-proc", (via_bindable) via_p_sub);
+    via_register_direct_proc(vm, "*", "mul-proc", (via_bindable) via_p_mul);
+    via_register_direct_proc(vm, "/", "div-proc", (via_bindable) via_p_div);
+    via_register_direct_proc(vm, "%", "mod-proc", (via_bindable) via_p_mod);
+    via_register_direct_proc(vm, "^", "pow-proc", (via_bindable) via_p_pow);
+    via_register_direct_proc(vm, "sin", "sin-proc", (via_bindable) via_p_sin);
+    via_register_direct_proc(vm, "cos", "cos-proc", (via_bindable) via_p_cos);
+    via_register_direct_proc(
         vm,
         "garbage-collect",
         "gc-proc",
-        NULL,
         (via_bindable) via_p_garbage_collect
     );
-    via_register_proc(vm, "byte", "byte-proc", NULL, (via_bindable) via_p_byte);
-    via_register_proc(vm, "int", "int-proc", NULL, (via_bindable) via_p_int);
-    via_register_proc(
+    via_register_direct_proc(
+        vm,
+        "byte",
+        "byte-proc",
+        (via_bindable) via_p_byte
+    );
+    via_register_direct_proc(vm, "int", "int-proc", (via_bindable) via_p_int);
+    via_register_direct_proc(
         vm,
         "float",
         "float-proc",
-        NULL,
         (via_bindable) via_p_float
     );
-    via_register_proc(
+    via_register_direct_proc(
         vm,
         "string",
         "string-proc",
-        NULL,
         (via_bindable) via_p_string
     );
-    via_register_proc(
+    via_register_direct_proc(
         vm,
         "byte?",
         "bytep-proc",
-        NULL,
         (via_bindable) via_p_bytep
     );
-    via_register_proc(vm, "nil?", "nilp-proc", NULL, (via_bindable) via_p_nilp);
-    via_register_proc(vm, "int?", "intp-proc", NULL, (via_bindable) via_p_intp);
-    via_register_proc(
+    via_register_direct_proc(
+        vm,
+        "nil?",
+        "nilp-proc",
+        (via_bindable) via_p_nilp
+    );
+    via_register_direct_proc(
+        vm,
+        "int?",
+        "intp-proc",
+        (via_bindable) via_p_intp
+    );
+    via_register_direct_proc(
         vm,
         "bool?",
         "boolp-proc",
-        NULL,
         (via_bindable) via_p_boolp
     );
-    via_register_proc(
+    via_register_direct_proc(
         vm,
         "string?",
         "stringp-proc",
-        NULL,
         (via_bindable) via_p_stringp
     );
-    via_register_proc(
+    via_register_direct_proc(
         vm,
         "stringview?",
         "stringviewp-proc",
-        NULL,
         (via_bindable) via_p_stringviewp
     );
-    via_register_proc(
+    via_register_direct_proc(
         vm,
         "pair?",
         "pairp-proc",
-        NULL,
         (via_bindable) via_p_pairp
     );
-    via_register_proc(
+    via_register_direct_proc(
         vm,
         "array?",
         "arrayp-proc",
-        NULL,
         (via_bindable) via_p_arrayp
     );
-    via_register_proc(
+    via_register_direct_proc(
         vm,
         "proc?",
         "procp-proc",
-        NULL,
         (via_bindable) via_p_procp
     );
-    via_register_proc(
+    via_register_direct_proc(
         vm,
         "form?",
         "formp-proc",
-        NULL,
         (via_bindable) via_p_formp
     );
-    via_register_proc(
+    via_register_direct_proc(
         vm,
         "builtin?",
         "builtinp-proc",
-        NULL,
         (via_bindable) via_p_builtinp
     );
-    via_register_proc(
+    via_register_direct_proc(
         vm,
         "frame?",
         "framep-proc",
-        NULL,
         (via_bindable) via_p_framep
     );
-    via_register_proc(
+    via_register_direct_proc(
         vm,
         "symbol?",
         "symbolp-proc",
-        NULL,
         (via_bindable) via_p_symbolp
     );
 
@@ -0,0 +1,941 @@
+#include <via/compiler.h>
+
+#include <via/alloc.h>
+#include <via/assembler.h>
+#include <via/value.h>
+#include <via/vm.h>
+
+#include <assert.h>
+#include <string.h>
+
+#define INITIAL_CODE_SIZE 64
+#define INITIAL_CONSTS_CAP 64
+#define INITIAL_LOOKUP_CACHES_CAP 64
+#define INITIAL_COMPILED_CAP 64
+#define INITIAL_OWNED_CAP 16
+#define INITIAL_CODE_SPANS_CAP 64
+
+// Constant slots holding the core forms that the compiler is able to inline.
+// The slots are filled in by via_init_compiler(), and are compared against
+// the runtime value of the head symbol of a compound expression, so that a
+// shadowed or redefined form falls back to regular form expansion.
+enum via_inline_form {
+    VIA_INLINE_IF,
+    VIA_INLINE_BEGIN,
+    VIA_INLINE_AND,
+    VIA_INLINE_OR,
+    VIA_INLINE_QUOTE,
+    VIA_INLINE_SET,
+
+    VIA_INLINE_COUNT
+};
+
+static const char* const inline_form_symbols[VIA_INLINE_COUNT] = {
+    "if",
+    "begin",
+    "and",
+    "or",
+    "quote",
+    "set!"
+};
+
+// Operators that have an opcode of their own, and the labels of the builtins
+// that the procedures bound to them by default have as their bodies.
+static const struct {
+    const char* symbol;
+    const char* label;
+    via_int op;
+} native_ops[] = {
+    { "+", "add-proc", VIA_OP_ADD },
+    { "-", "sub-proc", VIA_OP_SUB },
+    { "*", "mul-proc", VIA_OP_MUL },
+    { "/", "div-proc", VIA_OP_DIV },
+    { "=", "eq-proc", VIA_OP_EQ },
+    { "<>", "neq-proc", VIA_OP_NEQ },
+    { "<", "lt-proc", VIA_OP_LT },
+    { ">", "gt-proc", VIA_OP_GT },
+    { "<=", "lte-proc", VIA_OP_LTE },
+    { ">=", "gte-proc", VIA_OP_GTE }
+};
+
+struct via_compilation {
+    struct via_vm* vm;
+
+    via_opcode* code;
+    size_t code_size;
+    size_t code_cap;
+    via_bool failed;
+
+    via_int eval_proc;
+    via_int apply_proc;
+    via_int form_expand_proc;
+    via_int env_set_proc;
+
+    // Environment of the procedure application the code is compiled for, if
+    // any, whose bindings can be referred to by index.
+    const struct via_value* scope;
+
+    // Constant slots and lookup caches added for the code, which the code
+    // owns once compiled.
+    via_int* consts;
+    size_t consts_count;
+    size_t consts_cap;
+    via_int* caches;
+    size_t caches_count;
+    size_t caches_cap;
+};
+
+// Hashes a value by its heap slot, which stays the same when a copying
+// collection moves the value. Fixnums have no slot, nor move.
+static size_t via_hash_value(const struct via_value* value) {
+    uintptr_t h = via_is_fixnum(value) ? (uintptr_t) value : value->slot;
+    h ^= h >> 17;
+    h *= (uintptr_t) 0x9e3779b97f4a7c15ull;
+    return (size_t) (h ^ (h >> 29));
+}
+
+// Returns the index of the expression in the compiled code table, or the
+// capacity of the table if the expression has no compiled code.
+static size_t via_compiled_index(
+    const struct via_vm* vm,
+    const struct via_value* expr
+) {
+    if (!vm->compiled_cap) {
+        return 0;
+    }
+
+    const size_t mask = vm->compiled_cap - 1;
+    for (size_t i = via_hash_value(expr) & mask;; i = (i + 1) & mask) {
+        if (vm->compiled_exprs[i] == expr) {
+            return i;
+        } else if (!vm->compiled_exprs[i]) {
+            return vm->compiled_cap;
+        }
+    }
+}
+
+const struct via_compiled_code* via_find_compiled(
+    const struct via_vm* vm,
+    const struct via_value* expr
+) {
+    const size_t index = via_compiled_index(vm, expr);
+    return index < vm->compiled_cap ? &vm->compiled_code[index] : NULL;
+}
+
+void via_move_compiled(
+    struct via_vm* vm,
+    const struct via_value* expr,
+    const struct via_value* copy
+) {
+    const size_t index = via_compiled_index(vm, expr);
+    if (index < vm->compiled_cap) {
+        vm->compiled_exprs[index] = copy;
+    }
+}
+
+static via_int via_compiled_lookup(
+    struct via_vm* vm,
+    const struct via_value* expr
+) {
+    const struct via_compiled_code* code = via_find_compiled(vm, expr);
+    return code ? code->addr : -1;
+}
+
+static via_bool via_compiled_insert(
+    struct via_vm* vm,
+    const struct via_value* expr,
+    const struct via_compiled_code* code
+) {
+    if ((vm->compiled_count + 1) * 2 > vm->compiled_cap) {
+        const size_t old_cap = vm->compiled_cap;
+        const struct via_value** old_exprs = vm->compiled_exprs;
+        struct via_compiled_code* old_code = vm->compiled_code;
+
+        const size_t new_cap = old_cap ? old_cap * 2 : INITIAL_COMPILED_CAP;
+        const struct via_value** new_exprs = via_calloc(
+            new_cap,
+            sizeof(struct via_value*)
+        );
+        if (!new_exprs) {
+            return false;
+        }
+        struct via_compiled_code* new_code = via_malloc(
+            new_cap * sizeof(struct via_compiled_code)
+        );
+        if (!new_code) {
+            via_free(new_exprs);
+            return false;
+        }
+
+        vm->compiled_exprs = new_exprs;
+        vm->compiled_code = new_code;
+        vm->compiled_cap = new_cap;
+        vm->compiled_count = 0;
+        for (size_t i = 0; i < old_cap; ++i) {
+            if (old_exprs[i]) {
+                via_compiled_insert(vm, old_exprs[i], &old_code[i]);
+            }
+        }
+        via_free(old_exprs);
+        via_free(old_code);
+    }
+
+    const size_t mask = vm->compiled_cap - 1;
+    size_t i = via_hash_value(expr) & mask;
+    while (vm->compiled_exprs[i]) {
+        i = (i + 1) & mask;
+    }
+    vm->compiled_exprs[i] = expr;
+    vm->compiled_code[i] = *code;
+    via_write_barrier(vm, NULL, NULL, expr);
+    vm->compiled_count++;
+
+    return true;
+}
+
+// Tells whether the expression can be found dead, which fixnums and the
+// values owned by the VM never are.
+static via_bool via_collectable(const struct via_value* expr) {
+    return !via_is_fixnum(expr) && !(expr->flags & VIA_CELL_IMMORTAL);
+}
+
+// Makes room for one more code span.
+static via_bool via_reserve_code_span(struct via_vm* vm) {
+    if (vm->code_spans_count < vm->code_spans_cap) {
+        return true;
+    }
+
+    const size_t new_cap = vm->code_spans_cap
+        ? vm->code_spans_cap * 2
+        : INITIAL_CODE_SPANS_CAP;
+    struct via_code_span* new_spans = via_realloc(
+        vm->code_spans,
+        sizeof(struct via_code_span) * new_cap
+    );
+    if (!new_spans) {
+        return false;
+    }
+    vm->code_spans = new_spans;
+    vm->code_spans_cap = new_cap;
+    return true;
+}
+
+size_t via_find_code_span(const struct via_vm* vm, via_int pc) {
+    size_t lo = 0;
+    size_t hi = vm->code_spans_count;
+    while (lo < hi) {
+        const size_t mid = lo + (hi - lo) / 2;
+        const struct via_code_span* span = &vm->code_spans[mid];
+        if (span->addr + span->size < pc) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+// Adds the span of the code compiled for a collectable expression, in order
+// of address. Room must have been made for it.
+static void via_add_code_span(
+    struct via_vm* vm,
+    const struct via_value* expr,
+    const struct via_compiled_code* code
+) {
+    size_t i = via_find_code_span(vm, code->addr);
+    while (
+        i < vm->code_spans_count
+            && vm->code_spans[i].addr < code->addr
+    ) {
+        ++i;
+    }
+    memmove(
+        &vm->code_spans[i + 1],
+        &vm->code_spans[i],
+        sizeof(struct via_code_span) * (vm->code_spans_count - i)
+    );
+    vm->code_spans[i] = (struct via_code_span) {
+        code->addr,
+        code->size,
+        expr->slot
+    };
+    vm->code_spans_count++;
+}
+
+via_int via_add_const(struct via_vm* vm, const struct via_value* value) {
+    if (!vm->free_consts_count && vm->consts_count == vm->consts_cap) {
+        const size_t new_cap = vm->consts_cap
+            ? vm->consts_cap * 2
+            : INITIAL_CONSTS_CAP;
+        const struct via_value** new_consts = via_realloc(
+            (struct via_value**) vm->consts,
+            sizeof(struct via_value*) * new_cap
+        );
+        if (!new_consts) {
+            return -1;
+        }
+        vm->consts = new_consts;
+        via_bool* new_owned = via_realloc(
+            vm->consts_owned,
+            sizeof(via_bool) * new_cap
+        );
+        if (!new_owned) {
+            return -1;
+        }
+        vm->consts_owned = new_owned;
+        via_int* new_free = via_realloc(
+            vm->free_consts,
+            sizeof(via_int) * new_cap
+        );
+        if (!new_free) {
+            return -1;
+        }
+        vm->free_consts = new_free;
+        vm->consts_cap = new_cap;
+    }
+
+    const via_int index = vm->free_consts_count
+        ? vm->free_consts[--vm->free_consts_count]
+        : (via_int) vm->consts_count++;
+    vm->consts[index] = value;
+    vm->consts_owned[index] = false;
+    via_write_barrier(vm, NULL, NULL, value);
+    return index;
+}
+
+via_int via_add_lookup_cache(
+    struct via_vm* vm,
+    const struct via_value* symbol
+) {
+    if (
+        !vm->free_caches_count
+            && vm->lookup_caches_count == vm->lookup_caches_cap
+    ) {
+        const size_t new_cap = vm->lookup_caches_cap
+            ? vm->lookup_caches_cap * 2
+            : INITIAL_LOOKUP_CACHES_CAP;
+        struct via_lookup_cache* new_caches = via_realloc(
+            vm->lookup_caches,
+            sizeof(struct via_lookup_cache) * new_cap
+        );
+        if (!new_caches) {
+            return -1;
+        }
+        vm->lookup_caches = new_caches;
+        via_int* new_free = via_realloc(
+            vm->free_caches,
+            sizeof(via_int) * new_cap
+        );
+        if (!new_free) {
+            return -1;
+        }
+        vm->free_caches = new_free;
+        vm->lookup_caches_cap = new_cap;
+    }
+
+    const via_int index = via_add_const(vm, symbol);
+    if (index < 0) {
+        return -1;
+    }
+    const via_int cache = vm->free_caches_count
+        ? vm->free_caches[--vm->free_caches_count]
+        : (via_int) vm->lookup_caches_count++;
+    // The epochs of the VM start out at one, so the cache starts out empty.
+    vm->lookup_caches[cache] = (struct via_lookup_cache) { index, 0, 0 };
+    return cache;
+}
+
+static void via_release_const(struct via_vm* vm, via_int index) {
+    vm->consts[index] = NULL;
+    vm->consts_owned[index] = false;
+    vm->free_consts[vm->free_consts_count++] = index;
+}
+
+static void via_release_owned(
+    struct via_vm* vm,
+    const via_int* consts,
+    size_t consts_count,
+    const via_int* caches,
+    size_t caches_count
+) {
+    for (size_t i = 0; i < consts_count; ++i) {
+        via_release_const(vm, consts[i]);
+    }
+    for (size_t i = 0; i < caches_count; ++i) {
+        via_release_const(vm, vm->lookup_caches[caches[i]].symbol);
+        vm->free_caches[vm->free_caches_count++] = caches[i];
+    }
+}
+
+void via_drop_compiled(struct via_vm* vm, size_t index) {
+    struct via_compiled_code* code = &vm->compiled_code[index];
+    via_release_owned(
+        vm,
+        code->owned,
+        code->consts_count,
+        code->owned + code->consts_count,
+        code->caches_count
+    );
+    via_free(code->owned);
+    via_asm_release_prg(vm, code->addr, code->size);
+
+    // Move up the entries that probed past the emptied one, so that lookups
+    // still find them.
+    const size_t mask = vm->compiled_cap - 1;
+    size_t hole = index;
+    for (
+        size_t i = (index + 1) & mask;
+        vm->compiled_exprs[i];
+        i = (i + 1) & mask
+    ) {
+        const size_t home = via_hash_value(vm->compiled_exprs[i]) & mask;
+        if (((i - home) & mask) >= ((i - hole) & mask)) {
+            vm->compiled_exprs[hole] = vm->compiled_exprs[i];
+            vm->compiled_code[hole] = vm->compiled_code[i];
+            hole = i;
+        }
+    }
+    vm->compiled_exprs[hole] = NULL;
+    vm->compiled_count--;
+}
+
+void via_init_compiler(struct via_vm* vm) {
+    assert(vm->consts_count == 0);
+
+    for (size_t i = 0; i < VIA_INLINE_COUNT; ++i) {
+        via_add_const(vm, via_get(vm, inline_form_symbols[i]));
+    }
+}
+
+static size_t via_emit(struct via_compilation* c, via_int op, via_int arg) {
+    if (c->code_size == c->code_cap) {
+        via_opcode* new_code = via_realloc(
+            c->code,
+            sizeof(via_opcode) * c->code_cap * 2
+        );
+        if (!new_code) {
+            c->failed = true;
+            return c->code_size;
+        }
+        c->code = new_code;
+        c->code_cap *= 2;
+    }
+
+    c->code[c->code_size] = op | (arg << 8);
+    return c->code_size++;
+}
+
+// Appends the index to the list, growing it as needed.
+static via_bool via_own_index(
+    via_int** indices,
+    size_t* count,
+    size_t* cap,
+    via_int index
+) {
+    if (*count == *cap) {
+        const size_t new_cap = *cap ? *cap * 2 : INITIAL_OWNED_CAP;
+        via_int* new_indices = via_realloc(*indices, sizeof(via_int) * new_cap);
+        if (!new_indices) {
+            return false;
+        }
+        *indices = new_indices;
+        *cap = new_cap;
+    }
+    (*indices)[(*count)++] = index;
+    return true;
+}
+
+static size_t via_emit_const(
+    struct via_compilation* c,
+    via_int op,
+    const struct via_value* value
+) {
+    const via_int index = via_add_const(c->vm, value);
+    if (index < 0) {
+        c->failed = true;
+        return c->code_size;
+    }
+    c->vm->consts_owned[index] = true;
+    if (!via_own_index(&c->consts, &c->consts_count, &c->consts_cap, index)) {
+        via_release_const(c->vm, index);
+        c->failed = true;
+        return c->code_size;
+    }
+    return via_emit(c, op, index);
+}
+
+// Points the relative operand of the instruction at SOURCE to the current end
+// of the code.
+static void via_patch(struct via_compilation* c, size_t source) {
+    if (c->failed) {
+        return;
+    }
+    const via_int offset = c->code_size - (source + 1);
+    c->code[source] = (c->code[source] & 0xff) | (offset << 8);
+}
+
+static via_bool via_is_proper_list(const struct via_value* list) {
+    while (list) {
+        if (via_value_type(list) != VIA_V_PAIR) {
+            return false;
+        }
+        list = list->v_cdr;
+    }
+    return true;
+}
+
+static size_t via_list_length(const struct via_value* list) {
+    size_t length = 0;
+    for (; list; list = list->v_cdr) {
+        length++;
+    }
+    return length;
+}
+
+static void via_compile_expr(
+    struct via_compilation* c,
+    const struct via_value* expr
+);
+
+static via_bool via_compile_native_op(
+    struct via_compilation* c,
+    const struct via_value* expr,
+    via_bool tail
+);
+
+// Returns the index of the binding of the symbol in the application scope, or
+// -1 if it has none. The binding that was made last takes precedence, as in
+// the lookup.
+static via_int via_scope_binding(
+    struct via_compilation* c,
+    const struct via_value* symbol
+) {
+    if (!c->scope) {
+        return -1;
+    }
+    const struct via_value** slots = c->scope->v_arr;
+    for (via_int i = via_value_int(slots[VIA_ENV_COUNT]); i > 0; --i) {
+        if (slots[VIA_ENV_BINDINGS + (i - 1) * 2] == symbol) {
+            return i - 1;
+        }
+    }
+    return -1;
+}
+
+// Generates code that looks up the value bound to the symbol, and leaves it in
+// the accumulator and the return register. Symbols not bound in the scope get
+// a lookup cache of their own.
+static void via_compile_lookup(
+    struct via_compilation* c,
+    const struct via_value* symbol
+) {
+    const via_int binding = via_scope_binding(c, symbol);
+    if (binding >= 0) {
+        via_emit_const(c, VIA_OP_LOADK, symbol);
+        via_emit(c, VIA_OP_LOADL, binding);
+        return;
+    }
+    const via_int cache = via_add_lookup_cache(c->vm, symbol);
+    if (cache < 0) {
+        c->failed = true;
+        return;
+    }
+    if (!via_own_index(&c->caches, &c->caches_count, &c->caches_cap, cache)) {
+        via_release_owned(c->vm, NULL, 0, &cache, 1);
+        c->failed = true;
+        return;
+    }
+    via_emit(c, VIA_OP_LOADG, cache);
+}
+
+// Generates code that evaluates the expression and leaves the result in the
+// accumulator, while remaining in the current frame.
+static void via_compile_value(
+    struct via_compilation* c,
+    const struct via_value* expr
+) {
+    if (!expr) {
+        via_emit(c, VIA_OP_LOADNIL, 0);
+    } else if (via_value_type(expr) == VIA_V_SYMBOL) {
+        via_compile_lookup(c, expr);
+    } else if (via_compile_native_op(c, expr, false)) {
+        return;
+    } else if (
+        via_value_type(expr) == VIA_V_PAIR
+            || via_value_type(expr) == VIA_V_FRAME
+            || via_value_type(expr) == VIA_V_BUILTIN
+    ) {
+        const size_t snap = via_emit(c, VIA_OP_SNAP, 0);
+        via_compile_expr(c, expr);
+        via_patch(c, snap);
+        via_emit(c, VIA_OP_LOADRET, 0);
+    } else {
+        via_emit_const(c, VIA_OP_LOADK, expr);
+    }
+}
+
+// Generates code that evaluates one of the inlinable core forms, given the
+// rest of the expression (the form context). Returns false if the context is
+// not of a shape that can be inlined, in which case no code is generated.
+static via_bool via_compile_inline_form(
+    struct via_compilation* c,
+    enum via_inline_form form,
+    const struct via_value* args
+) {
+    const size_t argc = via_list_length(args);
+    size_t skip;
+
+    switch (form) {
+    case VIA_INLINE_IF:
+        if (argc != 2 && argc != 3) {
+            return false;
+        }
+        via_compile_value(c, args->v_car);
+        skip = via_emit(c, VIA_OP_SKIPZ, 0);
+        via_compile_expr(c, args->v_cdr->v_car);
+        via_patch(c, skip);
+        if (argc == 3) {
+            via_compile_expr(c, args->v_cdr->v_cdr->v_car);
+        } else {
+            via_emit(c, VIA_OP_SETRET, 0);
+            via_emit(c, VIA_OP_RETURN, 0);
+        }
+        return true;
+    case VIA_INLINE_BEGIN:
+        if (argc < 1) {
+            return false;
+        }
+        for (; args->v_cdr; args = args->v_cdr) {
+            if (
+                args->v_car
+                    && (via_value_type(args->v_car) == VIA_V_SYMBOL
+                        || via_value_type(args->v_car) == VIA_V_PAIR)
+            ) {
+                via_compile_value(c, args->v_car);
+            }
+        }
+        via_compile_expr(c, args->v_car);
+        return true;
+    case VIA_INLINE_AND:
+        if (argc != 2) {
+            return false;
+        }
+        via_compile_value(c, args->v_car);
+        skip = via_emit(c, VIA_OP_SKIPZ, 0);
+        via_compile_value(c, args->v_cdr->v_car);
+        via_patch(c, skip);
+        via_emit(c, VIA_OP_SETRET, 0);
+        via_emit(c, VIA_OP_RETURN, 0);
+        return true;
+    case VIA_INLINE_OR:
+        if (argc != 2) {
+            return false;
+        }
+        via_compile_value(c, args->v_car);
+        skip = via_emit(c, VIA_OP_SKIPZ, 0);
+        via_emit(c, VIA_OP_SETRET, 0);
+        via_emit(c, VIA_OP_RETURN, 0);
+        via_patch(c, skip);
+        via_compile_expr(c, args->v_cdr->v_car);
+        return true;
+    case VIA_INLINE_QUOTE:
+        if (argc != 1) {
+            return false;
+        }
+        via_emit_const(c, VIA_OP_LOADK, args->v_car);
+        via_emit(c, VIA_OP_SETRET, 0);
+        via_emit(c, VIA_OP_RETURN, 0);
+        return true;
+    case VIA_INLINE_SET:
+        if (
+            argc != 2
+                || !args->v_car
+                || via_value_type(args->v_car) != VIA_V_SYMBOL
+        ) {
+            return false;
+        }
+        via_compile_value(c, args->v_cdr->v_car);
+        via_emit(c, VIA_OP_PUSHARG, 0);
+        via_emit_const(c, VIA_OP_LOADK, args->v_car);
+        via_emit(c, VIA_OP_PUSH, 0);
+        via_emit(c, VIA_OP_CALL, c->env_set_proc);
+        return true;
+    default:
+        return false;
+    }
+}
+
+// Returns true if a value of the type is evaluated once more when a symbol at
+// the head of a compound expression resolves to it.
+static via_bool via_is_reevaluated(via_int type) {
+    return type == VIA_V_SYMBOL
+        || type == VIA_V_PAIR
+        || type == VIA_V_FRAME
+        || type == VIA_V_BUILTIN;
+}
+
+static void via_compile_compound(
+    struct via_compilation* c,
+    const struct via_value* expr
+) {
+    const struct via_value* head = expr->v_car;
+
+    via_emit_const(c, VIA_OP_LOADK, expr);
+    via_emit(c, VIA_OP_SET, VIA_REG_EXPR);
+
+    if (head && via_value_type(head) == VIA_V_SYMBOL) {
+        via_compile_lookup(c, head);
+
+        // Special forms are resolved at runtime, as the symbol may be bound
+        // to anything by the time the expression is evaluated.
+        via_emit(c, VIA_OP_FORMP, 0);
+        const size_t not_form = via_emit(c, VIA_OP_SKIPZ, 0);
+        for (size_t i = 0; i < VIA_INLINE_COUNT; ++i) {
+            if (head != via_sym(c->vm, inline_form_symbols[i])) {
+                continue;
+            }
+            const size_t code_size = c->code_size;
+            via_emit(c, VIA_OP_LOADRET, 0);
+            via_emit(c, VIA_OP_EQK, i);
+            const size_t generic = via_emit(c, VIA_OP_SKIPZ, 0);
+            if (via_compile_inline_form(c, i, expr->v_cdr)) {
+                via_patch(c, generic);
+            } else {
+                c->code_size = code_size;
+            }
+            break;
+        }
+        via_emit(c, VIA_OP_LOAD, VIA_REG_EXPR);
+        via_emit(c, VIA_OP_CDR, 0);
+        via_emit(c, VIA_OP_SET, VIA_REG_CTXT);
+        via_emit(c, VIA_OP_LOADRET, 0);
+        via_emit(c, VIA_OP_CALL, c->form_expand_proc);
+        via_patch(c, not_form);
+
+        // The evaluator evaluates the value a head symbol resolves to once
+        // more (ports rely on this to dispatch on symbols), so anything that
+        // isn't self-evaluating has to be passed through eval-proc again.
+        // Types past the end of the jump table are self-evaluating, like
+        // most of the ones in it.
+        size_t table[VIA_V_SYMBOL + 1];
+        via_emit(c, VIA_OP_LOADRET, 0);
+        via_emit(c, VIA_OP_TYPESWITCH, VIA_V_SYMBOL + 1);
+        for (size_t type = 0; type <= VIA_V_SYMBOL; ++type) {
+            table[type] = via_emit(c, VIA_OP_JMP, 0);
+        }
+        const size_t done = via_emit(c, VIA_OP_JMP, 0);
+        for (size_t type = 0; type <= VIA_V_SYMBOL; ++type) {
+            if (via_is_reevaluated(type)) {
+                via_patch(c, table[type]);
+            }
+        }
+        via_emit(c, VIA_OP_SNAP, 2);
+        via_emit(c, VIA_OP_SET, VIA_REG_EXPR);
+        via_emit(c, VIA_OP_CALL, c->eval_proc);
+        via_emit(c, VIA_OP_LOADRET, 0);
+        via_patch(c, done);
+        for (size_t type = 0; type <= VIA_V_SYMBOL; ++type) {
+            if (!via_is_reevaluated(type)) {
+                via_patch(c, table[type]);
+            }
+        }
+    } else {
+        via_compile_value(c, head);
+    }
+
+    // Procedure application.
+    via_emit(c, VIA_OP_SET, VIA_REG_PROC);
+    for (const struct via_value* arg = expr->v_cdr; arg; arg = arg->v_cdr) {
+        via_compile_value(c, arg->v_car);
+        via_emit(c, VIA_OP_PUSHARG, 0);
+    }
+    via_emit(c, VIA_OP_CALL, c->apply_proc);
+}
+
+// Generates code that applies an operator with an opcode of its own, if the
+// expression is an application of one to two arguments, and leaves the result
+// in the accumulator (or returns it, in tail position). Returns false if not,
+// in which case no code is generated. The opcode is used only while the
+// operator symbol resolves to the procedure it is bound to by default; any
+// other procedure is applied as usual.
+static via_bool via_compile_native_op(
+    struct via_compilation* c,
+    const struct via_value* expr,
+    via_bool tail
+) {
+    if (
+        via_value_type(expr) != VIA_V_PAIR
+            || !expr->v_car
+            || via_value_type(expr->v_car) != VIA_V_SYMBOL
+            || !via_is_proper_list(expr)
+            || via_list_length(expr) != 3
+    ) {
+        return false;
+    }
+    const size_t count = sizeof(native_ops) / sizeof(native_ops[0]);
+    size_t i = 0;
+    while (i < count && expr->v_car != via_sym(c->vm, native_ops[i].symbol)) {
+        i++;
+    }
+    if (i == count) {
+        return false;
+    }
+    const via_int addr = via_asm_label_lookup(c->vm, native_ops[i].label);
+    if (addr < 0) {
+        return false;
+    }
+
+    via_compile_lookup(c, expr->v_car);
+    via_emit(c, VIA_OP_NATIVEP, addr);
+    const size_t generic = via_emit(c, VIA_OP_SKIPZ, 0);
+    via_compile_value(c, expr->v_cdr->v_car);
+    via_emit(c, VIA_OP_PUSH, 0);
+    via_compile_value(c, expr->v_cdr->v_cdr->v_car);
+    via_emit(c, native_ops[i].op, 0);
+    if (tail) {
+        via_emit(c, VIA_OP_SETRET, 0);
+        via_emit(c, VIA_OP_RETURN, 0);
+        via_patch(c, generic);
+        via_compile_compound(c, expr);
+        return true;
+    }
+    const size_t done = via_emit(c, VIA_OP_JMP, 0);
+    via_patch(c, generic);
+    const size_t snap = via_emit(c, VIA_OP_SNAP, 0);
+    via_compile_compound(c, expr);
+    via_patch(c, snap);
+    via_emit(c, VIA_OP_LOADRET, 0);
+    via_patch(c, done);
+    return true;
+}
+
+// Generates code that evaluates the expression, and returns the result from
+// the current frame (or replaces the current frame by a tail call).
+static void via_compile_expr(
+    struct via_compilation* c,
+    const struct via_value* expr
+) {
+    if (c->failed) {
+        return;
+    }
+
+    if (!expr) {
+        via_emit(c, VIA_OP_LOADNIL, 0);
+        via_emit(c, VIA_OP_SETRET, 0);
+        via_emit(c, VIA_OP_RETURN, 0);
+        return;
+    }
+
+    switch (via_value_type(expr)) {
+    case VIA_V_SYMBOL:
+        via_compile_lookup(c, expr);
+        via_emit(c, VIA_OP_SETRET, 0);
+        via_emit(c, VIA_OP_RETURN, 0);
+        break;
+    case VIA_V_BUILTIN:
+        via_emit_const(c, VIA_OP_LOADK, expr);
+        via_emit(c, VIA_OP_CALLACC, 0);
+        break;
+    case VIA_V_PAIR:
+        if (via_compile_native_op(c, expr, true)) {
+            break;
+        } else if (via_is_proper_list(expr)) {
+            via_compile_compound(c, expr);
+            break;
+        }
+        // Fall through.
+    case VIA_V_FRAME:
+        // Leave anything unusual to the evaluator.
+        via_emit_const(c, VIA_OP_LOADK, expr);
+        via_emit(c, VIA_OP_SET, VIA_REG_EXPR);
+        via_emit(c, VIA_OP_CALL, c->eval_proc);
+        break;
+    default:
+        via_emit_const(c, VIA_OP_LOADK, expr);
+        via_emit(c, VIA_OP_SETRET, 0);
+        via_emit(c, VIA_OP_RETURN, 0);
+    }
+}
+
+via_int via_compile(struct via_vm* vm, const struct via_value* expr) {
+    via_int addr = via_compiled_lookup(vm, expr);
+    if (addr >= 0) {
+        return addr;
+    }
+
+    struct via_compilation c = {
+        vm,
+        via_malloc(sizeof(via_opcode) * INITIAL_CODE_SIZE),
+        0,
+        INITIAL_CODE_SIZE,
+        false,
+        vm->routines.eval_proc,
+        vm->routines.apply_proc,
+        vm->routines.form_expand_proc,
+        vm->routines.env_set_proc,
+        via_reg_env(vm)->v_arr[VIA_ENV_PARENT] ? via_reg_env(vm) : NULL,
+        NULL,
+        0,
+        0,
+        NULL,
+        0,
+        0
+    };
+    if (!c.code) {
+        return -1;
+    }
+
+    via_compile_expr(&c, expr);
+
+    struct via_compiled_code code = {
+        -1,
+        c.code_size,
+        via_malloc(sizeof(via_int) * (c.consts_count + c.caches_count + 1)),
+        c.consts_count,
+        c.caches_count
+    };
+    if (c.failed || !code.owned) {
+        goto cleanup;
+    }
+    code.addr = via_asm_reserve_prg(vm, c.code_size);
+    if (code.addr < 0) {
+        goto cleanup;
+    }
+    memcpy(&vm->program[code.addr], c.code, sizeof(via_opcode) * c.code_size);
+    via_asm_peephole(vm, code.addr, c.code_size);
+    for (size_t i = 0; i < c.consts_count; ++i) {
+        code.owned[i] = c.consts[i];
+    }
+    for (size_t i = 0; i < c.caches_count; ++i) {
+        code.owned[c.consts_count + i] = c.caches[i];
+    }
+    if (
+        (via_collectable(expr) && !via_reserve_code_span(vm))
+            || !via_compiled_insert(vm, expr, &code)
+    ) {
+        via_asm_release_prg(vm, code.addr, code.size);
+        goto cleanup;
+    }
+    if (via_collectable(expr)) {
+        via_add_code_span(vm, expr, &code);
+        ((struct via_value*) expr)->flags |= VIA_CELL_COMPILED;
+    }
+    addr = code.addr;
+
+cleanup:
+    if (addr < 0) {
+        via_release_owned(
+            vm,
+            c.consts,
+            c.consts_count,
+            c.caches,
+            c.caches_count
+        );
+        via_free(code.owned);
+    }
+    via_free(c.caches);
+    via_free(c.consts);
+    via_free(c.code);
+
+    return addr;
+}
@@ -6,6 +6,8 @@
 #define THREE_ARGS "Function expects three arguments"
 #define ARITH_NUMERIC "Arithmetic operation expects two numeric values"
 #define MODULO_INT "Modulo expects two integers"
+#define DIVIDE_BY_ZERO "Division by zero"
+#define INT_OVERFLOW "Integer overflow"
 #define FORM_INADEQUATE_ARGS "Too few arguments to expression"
 #define FORM_SUPERFLOUS_ARGS "Too many arguments to expression"
 #define MALFORMED_SYNTAX "Malformed syntax declaration"
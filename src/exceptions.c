@@ -8,7 +8,7 @@
 via_bool via_is_exception(struct via_vm* vm, const struct via_value* value) {
     return (
         value
-            && value->type == VIA_V_PAIR
+            && via_value_type(value) == VIA_V_PAIR
             && value->v_car == via_sym(vm, EXCEPT)
     );
 }
@@ -27,7 +27,7 @@ const struct via_value* via_make_exception(
             via_make_pair(
                 vm,
                 via_make_string(vm, message),
-                vm->regs
+                via_capture_frame(vm)
             )
         )
     );
@@ -0,0 +1,470 @@
+#include <via/jit.h>
+
+#include <via/alloc.h>
+#include <via/type-utils.h>
+#include <via/value.h>
+#include <via/vm.h>
+
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#if !defined(__x86_64__) && !defined(_M_X64)
+#error "The JIT only supports x86-64 targets."
+#endif
+
+#define CHUNK_SIZE (64 * 1024)
+#define MAX_BLOCK_OPS 256
+// Upper bound of the machine code size generated for a single instruction.
+#define MAX_OP_CODE_SIZE 64
+
+// Executable memory is allocated in chunks that are only writable while code
+// is being copied into them.
+struct via_jit_chunk {
+    struct via_jit_chunk* next;
+    uint8_t* mem;
+    size_t size;
+    size_t used;
+};
+
+struct via_jit_emitter {
+    uint8_t* code;
+    size_t size;
+};
+
+// Marks an address that can't be translated (e.g. starting with a control
+// transfer instruction), so that no further attempts are made.
+static struct via_jit_block* via_jit_untranslatable(via_opcode op) {
+    struct via_jit_block* block = via_malloc(
+        sizeof(struct via_jit_block) + sizeof(via_opcode)
+    );
+    if (block) {
+        block->code = NULL;
+        block->length = 1;
+        block->ops[0] = op;
+    }
+    return block;
+}
+
+static void via_jit_bytes(
+    struct via_jit_emitter* e,
+    const uint8_t* bytes,
+    size_t count
+) {
+    memcpy(&e->code[e->size], bytes, count);
+    e->size += count;
+}
+
+static void via_jit_imm32(struct via_jit_emitter* e, int32_t imm) {
+    via_jit_bytes(e, (const uint8_t*) &imm, sizeof(imm));
+}
+
+static void via_jit_imm64(struct via_jit_emitter* e, uint64_t imm) {
+    via_jit_bytes(e, (const uint8_t*) &imm, sizeof(imm));
+}
+
+// The VM pointer is kept in rbx throughout the block.
+
+// mov rax, [rbx + disp]
+static void via_jit_load_vm(struct via_jit_emitter* e, size_t disp) {
+    via_jit_bytes(e, (const uint8_t[]) { 0x48, 0x8b, 0x83 }, 3);
+    via_jit_imm32(e, disp);
+}
+
+// mov [rbx + disp], rax
+static void via_jit_store_vm(struct via_jit_emitter* e, size_t disp) {
+    via_jit_bytes(e, (const uint8_t[]) { 0x48, 0x89, 0x83 }, 3);
+    via_jit_imm32(e, disp);
+}
+
+// mov rax, [rax + disp]
+static void via_jit_load_rax(struct via_jit_emitter* e, size_t disp) {
+    via_jit_bytes(e, (const uint8_t[]) { 0x48, 0x8b, 0x80 }, 3);
+    via_jit_imm32(e, disp);
+}
+
+// Leaves the address of the register array of the current frame in rcx.
+static void via_jit_load_regs(struct via_jit_emitter* e) {
+    // mov rcx, [rbx + regs]
+    via_jit_bytes(e, (const uint8_t[]) { 0x48, 0x8b, 0x8b }, 3);
+    via_jit_imm32(e, offsetof(struct via_vm, regs));
+    // mov rcx, [rcx + v_arr]
+    via_jit_bytes(e, (const uint8_t[]) { 0x48, 0x8b, 0x89 }, 3);
+    via_jit_imm32(e, offsetof(struct via_value, v_arr));
+}
+
+// Calls FUNC(vm, operand), with the operand either being the accumulator or
+// an immediate value. The result is stored in the accumulator if requested.
+static void via_jit_call(
+    struct via_jit_emitter* e,
+    const void* func,
+    via_bool acc_operand,
+    via_int operand,
+    via_bool store_result
+) {
+    // mov rdi, rbx
+    via_jit_bytes(e, (const uint8_t[]) { 0x48, 0x89, 0xdf }, 3);
+    if (acc_operand) {
+        // mov rsi, [rbx + acc]
+        via_jit_bytes(e, (const uint8_t[]) { 0x48, 0x8b, 0xb3 }, 3);
+        via_jit_imm32(e, offsetof(struct via_vm, acc));
+    } else {
+        // mov rsi, imm64
+        via_jit_bytes(e, (const uint8_t[]) { 0x48, 0xbe }, 2);
+        via_jit_imm64(e, operand);
+    }
+    // mov rax, imm64; call rax
+    via_jit_bytes(e, (const uint8_t[]) { 0x48, 0xb8 }, 2);
+    via_jit_imm64(e, (uintptr_t) func);
+    via_jit_bytes(e, (const uint8_t[]) { 0xff, 0xd0 }, 2);
+    if (store_result) {
+        via_jit_store_vm(e, offsetof(struct via_vm, acc));
+    }
+}
+
+// Returns the address to resume interpretation at.
+static void via_jit_exit(struct via_jit_emitter* e, via_int addr) {
+    // mov rax, imm64; pop rbx; ret
+    via_jit_bytes(e, (const uint8_t[]) { 0x48, 0xb8 }, 2);
+    via_jit_imm64(e, addr);
+    via_jit_bytes(e, (const uint8_t[]) { 0x5b, 0xc3 }, 2);
+}
+
+static const struct via_value* via_jit_type_predicate(
+    struct via_vm* vm,
+    via_int type
+) {
+    return via_make_bool(vm, vm->acc && via_value_type(vm->acc) == type);
+}
+
+static void via_jit_set(struct via_vm* vm, via_int reg) {
+    via_write_barrier(vm, vm->regs, vm->regs->v_arr[reg], vm->acc);
+    vm->regs->v_arr[reg] = vm->acc;
+}
+
+static const struct via_value* via_jit_eqk(struct via_vm* vm, via_int index) {
+    return via_make_bool(vm, vm->acc == vm->consts[index]);
+}
+
+// Mirrors the interpreter's treatment of a branch to the branching
+// instruction itself.
+static via_int via_jit_branch_target(via_int addr, via_opcode op) {
+    const via_int target = addr + (((via_int) op) >> 8) + 1;
+    return (target == addr) ? addr + 1 : target;
+}
+
+// Emits the translation of the instruction at ADDR. Returns false if the
+// instruction ends the block (in which case an exit has been emitted).
+static via_bool via_jit_translate(
+    struct via_jit_emitter* e,
+    via_int addr,
+    via_opcode op
+) {
+    const via_int operand = ((via_int) op) >> 8;
+
+    switch (op & 0xff) {
+    case VIA_OP_NOP:
+        break;
+    case VIA_OP_CAR:
+    case VIA_OP_CDR:
+        via_jit_load_vm(e, offsetof(struct via_vm, acc));
+        via_jit_load_rax(
+            e,
+            (op & 0xff) == VIA_OP_CAR
+                ? offsetof(struct via_value, v_car)
+                : offsetof(struct via_value, v_cdr)
+        );
+        via_jit_store_vm(e, offsetof(struct via_vm, acc));
+        break;
+    case VIA_OP_SET:
+        via_jit_call(e, via_jit_set, false, operand, false);
+        break;
+    case VIA_OP_LOAD:
+        via_jit_load_regs(e);
+        // mov rax, [rcx + disp]
+        via_jit_bytes(e, (const uint8_t[]) { 0x48, 0x8b, 0x81 }, 3);
+        via_jit_imm32(e, operand * sizeof(struct via_value*));
+        via_jit_store_vm(e, offsetof(struct via_vm, acc));
+        break;
+    case VIA_OP_LOADNIL:
+        // mov qword [rbx + acc], 0
+        via_jit_bytes(e, (const uint8_t[]) { 0x48, 0xc7, 0x83 }, 3);
+        via_jit_imm32(e, offsetof(struct via_vm, acc));
+        via_jit_imm32(e, 0);
+        break;
+    case VIA_OP_SETRET:
+        via_jit_load_vm(e, offsetof(struct via_vm, acc));
+        via_jit_store_vm(e, offsetof(struct via_vm, ret));
+        break;
+    case VIA_OP_LOADRET:
+        via_jit_load_vm(e, offsetof(struct via_vm, ret));
+        via_jit_store_vm(e, offsetof(struct via_vm, acc));
+        break;
+    case VIA_OP_LOADK:
+    // Superinstructions are translated as their first instruction, as the
+    // rest of the sequence follows them.
+    case VIA_OP_LOADKSET:
+    case VIA_OP_LOADKL:
+        via_jit_load_vm(e, offsetof(struct via_vm, consts));
+        via_jit_load_rax(e, operand * sizeof(struct via_value*));
+        via_jit_store_vm(e, offsetof(struct via_vm, acc));
+        break;
+    case VIA_OP_PAIRP:
+        via_jit_call(e, via_jit_type_predicate, false, VIA_V_PAIR, true);
+        break;
+    case VIA_OP_SYMBOLP:
+        via_jit_call(e, via_jit_type_predicate, false, VIA_V_SYMBOL, true);
+        break;
+    case VIA_OP_FORMP:
+        via_jit_call(e, via_jit_type_predicate, false, VIA_V_FORM, true);
+        break;
+    case VIA_OP_FRAMEP:
+        via_jit_call(e, via_jit_type_predicate, false, VIA_V_FRAME, true);
+        break;
+    case VIA_OP_BUILTINP:
+        via_jit_call(e, via_jit_type_predicate, false, VIA_V_BUILTIN, true);
+        break;
+    case VIA_OP_SKIPNT:
+        via_jit_call(e, via_jit_type_predicate, false, operand, true);
+        break;
+    case VIA_OP_EQK:
+        via_jit_call(e, via_jit_eqk, false, operand, true);
+        break;
+    case VIA_OP_PUSH:
+        via_jit_call(e, via_push, true, 0, false);
+        break;
+    case VIA_OP_POP:
+        via_jit_call(e, via_pop, false, 0, true);
+        break;
+    case VIA_OP_DROP:
+        via_jit_call(e, via_pop, false, 0, false);
+        break;
+    case VIA_OP_PUSHARG:
+        via_jit_call(e, via_push_arg, true, 0, false);
+        break;
+    case VIA_OP_POPARG:
+        via_jit_call(e, via_pop_arg, false, 0, true);
+        break;
+    case VIA_OP_SKIPZ: {
+        via_jit_load_vm(e, offsetof(struct via_vm, acc));
+        // test rax, rax; jz @exit
+        via_jit_bytes(e, (const uint8_t[]) { 0x48, 0x85, 0xc0, 0x74, 0x16 }, 5);
+        // test al, 1; jz @cell
+        via_jit_bytes(e, (const uint8_t[]) { 0xa8, 0x01, 0x74, 0x08 }, 4);
+        // A fixnum is zero if nothing but its tag is set.
+        // cmp rax, 1; jne @continue; jmp @exit
+        via_jit_bytes(
+            e,
+            (const uint8_t[]) { 0x48, 0x83, 0xf8, 0x01, 0x75, 0x18, 0xeb, 0x0a },
+            8
+        );
+        // @cell: cmp qword [rax + v_int], 0; jne @continue
+        via_jit_bytes(e, (const uint8_t[]) { 0x48, 0x83, 0xb8 }, 3);
+        via_jit_imm32(e, offsetof(struct via_value, v_int));
+        via_jit_bytes(e, (const uint8_t[]) { 0x00, 0x75, 0x0c }, 3);
+        // @exit:
+        via_jit_exit(e, via_jit_branch_target(addr, op));
+        // @continue:
+        break;
+    }
+    case VIA_OP_JMP:
+        via_jit_exit(e, via_jit_branch_target(addr, op));
+        return false;
+    default:
+        // Control transfers between frames and routines are left to the
+        // interpreter.
+        via_jit_exit(e, addr);
+        return false;
+    }
+
+    return true;
+}
+
+static void* via_jit_place(struct via_vm* vm, const uint8_t* code, size_t size) {
+    struct via_jit_chunk* chunk = vm->jit_chunks;
+    if (!chunk || chunk->used + size > chunk->size) {
+        const size_t chunk_size = size > CHUNK_SIZE ? size : CHUNK_SIZE;
+        chunk = via_malloc(sizeof(struct via_jit_chunk));
+        if (!chunk) {
+            return NULL;
+        }
+        chunk->mem = mmap(
+            NULL,
+            chunk_size,
+            PROT_READ | PROT_EXEC,
+            MAP_PRIVATE | MAP_ANONYMOUS,
+            -1,
+            0
+        );
+        if (chunk->mem == MAP_FAILED) {
+            via_free(chunk);
+            return NULL;
+        }
+        chunk->size = chunk_size;
+        chunk->used = 0;
+        chunk->next = vm->jit_chunks;
+        vm->jit_chunks = chunk;
+    }
+
+    if (mprotect(chunk->mem, chunk->size, PROT_READ | PROT_WRITE)) {
+        return NULL;
+    }
+    uint8_t* dest = chunk->mem + chunk->used;
+    memcpy(dest, code, size);
+    if (mprotect(chunk->mem, chunk->size, PROT_READ | PROT_EXEC)) {
+        return NULL;
+    }
+    // Keep blocks 16-byte aligned.
+    chunk->used += (size + 15) & ~((size_t) 15);
+
+    return dest;
+}
+
+static via_bool via_jit_reserve(struct via_vm* vm) {
+    const size_t new_cap = vm->program_cap;
+    struct via_jit_block** new_blocks = via_realloc(
+        vm->jit_blocks,
+        sizeof(struct via_jit_block*) * new_cap
+    );
+    if (!new_blocks) {
+        return false;
+    }
+    vm->jit_blocks = new_blocks;
+
+    uint32_t* new_counters = via_realloc(
+        vm->jit_counters,
+        sizeof(uint32_t) * new_cap
+    );
+    if (!new_counters) {
+        return false;
+    }
+    vm->jit_counters = new_counters;
+
+    memset(
+        &vm->jit_blocks[vm->jit_cap],
+        0,
+        sizeof(struct via_jit_block*) * (new_cap - vm->jit_cap)
+    );
+    memset(
+        &vm->jit_counters[vm->jit_cap],
+        0,
+        sizeof(uint32_t) * (new_cap - vm->jit_cap)
+    );
+    vm->jit_cap = new_cap;
+
+    return true;
+}
+
+void via_jit_init(struct via_vm* vm) {
+    const char* threshold = getenv("VIA_JIT_THRESHOLD");
+    vm->jit_threshold = threshold
+        ? strtoul(threshold, NULL, 10)
+        : VIA_JIT_DEFAULT_THRESHOLD;
+    via_jit_reserve(vm);
+}
+
+void via_jit_free(struct via_vm* vm) {
+    for (size_t i = 0; i < vm->jit_cap; ++i) {
+        via_free(vm->jit_blocks[i]);
+    }
+    via_free(vm->jit_blocks);
+    via_free(vm->jit_counters);
+
+    while (vm->jit_chunks) {
+        struct via_jit_chunk* next = vm->jit_chunks->next;
+        munmap(vm->jit_chunks->mem, vm->jit_chunks->size);
+        via_free(vm->jit_chunks);
+        vm->jit_chunks = next;
+    }
+}
+
+via_bool via_jit_compile(struct via_vm* vm, via_int addr) {
+    if (addr >= vm->jit_cap && !via_jit_reserve(vm)) {
+        return false;
+    }
+    via_free(vm->jit_blocks[addr]);
+    vm->jit_blocks[addr] = NULL;
+
+    uint8_t* buffer = via_malloc(MAX_OP_CODE_SIZE * (MAX_BLOCK_OPS + 2));
+    if (!buffer) {
+        return false;
+    }
+    struct via_jit_emitter e = { buffer, 0 };
+
+    // push rbx; mov rbx, rdi
+    via_jit_bytes(&e, (const uint8_t[]) { 0x53, 0x48, 0x89, 0xfb }, 4);
+
+    via_int length = 0;
+    via_int translated = 0;
+    for (;;) {
+        if (length == MAX_BLOCK_OPS || addr + length == vm->program_cap) {
+            via_jit_exit(&e, addr + length);
+            break;
+        }
+        const via_opcode op = vm->program[addr + length++];
+        if (!via_jit_translate(&e, addr + length - 1, op)) {
+            break;
+        }
+        ++translated;
+    }
+
+    struct via_jit_block* block = NULL;
+    if (!translated) {
+        block = via_jit_untranslatable(vm->program[addr]);
+    } else {
+        block = via_malloc(
+            sizeof(struct via_jit_block) + sizeof(via_opcode) * length
+        );
+        if (block) {
+            block->code = (via_jit_code) via_jit_place(vm, buffer, e.size);
+            block->length = length;
+            memcpy(block->ops, &vm->program[addr], sizeof(via_opcode) * length);
+            if (!block->code) {
+                via_free(block);
+                block = NULL;
+            }
+        }
+    }
+    via_free(buffer);
+
+    vm->jit_blocks[addr] = block;
+    return block && block->code;
+}
+
+via_int via_jit_enter(struct via_vm* vm, via_int addr) {
+    for (;;) {
+        if (addr >= vm->jit_cap && !via_jit_reserve(vm)) {
+            return addr;
+        }
+
+        struct via_jit_block* block = vm->jit_blocks[addr];
+        if (
+            block
+                && memcmp(
+                    block->ops,
+                    &vm->program[addr],
+                    sizeof(via_opcode) * block->length
+                )
+        ) {
+            // The program has been overwritten since the translation.
+            via_free(block);
+            block = vm->jit_blocks[addr] = NULL;
+            vm->jit_counters[addr] = 0;
+        }
+
+        if (!block) {
+            if (vm->jit_counters[addr] < vm->jit_threshold) {
+                vm->jit_counters[addr]++;
+                return addr;
+            }
+            via_jit_compile(vm, addr);
+            block = vm->jit_blocks[addr];
+        }
+
+        if (!block || !block->code) {
+            return addr;
+        }
+        addr = block->code(vm);
+    }
+}
@@ -0,0 +1,598 @@
+#include <via/parallel-mark.h>
+
+#include <via/alloc.h>
+#include <via/compiler.h>
+#include <via/value.h>
+#include <via/vm.h>
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+
+#define DEFAULT_DEQUE_SIZE 1024
+
+// Circular array of a work-stealing deque. Arrays outgrown while marking stay
+// around until the end of the marking, as thieves may still be reading them.
+struct via_mark_buffer {
+    struct via_mark_buffer* retired;
+    int64_t cap;
+    _Atomic(const struct via_value*) slots[];
+};
+
+// Chase-Lev deque, as formulated for C11 atomics by Lê et al. The owner pushes
+// and takes values at the bottom, while other threads steal from the top.
+struct via_mark_deque {
+    _Atomic int64_t top;
+    _Atomic int64_t bottom;
+    _Atomic(struct via_mark_buffer*) buffer;
+};
+
+struct via_mark_worker {
+    struct via_mark_pool* pool;
+    struct via_mark_deque deque;
+    // Work not offered to other threads, which spares the synchronization of
+    // the deque while it has work to share already.
+    const struct via_value** local;
+    size_t local_top;
+    size_t local_cap;
+    pthread_t thread;
+    uint32_t steal_seed;
+};
+
+struct via_mark_pool {
+    struct via_vm* vm;
+    size_t count;
+
+    // Rounds of marking are started by bumping the round counter, and the
+    // collecting thread waits for running to drop back to zero.
+    pthread_mutex_t lock;
+    pthread_cond_t start;
+    pthread_cond_t done;
+    uint64_t round;
+    size_t running;
+    via_bool shutdown;
+
+    // Number of threads that ran out of work.
+    atomic_size_t idle;
+    atomic_bool overflow;
+
+    // The collecting thread marks as the first worker.
+    struct via_mark_worker workers[];
+};
+
+static struct via_mark_buffer* via_mark_buffer_create(int64_t cap) {
+    struct via_mark_buffer* buffer = via_malloc(
+        sizeof(struct via_mark_buffer)
+            + sizeof(_Atomic(const struct via_value*)) * cap
+    );
+    if (buffer) {
+        buffer->retired = NULL;
+        buffer->cap = cap;
+    }
+    return buffer;
+}
+
+// Doubles the array of the deque, copying over the values it holds.
+static struct via_mark_buffer* via_mark_deque_grow(
+    struct via_mark_deque* deque,
+    struct via_mark_buffer* buffer,
+    int64_t top,
+    int64_t bottom
+) {
+    struct via_mark_buffer* grown = via_mark_buffer_create(buffer->cap * 2);
+    if (!grown) {
+        return NULL;
+    }
+    for (int64_t i = top; i < bottom; ++i) {
+        atomic_store_explicit(
+            &grown->slots[i % grown->cap],
+            atomic_load_explicit(
+                &buffer->slots[i % buffer->cap],
+                memory_order_relaxed
+            ),
+            memory_order_relaxed
+        );
+    }
+    grown->retired = buffer;
+    atomic_store_explicit(&deque->buffer, grown, memory_order_release);
+    return grown;
+}
+
+static via_bool via_mark_deque_push(
+    struct via_mark_deque* deque,
+    const struct via_value* value
+) {
+    const int64_t bottom = atomic_load_explicit(
+        &deque->bottom,
+        memory_order_relaxed
+    );
+    const int64_t top = atomic_load_explicit(
+        &deque->top,
+        memory_order_acquire
+    );
+    struct via_mark_buffer* buffer = atomic_load_explicit(
+        &deque->buffer,
+        memory_order_relaxed
+    );
+    if (bottom - top > buffer->cap - 1) {
+        buffer = via_mark_deque_grow(deque, buffer, top, bottom);
+        if (!buffer) {
+            return false;
+        }
+    }
+    atomic_store_explicit(
+        &buffer->slots[bottom % buffer->cap],
+        value,
+        memory_order_relaxed
+    );
+    atomic_thread_fence(memory_order_release);
+    atomic_store_explicit(&deque->bottom, bottom + 1, memory_order_relaxed);
+    return true;
+}
+
+static const struct via_value* via_mark_deque_take(
+    struct via_mark_deque* deque
+) {
+    const int64_t bottom = atomic_load_explicit(
+        &deque->bottom,
+        memory_order_relaxed
+    ) - 1;
+    struct via_mark_buffer* buffer = atomic_load_explicit(
+        &deque->buffer,
+        memory_order_relaxed
+    );
+    atomic_store_explicit(&deque->bottom, bottom, memory_order_relaxed);
+    atomic_thread_fence(memory_order_seq_cst);
+    int64_t top = atomic_load_explicit(&deque->top, memory_order_relaxed);
+
+    if (top > bottom) {
+        atomic_store_explicit(
+            &deque->bottom,
+            bottom + 1,
+            memory_order_relaxed
+        );
+        return NULL;
+    }
+
+    const struct via_value* value = atomic_load_explicit(
+        &buffer->slots[bottom % buffer->cap],
+        memory_order_relaxed
+    );
+    if (top == bottom) {
+        // Last value, which a thief may be after as well.
+        if (
+            !atomic_compare_exchange_strong_explicit(
+                &deque->top,
+                &top,
+                top + 1,
+                memory_order_seq_cst,
+                memory_order_relaxed
+            )
+        ) {
+            value = NULL;
+        }
+        atomic_store_explicit(
+            &deque->bottom,
+            bottom + 1,
+            memory_order_relaxed
+        );
+    }
+    return value;
+}
+
+static const struct via_value* via_mark_deque_steal(
+    struct via_mark_deque* deque
+) {
+    int64_t top = atomic_load_explicit(&deque->top, memory_order_acquire);
+    atomic_thread_fence(memory_order_seq_cst);
+    const int64_t bottom = atomic_load_explicit(
+        &deque->bottom,
+        memory_order_acquire
+    );
+    if (top >= bottom) {
+        return NULL;
+    }
+
+    struct via_mark_buffer* buffer = atomic_load_explicit(
+        &deque->buffer,
+        memory_order_acquire
+    );
+    const struct via_value* value = atomic_load_explicit(
+        &buffer->slots[top % buffer->cap],
+        memory_order_relaxed
+    );
+    if (
+        !atomic_compare_exchange_strong_explicit(
+            &deque->top,
+            &top,
+            top + 1,
+            memory_order_seq_cst,
+            memory_order_relaxed
+        )
+    ) {
+        // Lost the race against the owner or another thief.
+        return NULL;
+    }
+    return value;
+}
+
+static via_bool via_mark_deque_empty(struct via_mark_deque* deque) {
+    return atomic_load_explicit(&deque->top, memory_order_relaxed)
+        >= atomic_load_explicit(&deque->bottom, memory_order_relaxed);
+}
+
+static void via_mark_deque_free_retired(struct via_mark_deque* deque) {
+    struct via_mark_buffer* buffer = atomic_load_explicit(
+        &deque->buffer,
+        memory_order_relaxed
+    );
+    while (buffer->retired) {
+        struct via_mark_buffer* retired = buffer->retired;
+        buffer->retired = retired->retired;
+        via_free(retired);
+    }
+}
+
+static via_bool via_has_references(const struct via_value* value) {
+    if (value->flags & VIA_CELL_COMPILED) {
+        return true;
+    }
+    switch (value->type) {
+    case VIA_V_PAIR:
+    case VIA_V_PROC:
+    case VIA_V_FORM:
+    case VIA_V_FRAME:
+    case VIA_V_ARRAY:
+    case VIA_V_ENV:
+        return true;
+    default:
+        return false;
+    }
+}
+
+// Sets the mark bit of the value, unless the value is to be left alone or
+// another thread got to it first. Returns true if the value was claimed.
+static via_bool via_parallel_set_mark(
+    struct via_vm* vm,
+    const struct via_value* value
+) {
+    if (!value || via_is_fixnum(value) || (value->flags & vm->mark_skip)) {
+        return false;
+    }
+    _Atomic uint64_t* word = (_Atomic uint64_t*) &vm->mark_bits[
+        value->slot / 64
+    ];
+    const uint64_t bit = (uint64_t) 1 << (value->slot % 64);
+    if (atomic_load_explicit(word, memory_order_relaxed) & bit) {
+        return false;
+    }
+    return !(atomic_fetch_or_explicit(word, bit, memory_order_relaxed) & bit);
+}
+
+static via_bool via_mark_local_push(
+    struct via_mark_worker* worker,
+    const struct via_value* value
+) {
+    if (worker->local_top == worker->local_cap) {
+        const size_t new_cap = worker->local_cap
+            ? worker->local_cap * 2
+            : DEFAULT_DEQUE_SIZE;
+        const struct via_value** new_local = via_realloc(
+            (struct via_value**) worker->local,
+            sizeof(struct via_value*) * new_cap
+        );
+        if (!new_local) {
+            return false;
+        }
+        worker->local = new_local;
+        worker->local_cap = new_cap;
+    }
+    worker->local[worker->local_top++] = value;
+    return true;
+}
+
+static void via_parallel_mark_push(
+    struct via_mark_worker* worker,
+    const struct via_value* value
+) {
+    if (
+        !via_parallel_set_mark(worker->pool->vm, value)
+            || !via_has_references(value)
+    ) {
+        return;
+    }
+    // Only offer work to the other threads once they have taken what was
+    // offered before.
+    if (
+        !via_mark_deque_empty(&worker->deque)
+            && via_mark_local_push(worker, value)
+    ) {
+        return;
+    }
+    if (!via_mark_deque_push(&worker->deque, value)) {
+        // Left for the serial rescan of the heap.
+        atomic_store_explicit(
+            &worker->pool->overflow,
+            true,
+            memory_order_relaxed
+        );
+    }
+}
+
+// Marks the constants of the code compiled for the expression. The compiled
+// code table is left alone while marking.
+static void via_parallel_mark_compiled(
+    struct via_mark_worker* worker,
+    const struct via_value* expr
+) {
+    const struct via_vm* vm = worker->pool->vm;
+    const struct via_compiled_code* code = via_find_compiled(vm, expr);
+    for (size_t i = 0; code && i < code->consts_count; ++i) {
+        via_parallel_mark_push(worker, vm->consts[code->owned[i]]);
+    }
+}
+
+// Marks the expressions of the code that a frame with the program counter is
+// running.
+static void via_parallel_mark_running(
+    struct via_mark_worker* worker,
+    const struct via_value* pc
+) {
+    const struct via_vm* vm = worker->pool->vm;
+    if (!pc) {
+        return;
+    }
+    for (
+        size_t i = via_find_code_span(vm, pc->v_int);
+        i < vm->code_spans_count && vm->code_spans[i].addr <= pc->v_int;
+        ++i
+    ) {
+        via_parallel_mark_push(worker, vm->heap[vm->code_spans[i].slot]);
+    }
+}
+
+static void via_parallel_mark_references(
+    struct via_mark_worker* worker,
+    const struct via_value* value
+) {
+    for (;;) {
+        if (value->flags & VIA_CELL_COMPILED) {
+            via_parallel_mark_compiled(worker, value);
+        }
+        switch (value->type) {
+        case VIA_V_PAIR:
+        case VIA_V_PROC:
+        case VIA_V_FORM:
+            via_parallel_mark_push(worker, value->v_car);
+            value = value->v_cdr;
+            if (!via_parallel_set_mark(worker->pool->vm, value)) {
+                return;
+            }
+            continue;
+        case VIA_V_FRAME:
+            via_parallel_mark_running(worker, value->v_arr[VIA_REG_PC]);
+            // Fall through.
+        case VIA_V_ARRAY:
+        case VIA_V_ENV:
+            for (via_int i = 0; i < value->v_size; ++i) {
+                via_parallel_mark_push(worker, value->v_arr[i]);
+            }
+            return;
+        default:
+            return;
+        }
+    }
+}
+
+// Tries every other deque once, starting from a random one.
+static const struct via_value* via_parallel_mark_steal(
+    struct via_mark_worker* worker
+) {
+    struct via_mark_pool* pool = worker->pool;
+    worker->steal_seed ^= worker->steal_seed << 13;
+    worker->steal_seed ^= worker->steal_seed >> 17;
+    worker->steal_seed ^= worker->steal_seed << 5;
+    const size_t first = worker->steal_seed % pool->count;
+    for (size_t i = 0; i < pool->count; ++i) {
+        struct via_mark_worker* victim = &pool->workers[
+            (first + i) % pool->count
+        ];
+        if (victim == worker) {
+            continue;
+        }
+        const struct via_value* value = via_mark_deque_steal(&victim->deque);
+        if (value) {
+            return value;
+        }
+    }
+    return NULL;
+}
+
+static via_bool via_parallel_mark_pending(struct via_mark_pool* pool) {
+    for (size_t i = 0; i < pool->count; ++i) {
+        if (!via_mark_deque_empty(&pool->workers[i].deque)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Marks until every thread is out of work. Work only comes from marking, so
+// once all threads are idle at the same time, marking is complete.
+static void via_parallel_mark_drain(struct via_mark_worker* worker) {
+    struct via_mark_pool* pool = worker->pool;
+    for (;;) {
+        const struct via_value* value = worker->local_top
+            ? worker->local[--worker->local_top]
+            : via_mark_deque_take(&worker->deque);
+        if (!value) {
+            value = via_parallel_mark_steal(worker);
+        }
+        if (value) {
+            via_parallel_mark_references(worker, value);
+            continue;
+        }
+
+        atomic_fetch_add(&pool->idle, 1);
+        for (;;) {
+            if (atomic_load(&pool->idle) == pool->count) {
+                return;
+            }
+            if (via_parallel_mark_pending(pool)) {
+                atomic_fetch_sub(&pool->idle, 1);
+                break;
+            }
+            sched_yield();
+        }
+    }
+}
+
+static void* via_parallel_mark_thread(void* arg) {
+    struct via_mark_worker* worker = arg;
+    struct via_mark_pool* pool = worker->pool;
+    uint64_t round = 0;
+
+    pthread_mutex_lock(&pool->lock);
+    for (;;) {
+        while (pool->round == round && !pool->shutdown) {
+            pthread_cond_wait(&pool->start, &pool->lock);
+        }
+        if (pool->shutdown) {
+            break;
+        }
+        round = pool->round;
+        pthread_mutex_unlock(&pool->lock);
+
+        via_parallel_mark_drain(worker);
+
+        pthread_mutex_lock(&pool->lock);
+        if (--pool->running == 0) {
+            pthread_cond_signal(&pool->done);
+        }
+    }
+    pthread_mutex_unlock(&pool->lock);
+
+    return NULL;
+}
+
+// Stops and joins the first count helper threads, and frees the pool.
+static void via_parallel_mark_stop(struct via_mark_pool* pool, size_t count) {
+    pthread_mutex_lock(&pool->lock);
+    pool->shutdown = true;
+    pthread_cond_broadcast(&pool->start);
+    pthread_mutex_unlock(&pool->lock);
+    for (size_t i = 1; i <= count; ++i) {
+        pthread_join(pool->workers[i].thread, NULL);
+    }
+
+    for (size_t i = 0; i < pool->count; ++i) {
+        struct via_mark_deque* deque = &pool->workers[i].deque;
+        if (atomic_load(&deque->buffer)) {
+            via_mark_deque_free_retired(deque);
+            via_free(atomic_load(&deque->buffer));
+        }
+        via_free((struct via_value**) pool->workers[i].local);
+    }
+    pthread_cond_destroy(&pool->done);
+    pthread_cond_destroy(&pool->start);
+    pthread_mutex_destroy(&pool->lock);
+    via_free(pool);
+}
+
+via_bool via_parallel_mark_init(struct via_vm* vm, size_t thread_count) {
+    struct via_mark_pool* pool = via_calloc(
+        1,
+        sizeof(struct via_mark_pool)
+            + sizeof(struct via_mark_worker) * thread_count
+    );
+    if (!pool) {
+        return false;
+    }
+    pool->vm = vm;
+    pool->count = thread_count;
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->start, NULL);
+    pthread_cond_init(&pool->done, NULL);
+    atomic_init(&pool->idle, 0);
+    atomic_init(&pool->overflow, false);
+
+    for (size_t i = 0; i < thread_count; ++i) {
+        struct via_mark_worker* worker = &pool->workers[i];
+        worker->pool = pool;
+        worker->steal_seed = 2463534242u + i;
+        atomic_init(&worker->deque.top, 0);
+        atomic_init(&worker->deque.bottom, 0);
+        atomic_init(
+            &worker->deque.buffer,
+            via_mark_buffer_create(DEFAULT_DEQUE_SIZE)
+        );
+        if (!atomic_load(&worker->deque.buffer)) {
+            via_parallel_mark_stop(pool, 0);
+            return false;
+        }
+    }
+
+    for (size_t i = 1; i < thread_count; ++i) {
+        if (
+            pthread_create(
+                &pool->workers[i].thread,
+                NULL,
+                via_parallel_mark_thread,
+                &pool->workers[i]
+            )
+        ) {
+            via_parallel_mark_stop(pool, i - 1);
+            return false;
+        }
+    }
+
+    vm->mark_pool = pool;
+    return true;
+}
+
+void via_parallel_mark_free(struct via_vm* vm) {
+    if (vm->mark_pool) {
+        via_parallel_mark_stop(vm->mark_pool, vm->mark_pool->count - 1);
+        vm->mark_pool = NULL;
+    }
+}
+
+void via_parallel_mark(struct via_vm* vm) {
+    struct via_mark_pool* pool = vm->mark_pool;
+
+    // The threads are asleep, so the deques can be filled directly.
+    for (size_t i = 0; i < vm->mark_stack_top; ++i) {
+        if (
+            !via_mark_deque_push(
+                &pool->workers[i % pool->count].deque,
+                vm->mark_stack[i]
+            )
+        ) {
+            vm->mark_overflow = true;
+        }
+    }
+    vm->mark_stack_top = 0;
+    atomic_store(&pool->idle, 0);
+    atomic_store(&pool->overflow, false);
+
+    pthread_mutex_lock(&pool->lock);
+    pool->round++;
+    pool->running = pool->count - 1;
+    pthread_cond_broadcast(&pool->start);
+    pthread_mutex_unlock(&pool->lock);
+
+    via_parallel_mark_drain(&pool->workers[0]);
+
+    pthread_mutex_lock(&pool->lock);
+    while (pool->running) {
+        pthread_cond_wait(&pool->done, &pool->lock);
+    }
+    pthread_mutex_unlock(&pool->lock);
+
+    if (atomic_load(&pool->overflow)) {
+        vm->mark_overflow = true;
+    }
+    for (size_t i = 0; i < pool->count; ++i) {
+        via_mark_deque_free_retired(&pool->workers[i].deque);
+    }
+}
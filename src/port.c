@@ -12,54 +12,51 @@
 #include <stdio.h>
 #include <string.h>
 
+// Returns the handle of a standard stream, making it on first use.
+static const struct via_value* via_std_handle(
+    struct via_vm* vm,
+    const struct via_value** handle,
+    FILE* file
+) {
+    if (!*handle) {
+        *handle = via_make_handle(vm, file);
+        via_write_barrier(vm, NULL, NULL, *handle);
+    }
+    return *handle;
+}
+
 void via_p_file_stdin(struct via_vm* vm) {
-    if (via_reg_args(vm)) {
+    if (via_arg_count(vm)) {
         via_throw(vm, via_except_argument_error(vm, NO_ARGS));
         return;
     }
-    vm->ret = via_get(vm, "file-stdin-object");
-
-    if (vm->ret->type == VIA_V_UNDEFINED) {
-        vm->ret = via_make_handle(vm, stdin);
-        via_env_set(vm, via_sym(vm, "file-stdin-object"), vm->ret);
-    }
+    vm->ret = via_std_handle(vm, &vm->stdin_handle, stdin);
 }
 
 void via_p_file_stdout(struct via_vm* vm) {
-    if (via_reg_args(vm)) {
+    if (via_arg_count(vm)) {
         via_throw(vm, via_except_argument_error(vm, NO_ARGS));
         return;
     }
-    vm->ret = via_get(vm, "file-stdin-object");
-
-    if (vm->ret->type == VIA_V_UNDEFINED) {
-        vm->ret = via_make_handle(vm, stdout);
-        via_env_set(vm, via_sym(vm, "file-stdout-object"), vm->ret);
-    }
+    vm->ret = via_std_handle(vm, &vm->stdout_handle, stdout);
 }
 
 void via_p_file_stderr(struct via_vm* vm) {
-    if (via_reg_args(vm)) {
+    if (via_arg_count(vm)) {
         via_throw(vm, via_except_argument_error(vm, NO_ARGS));
         return;
     }
-    vm->ret = via_get(vm, "file-stderr-object");
-
-    if (vm->ret->type == VIA_V_UNDEFINED) {
-        vm->ret = via_make_handle(vm, stderr);
-        via_env_set(vm, via_sym(vm, "file-stderr-object"), vm->ret);
-    }
+    vm->ret = via_std_handle(vm, &vm->stderr_handle, stderr);
 }
 
 void via_p_file_open(struct via_vm* vm) {
-    const struct via_value* args = via_reg_args(vm);
-    if (!args || !args->v_cdr || args->v_cdr->v_cdr) {
+    if (via_arg_count(vm) != 2) {
         via_throw(vm, via_except_argument_error(vm, TWO_ARGS));
         return;
     }
 
-    const struct via_value* filename = via_pop_arg(vm);
-    const struct via_value* mode = via_pop_arg(vm);
+    const struct via_value* filename = via_arg(vm, 0);
+    const struct via_value* mode = via_arg(vm, 1);
 
     const char* mode_str = "";
     if (mode == via_sym(vm, INPUT_MODE)) {
@@ -85,19 +82,18 @@ void via_p_file_open(struct via_vm* vm) {
 }
 
 void via_p_file_read(struct via_vm* vm) {
-    const struct via_value* args = via_reg_args(vm);
-    if (!args || !args->v_cdr || args->v_cdr->v_cdr) {
+    if (via_arg_count(vm) != 2) {
         via_throw(vm, via_except_argument_error(vm, TWO_ARGS));
         return;
     }
 
-    const struct via_value* handle = via_pop_arg(vm);
-    if (handle->type != VIA_V_HANDLE) {
+    const struct via_value* handle = via_arg(vm, 0);
+    if (via_value_type(handle) != VIA_V_HANDLE) {
         via_throw(vm, via_except_invalid_type(vm, EXPECTED_HANDLE));
         return;
     }
-    const struct via_value* char_count = via_pop_arg(vm);
-    if (char_count->type != VIA_V_INT) {
+    const struct via_value* char_count = via_arg(vm, 1);
+    if (via_value_type(char_count) != VIA_V_INT) {
         via_throw(vm, via_except_invalid_type(vm, INT_REQUIRED));
         return;
     }
@@ -106,14 +102,15 @@ void via_p_file_read(struct via_vm* vm) {
         return;
     }
 
-    char* dest = via_calloc(1, char_count->v_int + 1);
+    const via_int length = via_value_int(char_count);
+    char* dest = via_calloc(1, length + 1);
     if (!dest) {
         via_throw(vm, via_except_out_of_memory(vm, ALLOC_FAIL));
         return;
     }
 
-    size_t count = fread(dest, 1, char_count->v_int + 1, handle->v_handle);
-    if (count != char_count->v_int) {
+    size_t count = fread(dest, 1, length + 1, handle->v_handle);
+    if (count != (size_t) length) {
         if (feof(handle->v_handle)) {
             via_throw(vm, via_except_end_of_file(vm, END_OF_FILE));
         } else {
@@ -122,7 +119,7 @@ void via_p_file_read(struct via_vm* vm) {
         goto cleanup;
     }
 
-    dest[char_count->v_int] = '\0';
+    dest[length] = '\0';
 
     vm->ret = via_make_string(vm, dest);
 
@@ -131,14 +128,13 @@ cleanup:
 }
 
 void via_p_file_readline(struct via_vm* vm) {
-    const struct via_value* args = via_reg_args(vm);
-    if (!args || args->v_cdr) {
+    if (via_arg_count(vm) != 1) {
         via_throw(vm, via_except_argument_error(vm, ONE_ARG));
         return;
     }
 
-    const struct via_value* handle = via_pop_arg(vm);
-    if (handle->type != VIA_V_HANDLE) {
+    const struct via_value* handle = via_arg(vm, 0);
+    if (via_value_type(handle) != VIA_V_HANDLE) {
         via_throw(vm, via_except_invalid_type(vm, EXPECTED_HANDLE));
         return;
     }
@@ -166,19 +162,21 @@ cleanup:
 }
 
 void via_p_file_write(struct via_vm* vm) {
-    const struct via_value* args = via_reg_args(vm);
-    if (!args || !args->v_cdr || args->v_cdr->v_cdr) {
+    if (via_arg_count(vm) != 2) {
         via_throw(vm, via_except_argument_error(vm, TWO_ARGS));
         return;
     }
 
-    const struct via_value* handle = via_pop_arg(vm);
-    if (handle->type != VIA_V_HANDLE) {
+    const struct via_value* handle = via_arg(vm, 0);
+    if (via_value_type(handle) != VIA_V_HANDLE) {
         via_throw(vm, via_except_invalid_type(vm, EXPECTED_HANDLE));
         return;
     }
-    const struct via_value* char_seq = via_pop_arg(vm);
-    if (char_seq->type != VIA_V_STRING && char_seq->type != VIA_V_STRINGVIEW) {
+    const struct via_value* char_seq = via_arg(vm, 1);
+    if (
+        via_value_type(char_seq) != VIA_V_STRING
+            && via_value_type(char_seq) != VIA_V_STRINGVIEW
+    ) {
         via_throw(vm, via_except_invalid_type(vm, STRING_REQUIRED));
         return;
     }
@@ -190,27 +188,26 @@ void via_p_file_write(struct via_vm* vm) {
 }
 
 void via_p_file_seek(struct via_vm* vm) {
-    const struct via_value* args = via_reg_args(vm);
-    if (!args || !args->v_cdr) {
+    if (via_arg_count(vm) < 2) {
         via_throw(vm, via_except_argument_error(vm, TWO_ARGS));
         return;
     }
 
-    const struct via_value* handle = via_pop_arg(vm);
-    if (handle->type != VIA_V_HANDLE) {
+    const struct via_value* handle = via_arg(vm, 0);
+    if (via_value_type(handle) != VIA_V_HANDLE) {
         via_throw(vm, via_except_invalid_type(vm, EXPECTED_HANDLE));
         return;
     }
-    const struct via_value* offset = via_pop_arg(vm);
-    if (offset->type != VIA_V_INT) {
+    const struct via_value* offset = via_arg(vm, 1);
+    if (via_value_type(offset) != VIA_V_INT) {
         via_throw(vm, via_except_invalid_type(vm, INT_REQUIRED));
         return;
     }
-    const struct via_value* whence_val = via_pop_arg(vm);
+    const struct via_value* whence_val = via_arg(vm, 2);
 
     int whence = SEEK_SET;
     if (whence_val) {
-        if (whence_val->type != VIA_V_SYMBOL) {
+        if (via_value_type(whence_val) != VIA_V_SYMBOL) {
             via_throw(vm, via_except_invalid_type(vm, SYMBOL_REQUIRED));
             return;
         }
@@ -227,7 +224,7 @@ void via_p_file_seek(struct via_vm* vm) {
         }
     }
 
-    int result = fseek(handle->v_handle, offset->v_int, whence);
+    int result = fseek(handle->v_handle, via_value_int(offset), whence);
     if (result != 0) {
         if (errno == ESPIPE) {
             via_throw(vm, via_except_no_capability(vm, NOT_SEEKABLE));
@@ -240,14 +237,13 @@ void via_p_file_seek(struct via_vm* vm) {
 }
 
 void via_p_file_tell(struct via_vm* vm) {
-    const struct via_value* args = via_reg_args(vm);
-    if (!args || args->v_cdr) {
+    if (via_arg_count(vm) != 1) {
         via_throw(vm, via_except_argument_error(vm, ONE_ARG));
         return;
     }
 
-    const struct via_value* handle = via_pop_arg(vm);
-    if (handle->type != VIA_V_HANDLE) {
+    const struct via_value* handle = via_arg(vm, 0);
+    if (via_value_type(handle) != VIA_V_HANDLE) {
         via_throw(vm, via_except_invalid_type(vm, EXPECTED_HANDLE));
         return;
     }
@@ -266,14 +262,13 @@ void via_p_file_tell(struct via_vm* vm) {
 }
 
 void via_p_file_eofp(struct via_vm* vm) {
-    const struct via_value* args = via_reg_args(vm);
-    if (!args || args->v_cdr) {
+    if (via_arg_count(vm) != 1) {
         via_throw(vm, via_except_argument_error(vm, ONE_ARG));
         return;
     }
 
-    const struct via_value* handle = via_pop_arg(vm);
-    if (handle->type != VIA_V_HANDLE) {
+    const struct via_value* handle = via_arg(vm, 0);
+    if (via_value_type(handle) != VIA_V_HANDLE) {
         via_throw(vm, via_except_invalid_type(vm, EXPECTED_HANDLE));
         return;
     }
@@ -282,14 +277,13 @@ void via_p_file_eofp(struct via_vm* vm) {
 }
 
 void via_p_file_close(struct via_vm* vm) {
-    const struct via_value* args = via_reg_args(vm);
-    if (!args || args->v_cdr) {
+    if (via_arg_count(vm) != 1) {
         via_throw(vm, via_except_argument_error(vm, ONE_ARG));
         return;
     }
 
-    const struct via_value* handle = via_pop_arg(vm);
-    if (handle->type != VIA_V_HANDLE) {
+    const struct via_value* handle = via_arg(vm, 0);
+    if (via_value_type(handle) != VIA_V_HANDLE) {
         via_throw(vm, via_except_invalid_type(vm, EXPECTED_HANDLE));
         return;
     }
@@ -298,81 +292,70 @@ void via_p_file_close(struct via_vm* vm) {
 }
 
 void via_add_port_procedures(struct via_vm* vm) {
-    via_register_proc(
+    via_register_direct_proc(
         vm,
         "file-stdin",
         "file-stdin-proc",
-        NULL,
         (via_bindable) via_p_file_stdin
     );
-    via_register_proc(
+    via_register_direct_proc(
         vm,
         "file-stdout",
         "file-stdout-proc",
-        NULL,
         (via_bindable) via_p_file_stdout
     );
-    via_register_proc(
+    via_register_direct_proc(
         vm,
         "file-stderr",
         "file-stderr-proc",
-        NULL,
         (via_bindable) via_p_file_stderr
     );
-    via_register_proc(
+    via_register_direct_proc(
         vm,
         "file-open",
         "file-open-proc",
-        NULL,
         (via_bindable) via_p_file_open
     );
-    via_register_proc(
+    via_register_direct_proc(
         vm,
         "file-read",
         "file-read-proc",
-        NULL,
         (via_bindable) via_p_file_read
     );
-    via_register_proc(
+    via_register_direct_proc(
         vm,
         "file-read-line",
         "file-read-line-proc",
-        NULL,
         (via_bindable) via_p_file_readline
     );
-    via_register_proc(
+    via_register_direct_proc(
         vm,
         "file-write",
         "file-write-proc",
-        NULL,
         (via_bindable) via_p_file_write
     );
-    via_register_proc(
+    via_register_direct_proc(
         vm,
         "file-seek",
         "file-seek-proc",
-        NULL,
         (via_bindable) via_p_file_seek
     );
-    via_register_proc(
+    via_register_direct_proc(
         vm,
         "file-tell",
         "file-tell-proc",
-        NULL,
         (via_bindable) via_p_file_tell
     );
-    via_register_proc(
+    via_register_direct_proc(
         vm,
         "file-eof?",
         "file-eofp-proc",
-        NULL,
         (via_bindable) via_p_file_eofp
     );
-    via_register_proc(
+    via_register_direct_proc(
         vm,
         "file-close",
         "file-close-proc",
-        NULL,
         (via_bindable) via_p_file_close
     );
 }
@@ -56,9 +56,9 @@ int dispatch_execution(int argc, char** argv) {
         return -2;
     }
 
-    switch (result->type) {
+    switch (via_value_type(result)) {
     case VIA_V_INT:
-        return result->v_int;
+        return via_value_int(result);
     case VIA_V_BOOL:
         return result->v_bool ? 0 : 1;
     case VIA_V_FLOAT:
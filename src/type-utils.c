@@ -12,6 +12,9 @@
 #include <stdio.h>
 #include <string.h>
 
+#define DEFAULT_ENV_BINDINGS 4
+#define DEFAULT_OUTER_ENV_BINDINGS 256
+
 static const struct via_value* via_value_transformer(
     struct via_vm* vm,
     void* value
@@ -69,6 +72,10 @@ static via_bool via_list_contains(
 }
 
 const struct via_value* via_make_int(struct via_vm* vm, via_int v_int) {
+    if (v_int >= VIA_FIXNUM_MIN && v_int <= VIA_FIXNUM_MAX) {
+        return via_fixnum(v_int);
+    }
+
     struct via_value* value = via_make_value(vm);
     value->type = VIA_V_INT;
     value->v_int = v_int;
@@ -85,11 +92,7 @@ const struct via_value* via_make_float(struct via_vm* vm, via_float v_float) {
 }
 
 const struct via_value* via_make_bool(struct via_vm* vm, via_bool v_bool) {
-    struct via_value* value = via_make_value(vm);
-    value->type = VIA_V_BOOL;
-    value->v_bool = v_bool;
-
-    return value;
+    return &vm->immortals[v_bool];
 }
 
 const struct via_value* via_make_string(
@@ -98,9 +101,16 @@ const struct via_value* via_make_string(
 ) {
     size_t size = strlen(v_string) + 1;
     char* string_copy = via_malloc(size);
+    if (!string_copy) {
+        return NULL;
+    }
     memcpy(string_copy, v_string, size);
 
     struct via_value* value = via_make_value(vm);
+    if (!value) {
+        via_free(string_copy);
+        return NULL;
+    }
     value->type = VIA_V_STRING;
     value->v_string = string_copy;
 
@@ -193,7 +203,44 @@ const struct via_value* via_make_env(
     struct via_vm* vm,
     const struct via_value* parent
 ) {
-    return via_make_pair(vm, parent, NULL);
+    return via_make_env_sized(
+        vm,
+        parent,
+        parent ? DEFAULT_ENV_BINDINGS : DEFAULT_OUTER_ENV_BINDINGS
+    );
+}
+
+const struct via_value* via_make_env_sized(
+    struct via_vm* vm,
+    const struct via_value* parent,
+    size_t bindings
+) {
+    if (!parent) {
+        // The hash table is kept at most half full, and its size a power of
+        // two.
+        size_t cap = 1;
+        while (cap < bindings * 2) {
+            cap *= 2;
+        }
+        bindings = cap;
+    }
+
+    struct via_value* env = via_make_value(vm);
+    if (!env) {
+        return NULL;
+    }
+
+    env->type = VIA_V_ENV;
+    env->v_arr = via_make_array(vm, VIA_ENV_BINDINGS + bindings * 2);
+    if (!env->v_arr) {
+        return NULL;
+    }
+    env->v_size = VIA_ENV_BINDINGS + bindings * 2;
+
+    env->v_arr[VIA_ENV_PARENT] = parent;
+    env->v_arr[VIA_ENV_COUNT] = via_make_int(vm, 0);
+
+    return env;
 }
 
 const struct via_value* via_escape_string(
@@ -274,7 +321,7 @@ static const struct via_value* via_to_string_impl(
     const char* fmt_close = "%s)%s";
     const char* fmt_open_close = "(%s)%s";
 
-    switch (value->type) {
+    switch (via_value_type(value)) {
     case VIA_V_SYMBOL:
         return value;
     case VIA_V_INVALID:
@@ -284,7 +331,7 @@ static const struct via_value* via_to_string_impl(
     case VIA_V_NIL:
         return via_make_stringview(vm, "<nil>");
     case VIA_V_INT:
-        OUT_PRINTF("%" VIA_FMTId, value->v_int);
+        OUT_PRINTF("%" VIA_FMTId, via_value_int(value));
         return out;
     case VIA_V_FLOAT:
         OUT_PRINTF("%f", value->v_float);
@@ -303,6 +350,8 @@ static const struct via_value* via_to_string_impl(
         return via_make_stringview(vm, "<array>");
     case VIA_V_FRAME:
         return via_make_stringview(vm, "<frame>");
+    case VIA_V_ENV:
+        return via_make_stringview(vm, "<env>");
     case VIA_V_BUILTIN:
         OUT_PRINTF("<builtin %" VIA_FMTIx  ">", value->v_int);
         return out;
@@ -322,14 +371,14 @@ static const struct via_value* via_to_string_impl(
         sequence = via_make_pair(vm, value, sequence);
 
         if (!tail) {
-            if (value->v_cdr && value->v_cdr->type == VIA_V_PAIR) {
+            if (value->v_cdr && via_value_type(value->v_cdr) == VIA_V_PAIR) {
                 fmt = fmt_open;
             } else if (value->v_cdr) {
                 fmt = fmt_pair;
             } else {
                 fmt = fmt_open_close;
             }
-        } else if (value->v_cdr && value->v_cdr->type != VIA_V_PAIR) {
+        } else if (value->v_cdr && via_value_type(value->v_cdr) != VIA_V_PAIR) {
             fmt = fmt_dot;
         } else if (!value->v_cdr) {
             fmt = fmt_close;
@@ -5,7 +5,14 @@
 #include <via/alloc.h>
 #include <via/assembler.h>
 #include <via/builtin.h>
+#include <via/compiler.h>
 #include <via/exceptions.h>
+#ifdef VIA_ENABLE_JIT
+#include <via/jit.h>
+#endif
+#ifdef VIA_ENABLE_PARALLEL_MARK
+#include <via/parallel-mark.h>
+#endif
 #include <via/parse.h>
 #include <via/port.h>
 #include <via/type-utils.h>
@@ -16,7 +23,13 @@
 #include <assert.h>
 #include <stdarg.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <time.h>
+#ifdef VIA_ENABLE_BACKGROUND_SWEEP
+#include <pthread.h>
+#include <stdatomic.h>
+#endif
 
 #if 0
 #define DPRINTF(...) do { printf(__VA_ARGS__); } while (0)
@@ -29,11 +42,39 @@
 #define DDPRINTF(...) do {  } while (0)
 #endif
 
+// Use direct threaded dispatch (labels as values) when the compiler supports
+// it, unless explicitly disabled.
+#if (defined(__GNUC__) || defined(__clang__))\
+    && !defined(VIA_NO_THREADED_DISPATCH)
+#define VIA_THREADED_DISPATCH
+#endif
+
 #define DEFAULT_HEAPSIZE 2048 
 #define DEFAULT_STACKSIZE 256
+#define DEFAULT_FRAME_STACK_SIZE 512
+#define INITIAL_SYMBOLS_CAP 512
 #define DEFAULT_BOUND_SIZE 2048
 #define DEFAULT_PROGRAM_SIZE 512
 #define DEFAULT_LABELS_CAP 16
+#define DEFAULT_MARK_STACK_SIZE 256
+#define SLAB_CHUNK_CELLS 4096
+#define DEFAULT_GC_GROWTH_FACTOR 2.0
+#define DEFAULT_GC_MIN_HEAP_CELLS (64 * 1024)
+#define DEFAULT_GC_NURSERY_CELLS (32 * 1024)
+// Full collections stop the world unless a step size is given.
+#define DEFAULT_GC_STEP_CELLS 0
+#define DEFAULT_REMEMBERED_SIZE 256
+#define DEFAULT_ROOTS_SIZE 16
+#define GC_STEP_UNITS 1024
+#define IMMORTALS_COUNT 2
+// Below this many cells, waking up the marking threads costs more than it
+// saves.
+#define PARALLEL_MARK_MIN_CELLS (64 * 1024)
+
+struct via_slab_chunk {
+    struct via_slab_chunk* next;
+    struct via_value cells[];
+};
 
 static void via_env_set_proc(struct via_vm* vm) {
     const struct via_value* symbol = via_pop(vm);
@@ -52,19 +93,385 @@ struct via_assembly_result via_add_core_routines(struct via_vm* vm) {
     via_bind(vm, "form-expand-proc", (via_bindable) via_expand_form);
     via_bind(vm, "assume-proc", (via_bindable) via_assume_frame);
     via_bind(vm, "env-set-proc", (via_bindable) via_env_set_proc);
+    via_bind(
+        vm,
+        "default-except-proc",
+        (via_bindable) via_default_exception_handler
+    );
 
     // Assemble the native routines.
     return via_assemble(vm, builtin_prg); 
 }
 
+// Looks up the addresses of the core routines once they are all assembled, so
+// that transferring control to them takes no label lookups.
+static void via_resolve_routines(struct via_vm* vm) {
+    struct via_routines* r = &vm->routines;
+    r->eval_proc = via_asm_label_lookup(vm, "eval-proc");
+    r->eval_transform_proc = via_asm_label_lookup(vm, "eval-transform-proc");
+    r->transform_template_proc =
+        via_asm_label_lookup(vm, "transform-template-proc");
+    r->lookup_proc = via_asm_label_lookup(vm, "lookup-proc");
+    r->apply_proc = via_asm_label_lookup(vm, "apply-proc");
+    r->form_expand_proc = via_asm_label_lookup(vm, "form-expand-proc");
+    r->env_set_proc = via_asm_label_lookup(vm, "env-set-proc");
+    r->default_except_proc = via_asm_label_lookup(vm, "default-except-proc");
+}
+
+// Hands out a zeroed value cell, according to the allocation strategy of the
+// VM.
+static struct via_value* via_alloc_cell(struct via_vm* vm) {
+    if (vm->allocator == VIA_ALLOC_MALLOC) {
+        return via_calloc(1, sizeof(struct via_value));
+    }
+
+    if (!vm->slab_free) {
+        struct via_slab_chunk* chunk = via_malloc(
+            sizeof(struct via_slab_chunk)
+                + sizeof(struct via_value) * SLAB_CHUNK_CELLS
+        );
+        if (!chunk) {
+            return NULL;
+        }
+        chunk->next = vm->slab_chunks;
+        vm->slab_chunks = chunk;
+
+        // Thread the new cells onto the free list in address order.
+        for (size_t i = SLAB_CHUNK_CELLS; i > 0; --i) {
+            chunk->cells[i - 1].v_car = vm->slab_free;
+            vm->slab_free = &chunk->cells[i - 1];
+        }
+    }
+
+    struct via_value* cell = vm->slab_free;
+    vm->slab_free = (struct via_value*) cell->v_car;
+    memset(cell, 0, sizeof(struct via_value));
+    return cell;
+}
+
+static void via_release_cell(struct via_vm* vm, struct via_value* cell) {
+    if (vm->allocator == VIA_ALLOC_MALLOC) {
+        via_free(cell);
+        return;
+    }
+
+    cell->v_car = vm->slab_free;
+    vm->slab_free = cell;
+}
+
+// Frees what the value owns, but not its cell.
+static void via_free_contents(struct via_value* value) {
+    switch (value->type) {
+    case VIA_V_STRING:
+    case VIA_V_SYMBOL:
+        via_free((char*) value->v_string);
+        break;
+    case VIA_V_ARRAY:
+    case VIA_V_FRAME:
+    case VIA_V_ENV:
+        via_free((struct via_value*) value->v_arr);
+        break;
+    case VIA_V_HANDLE:
+        via_file_close(value);
+        break;
+    }
+}
+
+static void via_delete_value(struct via_vm* vm, struct via_value* value) {
+    via_free_contents(value);
+    via_release_cell(vm, value);
+}
+
+#ifdef VIA_ENABLE_BACKGROUND_SWEEP
+// Thread freeing the values found dead by full collections. The slots of the
+// freed values are passed back through a single producer, single consumer
+// queue, of which the entries below the published count are ready for the
+// VM to reuse.
+struct via_sweeper {
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    pthread_cond_t idle;
+    via_bool busy;
+    via_bool shutdown;
+
+    // Dead values of the sweep in progress, one bit per heap slot.
+    uint64_t* dead_bits;
+    via_int dead_words;
+    const struct via_value** heap;
+
+    via_int* queue;
+    via_int cap;
+    atomic_size_t published;
+    size_t reclaimed;
+};
+
+static void via_sweeper_run(struct via_vm* vm, struct via_sweeper* sweeper) {
+    size_t count = 0;
+    // Sweep downwards, so that the lowest free slots end up on top of the
+    // free slot stack.
+    for (via_int word = sweeper->dead_words - 1; word >= 0; --word) {
+        uint64_t dead = sweeper->dead_bits[word];
+        for (int bit = 63; dead; --bit) {
+            if (!((dead >> bit) & 1)) {
+                continue;
+            }
+            dead &= ~((uint64_t) 1 << bit);
+            const via_int slot = word * 64 + bit;
+            struct via_value* value =
+                (struct via_value*) sweeper->heap[slot];
+            via_free_contents(value);
+            if (vm->allocator == VIA_ALLOC_MALLOC) {
+                via_free(value);
+            }
+            sweeper->queue[count++] = slot;
+        }
+        atomic_store_explicit(
+            &sweeper->published,
+            count,
+            memory_order_release
+        );
+    }
+}
+
+static void* via_sweeper_thread(void* arg) {
+    struct via_vm* vm = arg;
+    struct via_sweeper* sweeper = vm->sweeper;
+
+    pthread_mutex_lock(&sweeper->lock);
+    for (;;) {
+        while (!sweeper->busy && !sweeper->shutdown) {
+            pthread_cond_wait(&sweeper->wake, &sweeper->lock);
+        }
+        if (sweeper->shutdown) {
+            break;
+        }
+        pthread_mutex_unlock(&sweeper->lock);
+
+        via_sweeper_run(vm, sweeper);
+
+        pthread_mutex_lock(&sweeper->lock);
+        sweeper->busy = false;
+        pthread_cond_broadcast(&sweeper->idle);
+    }
+    pthread_mutex_unlock(&sweeper->lock);
+
+    return NULL;
+}
+
+static void via_sweeper_init(struct via_vm* vm) {
+    struct via_sweeper* sweeper = via_calloc(1, sizeof(struct via_sweeper));
+    if (!sweeper) {
+        return;
+    }
+    pthread_mutex_init(&sweeper->lock, NULL);
+    pthread_cond_init(&sweeper->wake, NULL);
+    pthread_cond_init(&sweeper->idle, NULL);
+    atomic_init(&sweeper->published, 0);
+
+    vm->sweeper = sweeper;
+    if (pthread_create(&sweeper->thread, NULL, via_sweeper_thread, vm)) {
+        vm->sweeper = NULL;
+        pthread_cond_destroy(&sweeper->idle);
+        pthread_cond_destroy(&sweeper->wake);
+        pthread_mutex_destroy(&sweeper->lock);
+        via_free(sweeper);
+    }
+}
+
+// Takes over the slots of the values freed so far.
+static void via_sweeper_reclaim(struct via_vm* vm) {
+    struct via_sweeper* sweeper = vm->sweeper;
+    const size_t published = atomic_load_explicit(
+        &sweeper->published,
+        memory_order_acquire
+    );
+    for (; sweeper->reclaimed < published; ++sweeper->reclaimed) {
+        const via_int slot = sweeper->queue[sweeper->reclaimed];
+        if (vm->allocator != VIA_ALLOC_MALLOC) {
+            via_release_cell(vm, (struct via_value*) vm->heap[slot]);
+        }
+        vm->heap[slot] = NULL;
+        vm->free_slots[vm->free_slots_count++] = slot;
+    }
+}
+
+// Waits for the sweep in progress, if any, and takes over its slots.
+static void via_sweeper_wait(struct via_vm* vm) {
+    struct via_sweeper* sweeper = vm->sweeper;
+    if (!sweeper) {
+        return;
+    }
+    pthread_mutex_lock(&sweeper->lock);
+    while (sweeper->busy) {
+        pthread_cond_wait(&sweeper->idle, &sweeper->lock);
+    }
+    pthread_mutex_unlock(&sweeper->lock);
+
+    via_sweeper_reclaim(vm);
+    sweeper->reclaimed = 0;
+    atomic_store_explicit(&sweeper->published, 0, memory_order_relaxed);
+}
+
+static void via_sweeper_free(struct via_vm* vm) {
+    struct via_sweeper* sweeper = vm->sweeper;
+    if (!sweeper) {
+        return;
+    }
+    via_sweeper_wait(vm);
+
+    pthread_mutex_lock(&sweeper->lock);
+    sweeper->shutdown = true;
+    pthread_cond_signal(&sweeper->wake);
+    pthread_mutex_unlock(&sweeper->lock);
+    pthread_join(sweeper->thread, NULL);
+
+    pthread_cond_destroy(&sweeper->idle);
+    pthread_cond_destroy(&sweeper->wake);
+    pthread_mutex_destroy(&sweeper->lock);
+    via_free(sweeper->dead_bits);
+    via_free(sweeper->queue);
+    via_free(sweeper);
+    vm->sweeper = NULL;
+}
+
+#endif
+
+static via_bool via_frame_on_stack(
+    struct via_vm* vm,
+    const struct via_value* frame
+) {
+    return (const char*) frame >= (const char*) vm->frames
+        && (const char*) frame < (const char*) (vm->frames + vm->frames_cap);
+}
+
+// Makes the frame current, and drops the frames above it off the stack.
+static void via_enter_frame(struct via_vm* vm, const struct via_value* frame) {
+    vm->regs = (struct via_value*) frame;
+    vm->frames_top = via_frame_on_stack(vm, frame)
+        ? (const struct via_frame*) frame - vm->frames + 1
+        : 0;
+}
+
+// Makes a frame on the heap with the given registers, apart from the parent.
+static struct via_value* via_heap_frame(
+    struct via_vm* vm,
+    const struct via_value* const* regs,
+    const struct via_value* parent
+) {
+    struct via_value* frame = via_make_value(vm);
+    if (!frame) {
+        return NULL;
+    }
+
+    frame->type = VIA_V_FRAME;
+    frame->v_arr = via_make_array(vm, VIA_REG_COUNT);
+    if (!frame->v_arr) {
+        return NULL;
+    }
+    frame->v_size = VIA_REG_COUNT;
+
+    frame->v_arr[VIA_REG_PC] = via_make_value(vm);
+    ((struct via_value*) frame->v_arr[VIA_REG_PC])->type = VIA_V_INT;
+    ((struct via_value*) frame->v_arr[VIA_REG_PC])->v_int =
+        regs[VIA_REG_PC]->v_int;
+    for (size_t i = 1; i < VIA_REG_COUNT - 1; ++i) {
+        frame->v_arr[i] = regs[i];
+    }
+    frame->v_arr[VIA_REG_PARN] = parent;
+
+    return frame;
+}
+
+// Copies the frame to the heap, along with its parents on the stack.
+static const struct via_value* via_frame_to_heap(
+    struct via_vm* vm,
+    const struct via_value* frame
+) {
+    if (!via_frame_on_stack(vm, frame)) {
+        return frame;
+    }
+    return via_heap_frame(
+        vm,
+        frame->v_arr,
+        via_frame_to_heap(vm, frame->v_arr[VIA_REG_PARN])
+    );
+}
+
+// Pushes a copy of the current frame onto the control stack, with the current
+// frame as its parent, and makes it current. Should the stack be full, the
+// frames on it are moved to the heap first.
+static void via_push_frame(struct via_vm* vm) {
+    if (vm->frames_top == vm->frames_cap) {
+        via_capture_frame(vm);
+    }
+
+    struct via_frame* frame = &vm->frames[vm->frames_top++];
+    if (vm->regs) {
+        frame->pc.v_int = via_reg_pc(vm)->v_int;
+        for (size_t i = 1; i < VIA_REG_COUNT - 1; ++i) {
+            frame->regs[i] = vm->regs->v_arr[i];
+        }
+        frame->regs[VIA_REG_ARGS] = via_make_int(vm, via_reg_sptr(vm)->v_int);
+    }
+    frame->regs[VIA_REG_PARN] = vm->regs;
+    vm->regs = &frame->value;
+}
+
 struct via_vm* via_create_vm() {
+    return via_create_vm_with_options(NULL);
+}
+
+struct via_vm* via_create_vm_with_options(
+    const struct via_vm_options* options
+) {
     struct via_vm* vm = via_calloc(1, sizeof(struct via_vm));
     if (vm) {
+        if (options) {
+            vm->allocator = options->allocator;
+            // Evacuated cells are carved out of slab chunks.
+            if (vm->allocator == VIA_ALLOC_SLAB) {
+                vm->collector = options->collector;
+            }
+        }
+
         vm->heap = via_calloc(DEFAULT_HEAPSIZE, sizeof(struct via_value*));
         if (!vm->heap) {
             goto cleanup_vm;
         }
         vm->heap_cap = DEFAULT_HEAPSIZE;
+        vm->heap_top = -1;
+
+        vm->free_slots = via_malloc(DEFAULT_HEAPSIZE * sizeof(via_int));
+        if (!vm->free_slots) {
+            goto cleanup_heap;
+        }
+        vm->nursery = via_malloc(DEFAULT_HEAPSIZE * sizeof(via_int));
+        if (!vm->nursery) {
+            goto cleanup_heap;
+        }
+        vm->alloc_bits = via_calloc(DEFAULT_HEAPSIZE / 64, sizeof(uint64_t));
+        vm->mark_bits = via_calloc(DEFAULT_HEAPSIZE / 64, sizeof(uint64_t));
+        if (!vm->alloc_bits || !vm->mark_bits) {
+            goto cleanup_heap;
+        }
+        vm->nursery_limit = SIZE_MAX;
+
+        // Immortal values take up the lowest heap slots, and are left out of
+        // the alloc bitmap so that no sweep takes them for dead.
+        vm->immortals = via_calloc(IMMORTALS_COUNT, sizeof(struct via_value));
+        if (!vm->immortals) {
+            goto cleanup_heap;
+        }
+        for (via_int i = 0; i < IMMORTALS_COUNT; ++i) {
+            struct via_value* value = &vm->immortals[i];
+            value->type = VIA_V_BOOL;
+            value->v_bool = i;
+            value->slot = i;
+            value->flags = VIA_CELL_OLD | VIA_CELL_IMMORTAL;
+            vm->heap[i] = value;
+        }
+        vm->heap_top = IMMORTALS_COUNT - 1;
 
         vm->program = via_calloc(DEFAULT_PROGRAM_SIZE, sizeof(via_opcode));
         if (!vm->program) {
@@ -90,19 +497,69 @@ struct via_vm* via_create_vm() {
         if (!vm->bound_data) {
             goto cleanup_bound;
         }
+        vm->bound_direct = via_calloc(DEFAULT_BOUND_SIZE, sizeof(via_bool));
+        if (!vm->bound_direct) {
+            goto cleanup_bound_data;
+        }
         vm->bound_cap = DEFAULT_BOUND_SIZE;
 
         vm->stack = via_calloc(DEFAULT_STACKSIZE, sizeof(struct via_value*));
         if (!vm->stack) {
-            goto cleanup_bound_data;
+            goto cleanup_bound_direct;
         }
         vm->stack_size = DEFAULT_STACKSIZE;
 
+        vm->frames =
+            via_calloc(DEFAULT_FRAME_STACK_SIZE, sizeof(struct via_frame));
+        if (!vm->frames) {
+            goto cleanup_stack;
+        }
+        vm->frames_cap = DEFAULT_FRAME_STACK_SIZE;
+        // The frame values and program counters on the stack are owned by the
+        // VM, and left alone by the collector.
+        for (size_t i = 0; i < vm->frames_cap; ++i) {
+            struct via_frame* frame = &vm->frames[i];
+            frame->value.type = VIA_V_FRAME;
+            frame->value.v_arr = frame->regs;
+            frame->value.v_size = VIA_REG_COUNT;
+            frame->value.flags = VIA_CELL_OLD | VIA_CELL_IMMORTAL;
+            frame->pc.type = VIA_V_INT;
+            frame->pc.flags = VIA_CELL_OLD | VIA_CELL_IMMORTAL;
+            frame->regs[VIA_REG_PC] = &frame->pc;
+        }
+
+#ifdef VIA_ENABLE_PARALLEL_MARK
+        // Marking stays serial if the threads can't be started.
+        if (options && options->mark_threads > 1) {
+            via_parallel_mark_init(vm, options->mark_threads);
+        }
+#endif
+#ifdef VIA_ENABLE_BACKGROUND_SWEEP
+        // Likewise for sweeping.
+        if (options && options->background_sweep) {
+            via_sweeper_init(vm);
+        }
+#endif
+
         vm->regs = NULL;
-        vm->regs = (struct via_value*) via_make_frame(vm);
-        via_set_pc(vm, (struct via_value*) via_make_int(vm, 0));
-        via_set_env(vm, via_make_env(vm, NULL));
-        via_set_sptr(vm, (struct via_value*) via_make_int(vm, 0));
+        via_push_frame(vm);
+        vm->globals = via_make_env(vm, NULL);
+        via_write_barrier(vm, NULL, NULL, vm->globals);
+        vm->lookup_epoch = 1;
+        via_set_env(vm, vm->globals);
+        // The stack pointer is updated in place, which rules out fixnums.
+        struct via_value* sptr = via_make_value(vm);
+        sptr->type = VIA_V_INT;
+        via_set_sptr(vm, sptr);
+        via_set_args(vm, via_make_int(vm, 0));
+
+#ifdef VIA_ENABLE_JIT
+        via_jit_init(vm);
+#endif
+#ifdef VIA_ENABLE_OPCODE_PAIRS
+        // Pairs simply go uncounted if there is no room for the histogram.
+        vm->opcode_pairs = via_calloc(256 * 256, sizeof(uint64_t));
+#endif
 
         { 
             struct via_assembly_result result = via_add_core_routines(vm);
@@ -117,6 +574,8 @@ struct via_vm* via_create_vm() {
         }
 
         via_add_core_forms(vm);
+        via_resolve_routines(vm);
+        via_init_compiler(vm);
         via_add_core_procedures(vm);
 
         const struct via_value* native = via_parse(vm, native_via, NULL);
@@ -135,7 +594,7 @@ struct via_vm* via_create_vm() {
                     ((intptr_t) cursor) - ((intptr_t) native_via)
                 );
             }
-            goto cleanup_stack;
+            goto cleanup_frames;
         }
         
         via_set_expr(vm, via_parse_ctx_program(native)->v_car);
@@ -147,18 +606,40 @@ struct via_vm* via_create_vm() {
                     "Exception in bundled code: %s\n",
                     via_to_string(vm, result->v_cdr)->v_string
                 );
-                goto cleanup_stack;
+                goto cleanup_frames;
             }
         }
+
+        // Automatic collection is only enabled once the VM is fully set up.
+        const struct via_gc_policy policy = {
+            .enabled = true,
+            .growth_factor = DEFAULT_GC_GROWTH_FACTOR,
+            .min_heap_cells = DEFAULT_GC_MIN_HEAP_CELLS,
+            .nursery_cells = DEFAULT_GC_NURSERY_CELLS,
+            .step_cells = DEFAULT_GC_STEP_CELLS
+        };
+        via_set_gc_policy(vm, &policy);
     }
 
     return vm;
 
+cleanup_frames:
+#ifdef VIA_ENABLE_PARALLEL_MARK
+    via_parallel_mark_free(vm);
+#endif
+#ifdef VIA_ENABLE_BACKGROUND_SWEEP
+    via_sweeper_free(vm);
+#endif
+    via_free(vm->frames);
+
 cleanup_stack:
     via_free((struct via_value**) vm->stack);
 
+cleanup_bound_direct:
+    via_free(vm->bound_direct);
+
 cleanup_bound_data:
-    via_free(vm->bound);
+    via_free(vm->bound_data);
 
 cleanup_bound:
     via_free(vm->bound);
@@ -173,6 +654,11 @@ cleanup_program:
     via_free(vm->program);
 
 cleanup_heap:
+    via_free(vm->immortals);
+    via_free(vm->mark_bits);
+    via_free(vm->alloc_bits);
+    via_free(vm->nursery);
+    via_free(vm->free_slots);
     via_free((struct via_value**) vm->heap);
 
 cleanup_vm:
@@ -181,28 +667,97 @@ cleanup_vm:
     return NULL;
 }
 
-static void via_delete_value(struct via_value* value) {
-    switch (value->type) {
-    case VIA_V_STRING:
-    case VIA_V_SYMBOL:
-        via_free((char*) value->v_string);
-        break;
-    case VIA_V_ARRAY:
-    case VIA_V_FRAME:
-        via_free((struct via_value*) value->v_arr);
-        break;
-    case VIA_V_HANDLE:
-        via_file_close(value);
-        break;
-    }
+#ifdef VIA_ENABLE_OPCODE_PAIRS
+static const char* const opcode_names[256] = {
+    [VIA_OP_NOP] = "nop",
+    [VIA_OP_CAR] = "car",
+    [VIA_OP_CDR] = "cdr",
+    [VIA_OP_CALL] = "call",
+    [VIA_OP_CALLACC] = "callacc",
+    [VIA_OP_CALLB] = "callb",
+    [VIA_OP_SET] = "set",
+    [VIA_OP_LOAD] = "load",
+    [VIA_OP_LOADNIL] = "loadnil",
+    [VIA_OP_SETRET] = "setret",
+    [VIA_OP_LOADRET] = "loadret",
+    [VIA_OP_PAIRP] = "pairp",
+    [VIA_OP_SYMBOLP] = "symbolp",
+    [VIA_OP_FORMP] = "formp",
+    [VIA_OP_FRAMEP] = "framep",
+    [VIA_OP_BUILTINP] = "builtinp",
+    [VIA_OP_SKIPZ] = "skipz",
+    [VIA_OP_SNAP] = "snap",
+    [VIA_OP_RETURN] = "return",
+    [VIA_OP_JMP] = "jmp",
+    [VIA_OP_PUSH] = "push",
+    [VIA_OP_POP] = "pop",
+    [VIA_OP_DROP] = "drop",
+    [VIA_OP_PUSHARG] = "pusharg",
+    [VIA_OP_POPARG] = "poparg",
+    [VIA_OP_LOADK] = "loadk",
+    [VIA_OP_EQK] = "eqk",
+    [VIA_OP_LOADL] = "loadl",
+    [VIA_OP_LOADG] = "loadg",
+    [VIA_OP_TYPESWITCH] = "typeswitch",
+    [VIA_OP_NATIVEP] = "nativep",
+    [VIA_OP_ADD] = "add",
+    [VIA_OP_SUB] = "sub",
+    [VIA_OP_MUL] = "mul",
+    [VIA_OP_DIV] = "div",
+    [VIA_OP_EQ] = "eq",
+    [VIA_OP_NEQ] = "neq",
+    [VIA_OP_LT] = "lt",
+    [VIA_OP_GT] = "gt",
+    [VIA_OP_LTE] = "lte",
+    [VIA_OP_GTE] = "gte",
+    [VIA_OP_SKIPNT] = "skipnt",
+    [VIA_OP_LOADKSET] = "loadkset",
+    [VIA_OP_LOADKL] = "loadkl",
+    [VIA_OP_CALLBR] = "callbr",
+    [VIA_OP_DEBUG] = "debug"
+};
 
-    via_free(value);
+// Appends the opcode pairs counted by the VM to the file named by the
+// VIA_OPCODE_PAIRS environment variable, if set, one "first second count"
+// line per pair. Runs of several programs can then be summed up by pair.
+static void via_dump_opcode_pairs(struct via_vm* vm) {
+    const char* path = getenv("VIA_OPCODE_PAIRS");
+    if (!path || !vm->opcode_pairs) {
+        return;
+    }
+    FILE* file = fopen(path, "a");
+    if (!file) {
+        return;
+    }
+    for (size_t i = 0; i < 256 * 256; ++i) {
+        if (!vm->opcode_pairs[i]) {
+            continue;
+        }
+        const char* first = opcode_names[i >> 8];
+        const char* second = opcode_names[i & 0xff];
+        fprintf(
+            file,
+            "%s %s %llu\n",
+            first ? first : "?",
+            second ? second : "?",
+            (unsigned long long) vm->opcode_pairs[i]
+        );
+    }
+    fclose(file);
 }
+#endif
 
 void via_free_vm(struct via_vm* vm) {
+#ifdef VIA_ENABLE_OPCODE_PAIRS
+    via_dump_opcode_pairs(vm);
+    via_free(vm->opcode_pairs);
+#endif
     via_free((struct via_value**) vm->stack);
+    via_free(vm->frames);
+    via_free(vm->bound_direct);
     via_free(vm->bound_data);
     via_free(vm->bound);
+    via_free(vm->label_index);
     via_free(vm->label_addrs);
 
     for (via_int i = 0; i < vm->labels_count; ++i) {
@@ -211,123 +766,288 @@ void via_free_vm(struct via_vm* vm) {
     via_free(vm->labels);
 
     via_free(vm->program);
+    via_free(vm->free_ranges);
+
+    via_free((struct via_value**) vm->symbols);
+    via_free(vm->lookup_caches);
+    via_free(vm->free_caches);
+    via_free((struct via_value**) vm->consts);
+    via_free(vm->consts_owned);
+    via_free(vm->free_consts);
+    for (size_t i = 0; i < vm->compiled_cap; ++i) {
+        if (vm->compiled_exprs[i]) {
+            via_free(vm->compiled_code[i].owned);
+        }
+    }
+    via_free((struct via_value**) vm->compiled_exprs);
+    via_free(vm->compiled_code);
+    via_free(vm->code_spans);
+
+#ifdef VIA_ENABLE_JIT
+    via_jit_free(vm);
+#endif
+#ifdef VIA_ENABLE_PARALLEL_MARK
+    via_parallel_mark_free(vm);
+#endif
+#ifdef VIA_ENABLE_BACKGROUND_SWEEP
+    via_sweeper_free(vm);
+#endif
 
     for (via_int i = 0; i < vm->heap_cap; ++i) {
-        if (vm->heap[i]) {
-            via_delete_value((struct via_value*) vm->heap[i]);
+        if (vm->heap[i] && !(vm->heap[i]->flags & VIA_CELL_IMMORTAL)) {
+            via_delete_value(vm, (struct via_value*) vm->heap[i]);
         }
     }
+    via_free(vm->immortals);
     via_free((struct via_value**) vm->heap);
+    via_free(vm->free_slots);
+    via_free(vm->nursery);
+    via_free(vm->alloc_bits);
+    via_free(vm->mark_bits);
+    via_free((struct via_value**) vm->remembered);
+    via_free((struct via_value**) vm->roots);
+    via_free((struct via_value**) vm->mark_stack);
+
+    while (vm->slab_chunks) {
+        struct via_slab_chunk* next = vm->slab_chunks->next;
+        via_free(vm->slab_chunks);
+        vm->slab_chunks = next;
+    }
 
     via_free(vm);
 }
 
-struct via_value* via_make_value(struct via_vm* vm) {
-    size_t i = vm->heap_free;
-    for (; i < vm->heap_top + 1 && (vm->heap[i] != NULL); ++i) {
+static via_bool via_grow_bitmap(uint64_t** bits, via_int cap) {
+    const size_t words = cap / 64;
+    uint64_t* new_bits = via_realloc(*bits, sizeof(uint64_t) * words * 2);
+    if (!new_bits) {
+        return false;
     }
+    memset(&new_bits[words], 0, sizeof(uint64_t) * words);
+    *bits = new_bits;
+    return true;
+}
 
-    if (i == vm->heap_cap) {
-        const struct via_value** new_heap = via_realloc(
-            (struct via_value**) vm->heap,
-            sizeof(struct via_value*) * vm->heap_cap * 2
-        );
-        if (!new_heap) {
-            return NULL;
-        }
-        memset(
-            &new_heap[vm->heap_cap],
-            0,
-            sizeof(struct via_value*) * vm->heap_cap
-        );
-        vm->heap = new_heap;
-        vm->heap_cap *= 2;
+// Doubles the number of heap slots, along with the tables indexed by slot.
+static via_bool via_grow_heap(struct via_vm* vm) {
+    const struct via_value** new_heap = via_realloc(
+        (struct via_value**) vm->heap,
+        sizeof(struct via_value*) * vm->heap_cap * 2
+    );
+    if (!new_heap) {
+        return false;
     }
+    memset(
+        &new_heap[vm->heap_cap],
+        0,
+        sizeof(struct via_value*) * vm->heap_cap
+    );
+    vm->heap = new_heap;
 
-    if (i > vm->heap_top) {
-        vm->heap_top = i;
+    // Every slot may end up on the free slot stack.
+    via_int* new_free_slots = via_realloc(
+        vm->free_slots,
+        sizeof(via_int) * vm->heap_cap * 2
+    );
+    if (!new_free_slots) {
+        return false;
     }
-    struct via_value* val = via_calloc(1, sizeof(struct via_value));
-    vm->heap[i] = val;
-    vm->heap_free = i + 1;
-    val->type = VIA_V_NIL;
-    return val;
-}
+    vm->free_slots = new_free_slots;
 
-const struct via_value* via_make_frame(struct via_vm* vm) {
-    struct via_value* frame = via_make_value(vm);
-    if (!frame) {
-        return NULL;
+    // Likewise, every slot may hold a young value.
+    via_int* new_nursery = via_realloc(
+        vm->nursery,
+        sizeof(via_int) * vm->heap_cap * 2
+    );
+    if (!new_nursery) {
+        return false;
     }
+    vm->nursery = new_nursery;
 
-    frame->type = VIA_V_FRAME;
-    frame->v_arr = via_make_array(vm, VIA_REG_COUNT);
-    if (!frame->v_arr) {
-        return NULL;
+    if (
+        !via_grow_bitmap(&vm->alloc_bits, vm->heap_cap)
+            || !via_grow_bitmap(&vm->mark_bits, vm->heap_cap)
+    ) {
+        return false;
     }
-    frame->v_size = VIA_REG_COUNT;
 
-    frame->v_arr[VIA_REG_PC] = via_make_value(vm);
-    ((struct via_value*) frame->v_arr[VIA_REG_PC])->type = VIA_V_INT;
-    if (vm->regs) {
-        ((struct via_value*) frame->v_arr[VIA_REG_PC])->v_int =
-            via_reg_pc(vm)->v_int;
-        for (size_t i = 1; i < VIA_REG_COUNT - 1; ++i) {
-            const struct via_value** fval = &frame->v_arr[i];
-            *fval = vm->regs->v_arr[i];
+    vm->heap_cap *= 2;
+    return true;
+}
+
+struct via_value* via_make_value(struct via_vm* vm) {
+#ifdef VIA_ENABLE_BACKGROUND_SWEEP
+    if (!vm->free_slots_count && vm->sweeper) {
+        // Rather than growing the heap, which the sweeper reads, wait for the
+        // slots being freed.
+        if (vm->heap_top + 1 == vm->heap_cap) {
+            via_sweeper_wait(vm);
+        } else {
+            via_sweeper_reclaim(vm);
         }
     }
-    frame->v_arr[VIA_REG_PARN] = vm->regs;
-
-    if (vm->regs) {
-        DPRINTF(
-            "\t\t\tExpr: %s\n",
-            via_to_string(vm, via_reg_expr(vm))->v_string
-        );
+#endif
+    via_int i;
+    if (vm->free_slots_count) {
+        i = vm->free_slots[--vm->free_slots_count];
+    } else {
+        i = vm->heap_top + 1;
+        if (i == vm->heap_cap && !via_grow_heap(vm)) {
+            return NULL;
+        }
+        vm->heap_top = i;
     }
 
-    return frame;
-}
-
-const struct via_value* via_sym(struct via_vm* vm, const char* name) {
-    struct via_value* entry;
-    const struct via_value* cursor = vm->symbols;
-    if (!vm->symbols) {
-        entry = (struct via_value*) via_make_string(vm, name);
-        ((struct via_value*) entry)->type = VIA_V_SYMBOL;
-
-        vm->symbols = (struct via_value*) via_make_pair(vm, entry, NULL);
-        return vm->symbols->v_car;
+    struct via_value* val = via_alloc_cell(vm);
+    if (!val) {
+        vm->free_slots[vm->free_slots_count++] = i;
+        return NULL;
+    }
+    vm->heap[i] = val;
+    val->type = VIA_V_NIL;
+    val->slot = i;
+    vm->alloc_bits[i / 64] |= (uint64_t) 1 << (i % 64);
+    if (vm->gc_phase == VIA_GC_IDLE) {
+        vm->nursery[vm->nursery_count++] = i;
     } else {
-        bool found;
-        while(
-            !(found = (strcmp(cursor->v_car->v_symbol, name) == 0))
-                && cursor->v_cdr
+        val->flags = VIA_CELL_OLD;
+        if (
+            vm->gc_phase == VIA_GC_MARKING
+                || i / 64 <= vm->sweep_cursor
         ) {
-            cursor = cursor->v_cdr;
-        }
-        if (found) {
-            return cursor->v_car;
+            // Allocated black, for the cycle in progress to keep.
+            vm->mark_bits[i / 64] |= (uint64_t) 1 << (i % 64);
         }
     }
 
-    entry = (struct via_value*) via_make_string(vm, name);
-    entry->type = VIA_V_SYMBOL;
+    if (
+        (++vm->heap_cells >= vm->gc_threshold
+            || vm->nursery_count >= vm->nursery_limit)
+        && vm->gc_policy.enabled
+    ) {
+        vm->gc_requested = true;
+    }
 
-    ((struct via_value*) cursor)->v_cdr = via_make_pair(vm, entry, NULL);
+    return val;
+}
 
-    return cursor->v_cdr->v_car;
+const struct via_value* via_capture_frame(struct via_vm* vm) {
+    via_enter_frame(vm, via_frame_to_heap(vm, vm->regs));
+    return vm->regs;
+}
+
+const struct via_value* via_make_frame(struct via_vm* vm) {
+    const struct via_value* parent = via_capture_frame(vm);
+    DPRINTF(
+        "\t\t\tExpr: %s\n",
+        via_to_string(vm, via_reg_expr(vm))->v_string
+    );
+    return via_heap_frame(vm, parent->v_arr, parent);
+}
+
+uint32_t via_hash_name(const char* name) {
+    uint32_t h = 0x811c9dc5u;
+    for (; *name; ++name) {
+        h = (h ^ (uint8_t) *name) * 0x01000193u;
+    }
+    return h;
+}
+
+static via_bool via_symbols_insert(
+    struct via_vm* vm,
+    const struct via_value* symbol
+) {
+    if ((vm->symbols_count + 1) * 2 > vm->symbols_cap) {
+        const size_t old_cap = vm->symbols_cap;
+        const struct via_value** old_symbols = vm->symbols;
+
+        const size_t new_cap = old_cap ? old_cap * 2 : INITIAL_SYMBOLS_CAP;
+        const struct via_value** new_symbols = via_calloc(
+            new_cap,
+            sizeof(struct via_value*)
+        );
+        if (!new_symbols) {
+            return false;
+        }
+
+        vm->symbols = new_symbols;
+        vm->symbols_cap = new_cap;
+        vm->symbols_count = 0;
+        for (size_t i = 0; i < old_cap; ++i) {
+            if (old_symbols[i]) {
+                via_symbols_insert(vm, old_symbols[i]);
+            }
+        }
+        via_free(old_symbols);
+    }
+
+    const size_t mask = vm->symbols_cap - 1;
+    size_t i = symbol->v_symbol_hash & mask;
+    while (vm->symbols[i]) {
+        i = (i + 1) & mask;
+    }
+    vm->symbols[i] = symbol;
+    via_write_barrier(vm, NULL, NULL, symbol);
+    vm->symbols_count++;
+
+    return true;
+}
+
+const struct via_value* via_sym(struct via_vm* vm, const char* name) {
+    const uint32_t hash = via_hash_name(name);
+    if (vm->symbols_cap) {
+        const size_t mask = vm->symbols_cap - 1;
+        for (size_t i = hash & mask; vm->symbols[i]; i = (i + 1) & mask) {
+            const struct via_value* symbol = vm->symbols[i];
+            if (
+                symbol->v_symbol_hash == hash
+                    && strcmp(symbol->v_symbol, name) == 0
+            ) {
+                return symbol;
+            }
+        }
+    }
+
+    struct via_value* entry = (struct via_value*) via_make_string(vm, name);
+    if (!entry) {
+        return NULL;
+    }
+    entry->type = VIA_V_SYMBOL;
+    entry->v_symbol_hash = hash;
+    if (!via_symbols_insert(vm, entry)) {
+        return NULL;
+    }
+
+    return entry;
+}
+
+// Returns the height of the stack where the current frame started out, above
+// which its arguments are.
+static via_int via_arg_base(struct via_vm* vm) {
+    const struct via_value* base = via_reg_args(vm);
+    return via_is_fixnum(base)
+        ? via_value_int(base)
+        : via_reg_sptr(vm)->v_int;
+}
+
+// Pops the values above the height off the stack.
+static void via_unwind_stack(struct via_vm* vm, via_int height) {
+    struct via_value* sptr = via_reg_sptr(vm);
+    while (sptr->v_int > height) {
+        vm->stack[--sptr->v_int] = NULL;
+    }
 }
 
 void via_return_outer(struct via_vm* vm, const struct via_value* value) {
     vm->ret = value;
-    vm->regs = (struct via_value*) via_reg_parn(vm);
+    via_unwind_stack(vm, via_arg_base(vm));
+    via_enter_frame(vm, via_reg_parn(vm));
     via_reg_pc(vm)->v_int = 0;
 }
 
 void via_assume_frame(struct via_vm* vm) {
-    assert(vm->acc->type == VIA_V_FRAME);
-    vm->regs = (struct via_value*) vm->acc;
+    assert(via_value_type(vm->acc) == VIA_V_FRAME);
+    via_enter_frame(vm, vm->acc);
 }
 
 via_int via_bind(struct via_vm* vm, const char* name, via_bindable func) {
@@ -357,11 +1077,20 @@ via_int via_bind_context(
             return -1;
         }
         vm->bound_data = new_bound_data;
+        via_bool* new_bound_direct = via_realloc(
+            vm->bound_direct,
+            sizeof(via_bool) * vm->bound_cap * 2
+        );
+        if (!new_bound_direct) {
+            return -1;
+        }
+        vm->bound_direct = new_bound_direct;
         vm->bound_cap *= 2;
     }
     const via_int index = vm->bound_count++;
     vm->bound[index] = func;
     vm->bound_data[index] = user_data;
+    vm->bound_direct[index] = false;
 
     char buffer[256];
     snprintf(buffer, 256, "%s:\ncallb %" VIA_FMTId "\nreturn", name, index);
@@ -404,6 +1133,19 @@ void via_register_proc_context(
     );
 }
 
+void via_register_direct_proc(
+    struct via_vm* vm,
+    const char* symbol,
+    const char* asm_label,
+    via_bindable func
+) {
+    const size_t index = vm->bound_count;
+    via_register_proc(vm, symbol, asm_label, NULL, func);
+    if (vm->bound_count > index) {
+        vm->bound_direct[index] = true;
+    }
+}
+
 void via_register_native_proc(
     struct via_vm* vm,
     const char* symbol,
@@ -481,6 +1223,12 @@ void via_push(struct via_vm* vm, const struct via_value* value) {
             // TODO: Throw exception.
             return;
         }
+        // The whole stack is scanned by the collector.
+        memset(
+            new_stack + vm->stack_size,
+            0,
+            sizeof(struct via_value*) * vm->stack_size
+        );
         vm->stack = new_stack;
         vm->stack_size *= 2;
     }
@@ -494,77 +1242,268 @@ const struct via_value* via_pop(struct via_vm* vm) {
 }
 
 void via_push_arg(struct via_vm* vm, const struct via_value* val) {
-    via_set_args(vm, via_make_pair(vm, val, via_reg_args(vm)));
+    if (!via_is_fixnum(via_reg_args(vm))) {
+        via_set_args(vm, via_make_int(vm, via_reg_sptr(vm)->v_int));
+    }
+    via_push(vm, val);
 }
 
 const struct via_value* via_pop_arg(struct via_vm* vm) {
-    if (!via_reg_args(vm)) {
+    const size_t count = via_arg_count(vm);
+    if (!count) {
         return NULL;
     }
-    const struct via_value* val = via_reg_args(vm)->v_car;
-    via_set_args(vm, via_reg_args(vm)->v_cdr);
-    return val; 
+    const struct via_value** args = &vm->stack[via_arg_base(vm)];
+    const struct via_value* val = args[0];
+    memmove(args, args + 1, (count - 1) * sizeof(*args));
+    args[count - 1] = NULL;
+    via_reg_sptr(vm)->v_int--;
+    return val;
 }
 
-void via_apply(struct via_vm* vm) {
-    // TODO: Improve address caching.
-    static struct via_vm* cached_instance = NULL;
-    static via_int eval_proc = -1;
-    if (vm != cached_instance) {
-        cached_instance = vm;
-        eval_proc = via_asm_label_lookup(vm, "eval-proc");
+size_t via_arg_count(struct via_vm* vm) {
+    const via_int count = via_reg_sptr(vm)->v_int - via_arg_base(vm);
+    return count > 0 ? count : 0;
+}
+
+const struct via_value* via_arg(struct via_vm* vm, size_t index) {
+    return index < via_arg_count(vm)
+        ? vm->stack[via_arg_base(vm) + index]
+        : NULL;
+}
+
+const struct via_value* via_arg_list(struct via_vm* vm, size_t index) {
+    const struct via_value* list = NULL;
+    for (size_t i = via_arg_count(vm); i > index; --i) {
+        list = via_make_pair(vm, via_arg(vm, i - 1), list);
     }
+    return list;
+}
 
-    const struct via_value* proc = via_reg_proc(vm);
-    const struct via_value* args = via_reverse_list(vm, via_reg_args(vm));
+// Symbols are hashed by name, and anything else bound (which can only be
+// done through set!) by nothing at all.
+static uint32_t via_binding_hash(const struct via_value* symbol) {
+    return (via_value_type(symbol) == VIA_V_SYMBOL)
+        ? symbol->v_symbol_hash
+        : 0;
+}
+
+// Returns the slot holding the value bound to the symbol in the environment,
+// or zero (the parent slot) if the environment has no such binding.
+static size_t via_env_find(
+    const struct via_value* env,
+    const struct via_value* symbol
+) {
+    const struct via_value** slots = env->v_arr;
+    if (slots[VIA_ENV_PARENT]) {
+        // Later bindings take precedence, which matters for duplicate formals.
+        const size_t count = via_value_int(slots[VIA_ENV_COUNT]);
+        for (size_t i = VIA_ENV_BINDINGS + count * 2; i > VIA_ENV_BINDINGS;) {
+            i -= 2;
+            if (slots[i] == symbol) {
+                return i + 1;
+            }
+        }
+        return 0;
+    }
 
-    via_set_args(vm, args);
+    const size_t mask = (env->v_size - VIA_ENV_BINDINGS) / 2 - 1;
+    for (size_t i = via_binding_hash(symbol) & mask;; i = (i + 1) & mask) {
+        const struct via_value* key = slots[VIA_ENV_BINDINGS + i * 2];
+        if (!key) {
+            return 0;
+        } else if (key == symbol) {
+            return VIA_ENV_BINDINGS + i * 2 + 1;
+        }
+    }
+}
+
+// Replaces the bindings of the environment with room for the given number of
+// them, moving the existing ones over. Returns false if out of memory.
+static via_bool via_env_resize(struct via_value* env, size_t bindings) {
+    const struct via_value** old_slots = env->v_arr;
+    const size_t old_size = env->v_size;
+
+    const struct via_value** slots = via_calloc(
+        VIA_ENV_BINDINGS + bindings * 2,
+        sizeof(struct via_value*)
+    );
+    if (!slots) {
+        return false;
+    }
+    slots[VIA_ENV_PARENT] = old_slots[VIA_ENV_PARENT];
+    slots[VIA_ENV_COUNT] = old_slots[VIA_ENV_COUNT];
+    env->v_arr = slots;
+    env->v_size = VIA_ENV_BINDINGS + bindings * 2;
+
+    if (slots[VIA_ENV_PARENT]) {
+        memcpy(
+            &slots[VIA_ENV_BINDINGS],
+            &old_slots[VIA_ENV_BINDINGS],
+            (old_size - VIA_ENV_BINDINGS) * sizeof(struct via_value*)
+        );
+    } else {
+        // The hash doesn't depend on where the symbols are on the heap, so the
+        // table stays valid when a copying collection moves them.
+        const size_t mask = bindings - 1;
+        for (size_t i = VIA_ENV_BINDINGS; i < old_size; i += 2) {
+            if (!old_slots[i]) {
+                continue;
+            }
+            size_t j = via_binding_hash(old_slots[i]) & mask;
+            while (slots[VIA_ENV_BINDINGS + j * 2]) {
+                j = (j + 1) & mask;
+            }
+            slots[VIA_ENV_BINDINGS + j * 2] = old_slots[i];
+            slots[VIA_ENV_BINDINGS + j * 2 + 1] = old_slots[i + 1];
+        }
+    }
+    via_free(old_slots);
+
+    return true;
+}
+
+// Binds the symbol in the environment, without looking for an existing
+// binding of it unless the environment is the hashed one. Returns false if
+// out of memory.
+static via_bool via_env_bind(
+    struct via_vm* vm,
+    struct via_value* env,
+    const struct via_value* symbol,
+    const struct via_value* value
+) {
+    const size_t count = via_value_int(env->v_arr[VIA_ENV_COUNT]);
+    const size_t cap = (env->v_size - VIA_ENV_BINDINGS) / 2;
+    if (
+        env != vm->globals
+            && via_value_type(symbol) == VIA_V_SYMBOL
+            && !symbol->v_symbol_scoped
+    ) {
+        ((struct via_value*) symbol)->v_symbol_scoped = true;
+        vm->lookup_epoch++;
+    }
+
+    size_t slot;
+    if (env->v_arr[VIA_ENV_PARENT]) {
+        if (count == cap && !via_env_resize(env, cap ? cap * 2 : 1)) {
+            return false;
+        }
+        slot = VIA_ENV_BINDINGS + count * 2;
+    } else {
+        slot = via_env_find(env, symbol);
+        if (slot) {
+            via_write_barrier(vm, env, env->v_arr[slot], value);
+            env->v_arr[slot] = value;
+            return true;
+        }
+        // Nil marks the free entries of the table, and can't be bound.
+        if (!symbol) {
+            return true;
+        }
+        if ((count + 1) * 2 > cap) {
+            if (!via_env_resize(env, cap * 2)) {
+                return false;
+            }
+            vm->lookup_epoch++;
+        }
+        const size_t mask = (env->v_size - VIA_ENV_BINDINGS) / 2 - 1;
+        size_t i = via_binding_hash(symbol) & mask;
+        while (env->v_arr[VIA_ENV_BINDINGS + i * 2]) {
+            i = (i + 1) & mask;
+        }
+        slot = VIA_ENV_BINDINGS + i * 2;
+    }
+
+    via_write_barrier(vm, env, NULL, symbol);
+    env->v_arr[slot] = symbol;
+    via_write_barrier(vm, env, NULL, value);
+    env->v_arr[slot + 1] = value;
+    env->v_arr[VIA_ENV_COUNT] = via_make_int(vm, count + 1);
+
+    return true;
+}
+
+void via_apply(struct via_vm* vm) {
+    const struct via_value* proc = via_reg_proc(vm);
+    const via_int base = via_arg_base(vm);
+    const size_t count = via_arg_count(vm);
+
+    // Bound functions are called right away, while their arguments are still
+    // on the stack, and return through the instruction following the call.
+    via_int bound_addr = -1;
+    if (via_value_type(proc->v_car) == VIA_V_BUILTIN) {
+        const via_int addr = via_value_int(proc->v_car);
+        if ((vm->program[addr] & 0xff) == VIA_OP_CALLB) {
+            bound_addr = addr;
+        }
+    }
 
     const struct via_value* formals = proc->v_cdr->v_car;
     vm->acc = proc->v_cdr->v_cdr->v_car;
-    via_set_env(vm, via_make_env(vm, proc->v_cdr->v_cdr->v_car));
-    DPRINTF(
-        "Apply: %s (%s)\n",
-        via_to_string(vm, proc)->v_string,
-        via_to_string(vm, args)->v_string
-    );
-    DPRINTF("Args: %s\n", via_to_string(vm, via_reg_args(vm))->v_string);
-    DPRINTF("Formals: %s\n", via_to_string(vm, formals)->v_string);
-    DPRINTF("New application environment: %p\n", via_reg_env(vm));
-    DPRINTF("Parent: %p\n", via_reg_env(vm)->v_car);
-
-    while (formals) {
-        if (!args) {
-            via_env_set(vm, formals->v_car, NULL);
-            formals = formals->v_cdr;
-            continue;
-        } else if (!formals->v_cdr && args->v_cdr) {
-            via_env_set(vm, formals->v_car, args);
-        } else {
-            via_env_set(vm, formals->v_car, args->v_car);
+    if (bound_addr >= 0 && vm->bound_direct[vm->program[bound_addr] >> 8]) {
+        // Direct procedures have nothing to bind, and run in the environment
+        // they close over.
+        via_set_env(vm, proc->v_cdr->v_cdr->v_car);
+    } else {
+        size_t formals_count = 0;
+        for (const struct via_value* f = formals; f; f = f->v_cdr) {
+            formals_count++;
+        }
+        struct via_value* env = (struct via_value*) via_make_env_sized(
+            vm,
+            proc->v_cdr->v_cdr->v_car,
+            formals_count
+        );
+        via_set_env(vm, env);
+        DPRINTF(
+            "Apply: %s (%s)\n",
+            via_to_string(vm, proc)->v_string,
+            via_to_string(vm, via_arg_list(vm, 0))->v_string
+        );
+        DPRINTF("Formals: %s\n", via_to_string(vm, formals)->v_string);
+        DPRINTF("New application environment: %p\n", env);
+        DPRINTF("Parent: %p\n", env->v_arr[VIA_ENV_PARENT]);
+
+        // The formals are bound in order, so that the compiler can find them
+        // by index. The last formal takes a list of the remaining arguments,
+        // if there is more than one.
+        for (size_t i = 0; formals; formals = formals->v_cdr, ++i) {
+            via_env_bind(
+                vm,
+                env,
+                formals->v_car,
+                (!formals->v_cdr && count > i + 1)
+                    ? via_arg_list(vm, i)
+                    : via_arg(vm, i)
+            );
         }
-        args = args->v_cdr;
-        formals = formals->v_cdr;
     }
 
     via_set_expr(vm, proc->v_car);
-    via_reg_pc(vm)->v_int = eval_proc;
-}
 
-void via_expand_form(struct via_vm* vm) {
-    // TODO: Improve address caching.
-    static struct via_vm* cached_instance = NULL;
-    static via_int eval_proc = -1;
-    if (vm != cached_instance) {
-        cached_instance = vm;
-        eval_proc = via_asm_label_lookup(vm, "eval-proc");
+    if (bound_addr >= 0) {
+        const via_opcode op = vm->program[bound_addr];
+        void* data = vm->bound_data[op >> 8];
+        via_reg_pc(vm)->v_int = bound_addr + 1;
+        vm->bound[op >> 8](data ? data : vm);
+        via_unwind_stack(vm, base);
+        return;
     }
+    via_unwind_stack(vm, base);
 
+    // Procedure bodies are compiled on first application, and the compiled
+    // code is reused for every subsequent call.
+    const via_int body_addr = via_compile(vm, proc->v_car);
+    via_reg_pc(vm)->v_int =
+        (body_addr >= 0) ? body_addr : vm->routines.eval_proc;
+}
+
+void via_expand_form(struct via_vm* vm) {
     const struct via_value* routine = vm->acc->v_cdr->v_cdr;
 
     via_set_ctxt(vm, via_make_pair(vm, vm->acc, via_reg_ctxt(vm)));
     via_set_expr(vm, routine);
-    via_reg_pc(vm)->v_int = eval_proc;
+    via_reg_pc(vm)->v_int = vm->routines.eval_proc;
 }
 
 struct via_value* via_reg_pc(struct via_vm* vm) {
@@ -608,42 +1547,52 @@ const struct via_value* via_reg_parn(struct via_vm* vm) {
 }
 
 void via_set_pc(struct via_vm* vm, struct via_value* value) {
+    via_write_barrier(vm, vm->regs, vm->regs->v_arr[VIA_REG_PC], value);
     vm->regs->v_arr[VIA_REG_PC] = value;
 }
 
 void via_set_expr(struct via_vm* vm, const struct via_value* value) {
+    via_write_barrier(vm, vm->regs, vm->regs->v_arr[VIA_REG_EXPR], value);
     vm->regs->v_arr[VIA_REG_EXPR] = value;
 }
 
 void via_set_proc(struct via_vm* vm, const struct via_value* value) {
+    via_write_barrier(vm, vm->regs, vm->regs->v_arr[VIA_REG_PROC], value);
     vm->regs->v_arr[VIA_REG_PROC] = value;
 }
 
 void via_set_args(struct via_vm* vm, const struct via_value* value) {
+    via_write_barrier(vm, vm->regs, vm->regs->v_arr[VIA_REG_ARGS], value);
     vm->regs->v_arr[VIA_REG_ARGS] = value;
 }
 
 void via_set_env(struct via_vm* vm, const struct via_value* value) {
+    via_write_barrier(vm, vm->regs, vm->regs->v_arr[VIA_REG_ENV], value);
     vm->regs->v_arr[VIA_REG_ENV] = value;
 }
 
 void via_set_excn(struct via_vm* vm, const struct via_value* value) {
+    via_write_barrier(vm, vm->regs, vm->regs->v_arr[VIA_REG_EXCN], value);
     vm->regs->v_arr[VIA_REG_EXCN] = value;
 }
 
 void via_set_exh(struct via_vm* vm, const struct via_value* value) {
+    via_write_barrier(vm, vm->regs, vm->regs->v_arr[VIA_REG_EXH], value);
     vm->regs->v_arr[VIA_REG_EXH] = value;
 }
 
 void via_set_sptr(struct via_vm* vm, struct via_value* value) {
+    via_write_barrier(vm, vm->regs, vm->regs->v_arr[VIA_REG_SPTR], value);
     vm->regs->v_arr[VIA_REG_SPTR] = value;
 }
 
 void via_set_ctxt(struct via_vm* vm, const struct via_value* value) {
+    via_write_barrier(vm, vm->regs, vm->regs->v_arr[VIA_REG_CTXT], value);
     vm->regs->v_arr[VIA_REG_CTXT] = value;
 }
 
 void via_set_parn(struct via_vm* vm, const struct via_value* value) {
+    via_write_barrier(vm, vm->regs, vm->regs->v_arr[VIA_REG_PARN], value);
     vm->regs->v_arr[VIA_REG_PARN] = value;
 }
 
@@ -652,18 +1601,18 @@ const struct via_value* via_env_lookup_nothrow(
     struct via_vm* vm,
     const struct via_value* symbol
 ) {
-    const struct via_value* env = via_reg_env(vm);
+    // Symbols that are only bound in the outermost environment, if at all,
+    // are looked for there right away.
+    const struct via_value* env =
+        (via_value_type(symbol) == VIA_V_SYMBOL && !symbol->v_symbol_scoped)
+            ? vm->globals
+            : via_reg_env(vm);
     do {
-        const struct via_value* cursor = env;
-        if (cursor->v_cdr) {
-            do {
-                cursor = cursor->v_cdr;
-                if (cursor->v_car->v_car == symbol) {
-                    return cursor->v_car->v_cdr;
-                }
-            } while (cursor->v_cdr);
-        }
-        env = env->v_car;
+        const size_t slot = via_env_find(env, symbol);
+        if (slot) {
+            return env->v_arr[slot];
+        }
+        env = env->v_arr[VIA_ENV_PARENT];
     } while (env);
 
     struct via_value* value = via_make_value(vm);
@@ -675,30 +1624,38 @@ const struct via_value* via_env_lookup_nothrow(
 void via_env_lookup(struct via_vm* vm) {
     vm->ret = via_env_lookup_nothrow(vm, vm->acc);
 
-    if (vm->ret && vm->ret->type == VIA_V_UNDEFINED) {
+    if (vm->ret && via_value_type(vm->ret) == VIA_V_UNDEFINED) {
         via_throw(vm, via_except_undefined_value(vm, vm->acc->v_symbol));
     }
 }
 
+// Points the cache at the binding of its symbol in the outermost environment,
+// if that is where lookups of the symbol end up. Returns false if they have
+// to go through the environment chain.
+static via_bool via_fill_lookup_cache(
+    struct via_vm* vm,
+    struct via_lookup_cache* cache
+) {
+    const struct via_value* symbol = vm->consts[cache->symbol];
+    if (via_value_type(symbol) != VIA_V_SYMBOL || symbol->v_symbol_scoped) {
+        return false;
+    }
+    const size_t slot = via_env_find(vm->globals, symbol);
+    if (!slot) {
+        return false;
+    }
+    cache->epoch = vm->lookup_epoch;
+    cache->slot = slot;
+
+    return true;
+}
+
 void via_env_set(
     struct via_vm* vm,
     const struct via_value* symbol,
     const struct via_value* value
 ) {
-    const struct via_value* cursor = via_reg_env(vm);
-    via_bool found = false;
-    if (cursor->v_cdr) {
-        do {
-            cursor = cursor->v_cdr;
-            if (cursor->v_car->v_car == symbol) {
-                found = true;
-            }
-        } while (!found && cursor->v_cdr);
-    } 
-    if (!found) {
-        ((struct via_value*) cursor)->v_cdr = via_make_pair(vm, NULL, NULL);
-        cursor = cursor->v_cdr;
-    }
+    struct via_value* env = (struct via_value*) via_reg_env(vm);
 
     DPRINTF(
         "\t\t%s = %s\n",
@@ -706,60 +1663,944 @@ void via_env_set(
         via_to_string(vm, value)->v_string
     );
 
-    ((struct via_value*) cursor)->v_car = via_make_pair(vm, symbol, value);
+    const size_t slot = via_env_find(env, symbol);
+    if (!slot) {
+        via_env_bind(vm, env, symbol, value);
+        return;
+    }
+    via_write_barrier(vm, env, env->v_arr[slot], value);
+    env->v_arr[slot] = value;
 }
 
-static void via_mark(struct via_value* value, uint8_t generation) {
-    if (!value || value->generation == generation) {
+static via_bool via_has_references(const struct via_value* value) {
+    if (value->flags & VIA_CELL_COMPILED) {
+        return true;
+    }
+    switch (value->type) {
+    case VIA_V_PAIR:
+    case VIA_V_PROC:
+    case VIA_V_FORM:
+    case VIA_V_FRAME:
+    case VIA_V_ARRAY:
+    case VIA_V_ENV:
+        return true;
+    default:
+        return false;
+    }
+}
+
+static void via_mark_stack_push(
+    struct via_vm* vm,
+    const struct via_value* value
+) {
+    if (vm->mark_stack_top == vm->mark_stack_cap) {
+        const size_t new_cap = vm->mark_stack_cap
+            ? vm->mark_stack_cap * 2
+            : DEFAULT_MARK_STACK_SIZE;
+        const struct via_value** new_stack = via_realloc(
+            (struct via_value**) vm->mark_stack,
+            sizeof(struct via_value*) * new_cap
+        );
+        if (!new_stack) {
+            // The value stays marked, and gets its references marked when
+            // the heap is rescanned.
+            vm->mark_overflow = true;
+            return;
+        }
+        vm->mark_stack = new_stack;
+        vm->mark_stack_cap = new_cap;
+    }
+    vm->mark_stack[vm->mark_stack_top++] = value;
+}
+
+// Sets the mark bit of the value, unless the value is to be left alone.
+// Returns true if the value was not marked before.
+static via_bool via_set_mark(struct via_vm* vm, const struct via_value* value) {
+    if (!value || via_is_fixnum(value) || (value->flags & vm->mark_skip)) {
+        return false;
+    }
+    uint64_t* word = &vm->mark_bits[value->slot / 64];
+    const uint64_t bit = (uint64_t) 1 << (value->slot % 64);
+    if (*word & bit) {
+        return false;
+    }
+    *word |= bit;
+    return true;
+}
+
+static via_bool via_is_marked(struct via_vm* vm, via_int slot) {
+    return (vm->mark_bits[slot / 64] >> (slot % 64)) & 1;
+}
+
+// Marks the value, and queues it for having its references marked.
+static void via_mark_push(struct via_vm* vm, const struct via_value* value) {
+    if (!via_set_mark(vm, value)) {
+        return;
+    }
+    if (via_has_references(value)) {
+        via_mark_stack_push(vm, value);
+    }
+}
+
+// Marks the constants of the code compiled for the expression, and returns
+// their number.
+static size_t via_mark_compiled(
+    struct via_vm* vm,
+    const struct via_value* expr
+) {
+    const struct via_compiled_code* code = via_find_compiled(vm, expr);
+    if (!code) {
+        return 0;
+    }
+    for (size_t i = 0; i < code->consts_count; ++i) {
+        via_mark_push(vm, vm->consts[code->owned[i]]);
+    }
+    return code->consts_count;
+}
+
+// Marks the expressions of the code that a frame with the program counter is
+// running, which may be referred to from nowhere else.
+static void via_mark_running(struct via_vm* vm, const struct via_value* pc) {
+    if (!pc) {
         return;
     }
-    value->generation = generation;
+    for (
+        size_t i = via_find_code_span(vm, pc->v_int);
+        i < vm->code_spans_count && vm->code_spans[i].addr <= pc->v_int;
+        ++i
+    ) {
+        via_mark_push(vm, vm->heap[vm->code_spans[i].slot]);
+    }
+}
+
+// Marks the references of a value, and returns the amount of work done. Lists
+// are followed along their tails without going through the mark stack, until
+// the budget runs out.
+static size_t via_mark_references(
+    struct via_vm* vm,
+    const struct via_value* value,
+    size_t budget
+) {
+    size_t work = 1;
+    for (;;) {
+        if (value->flags & VIA_CELL_COMPILED) {
+            work += via_mark_compiled(vm, value);
+        }
+        switch (value->type) {
+        case VIA_V_PAIR:
+        case VIA_V_PROC:
+        case VIA_V_FORM:
+            via_mark_push(vm, value->v_car);
+            value = value->v_cdr;
+            if (!via_set_mark(vm, value)) {
+                return work;
+            }
+            if (++work >= budget) {
+                via_mark_stack_push(vm, value);
+                return work;
+            }
+            continue;
+        case VIA_V_FRAME:
+            via_mark_running(vm, value->v_arr[VIA_REG_PC]);
+            // Fall through.
+        case VIA_V_ARRAY:
+        case VIA_V_ENV:
+            for (via_int i = 0; i < value->v_size; ++i) {
+                via_mark_push(vm, value->v_arr[i]);
+            }
+            return work + value->v_size;
+        default:
+            return work;
+        }
+    }
+}
+
+static void via_mark(struct via_vm* vm, const struct via_value* value) {
+    via_mark_push(vm, value);
+    while (vm->mark_stack_top) {
+        via_mark_references(
+            vm,
+            vm->mark_stack[--vm->mark_stack_top],
+            SIZE_MAX
+        );
+    }
+}
+
+// Recovers from running out of memory for the mark stack, by marking the
+// references of every marked value on the heap until nothing new is marked.
+static void via_mark_overflowed(struct via_vm* vm) {
+    while (vm->mark_overflow) {
+        vm->mark_overflow = false;
+        for (via_int i = 0; i <= vm->heap_top; ++i) {
+            if (via_is_marked(vm, i)) {
+                via_mark_references(vm, vm->heap[i], SIZE_MAX);
+                via_mark(vm, NULL);
+            }
+        }
+    }
+}
+
+static via_bool via_compiled_live(
+    struct via_vm* vm,
+    const struct via_value* expr
+) {
+    return via_is_fixnum(expr)
+        || (expr->flags & VIA_CELL_IMMORTAL)
+        || via_is_marked(vm, expr->slot);
+}
+
+// Drops the compiled code whose expression was found dead, along with its
+// code span. Returns the amount of work done.
+static size_t via_sweep_compiled(struct via_vm* vm) {
+    for (size_t i = 0; i < vm->compiled_cap;) {
+        const struct via_value* expr = vm->compiled_exprs[i];
+        if (expr && !via_compiled_live(vm, expr)) {
+            // The entry moved into its place is looked at next.
+            via_drop_compiled(vm, i);
+        } else {
+            ++i;
+        }
+    }
+
+    size_t kept = 0;
+    for (size_t i = 0; i < vm->code_spans_count; ++i) {
+        if (via_is_marked(vm, vm->code_spans[i].slot)) {
+            vm->code_spans[kept++] = vm->code_spans[i];
+        }
+    }
+    vm->code_spans_count = kept;
+    return vm->compiled_cap + kept;
+}
+
+// Makes a young value old. It is no longer remembered, but keeps its compiled
+// code.
+static void via_promote(struct via_value* value) {
+    value->flags = (value->flags & VIA_CELL_COMPILED) | VIA_CELL_OLD;
+}
+
+static void via_clear_slot(struct via_vm* vm, via_int i) {
+    vm->heap[i] = NULL;
+    vm->alloc_bits[i / 64] &= ~((uint64_t) 1 << (i % 64));
+    vm->free_slots[vm->free_slots_count++] = i;
+    vm->heap_cells--;
+}
 
+static void via_free_slot(struct via_vm* vm, via_int i) {
+    via_delete_value(vm, (struct via_value*) vm->heap[i]);
+    via_clear_slot(vm, i);
+}
+
+// Frees the young values that were not marked, and promotes the rest.
+static void via_sweep_nursery(struct via_vm* vm) {
+    for (size_t i = vm->nursery_count; i > 0; --i) {
+        const via_int slot = vm->nursery[i - 1];
+        if (via_is_marked(vm, slot)) {
+            vm->mark_bits[slot / 64] &= ~((uint64_t) 1 << (slot % 64));
+            via_promote((struct via_value*) vm->heap[slot]);
+        } else {
+            via_free_slot(vm, slot);
+        }
+    }
+}
+
+static void via_forget_remembered(struct via_vm* vm) {
+    for (size_t i = 0; i < vm->remembered_count; ++i) {
+        ((struct via_value*) vm->remembered[i])->flags &=
+            ~VIA_CELL_REMEMBERED;
+    }
+    vm->remembered_count = 0;
+    vm->remembered_overflow = false;
+}
+
+static uint64_t via_gc_now(void) {
+    struct timespec ts;
+    timespec_get(&ts, TIME_UTC);
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void via_gc_report_pause(
+    struct via_vm* vm,
+    enum via_gc_pause_kind kind,
+    uint64_t start
+) {
+    if (vm->gc_pause_hook) {
+        vm->gc_pause_hook(vm, kind, via_gc_now() - start, vm->gc_pause_data);
+    }
+}
+
+// Starts a full collection cycle by shading the roots. From here on, the
+// write barrier shades every overwritten value, so that everything reachable
+// at this point gets marked, and new values are allocated marked.
+static void via_gc_start_cycle(struct via_vm* vm) {
+#ifdef VIA_ENABLE_BACKGROUND_SWEEP
+    via_sweeper_wait(vm);
+#endif
+    via_forget_remembered(vm);
+
+    vm->gc_phase = VIA_GC_MARKING;
+    vm->mark_skip = VIA_CELL_IMMORTAL;
+    via_mark_push(vm, vm->acc);
+    via_mark_push(vm, vm->ret);
+    via_mark_push(vm, vm->regs);
+    via_mark_running(vm, via_reg_pc(vm));
+    for (size_t i = 0; i < vm->frames_top; ++i) {
+        for (size_t j = 0; j < VIA_REG_COUNT; ++j) {
+            via_mark_push(vm, vm->frames[i].regs[j]);
+        }
+        via_mark_running(vm, vm->frames[i].regs[VIA_REG_PC]);
+    }
+    // Popped stack slots are cleared, but nil may be pushed anywhere.
+    for (size_t i = 0; i < vm->stack_size; ++i) {
+        via_mark_push(vm, vm->stack[i]);
+    }
+    for (size_t i = 0; i < vm->symbols_cap; ++i) {
+        via_mark_push(vm, vm->symbols[i]);
+    }
+    via_mark_push(vm, vm->globals);
+    for (size_t i = 0; i < vm->roots_count; ++i) {
+        via_mark_push(vm, vm->roots[i]);
+    }
+    via_mark_push(vm, vm->stdin_handle);
+    via_mark_push(vm, vm->stdout_handle);
+    via_mark_push(vm, vm->stderr_handle);
+    // Constants owned by compiled code are marked along with its expression.
+    for (size_t i = 0; i < vm->consts_count; ++i) {
+        if (!vm->consts_owned[i]) {
+            via_mark_push(vm, vm->consts[i]);
+        }
+    }
+}
+
+static void via_gc_finish_cycle(struct via_vm* vm) {
+    // Promote the young survivors. Slots of the dead may have been reused
+    // by values allocated during the cycle, which are old already.
+    for (size_t i = 0; i < vm->nursery_count; ++i) {
+        struct via_value* value =
+            (struct via_value*) vm->heap[vm->nursery[i]];
+        if (value) {
+            via_promote(value);
+        }
+    }
+    vm->nursery_count = 0;
+
+    vm->gc_phase = VIA_GC_IDLE;
+    vm->gc_count++;
+    vm->gc_survivors = vm->heap_cells;
+    vm->gc_threshold = vm->gc_survivors * vm->gc_policy.growth_factor;
+    if (vm->gc_threshold < vm->gc_policy.min_heap_cells) {
+        vm->gc_threshold = vm->gc_policy.min_heap_cells;
+    }
+    vm->gc_requested = vm->gc_policy.enabled
+        && vm->heap_cells >= vm->gc_threshold;
+}
+
+// Does about budget units of marking work, moving on to sweeping once
+// everything reachable is marked. Returns the work done.
+static size_t via_gc_mark_work(struct via_vm* vm, size_t budget) {
+    size_t work = 0;
+    while (vm->gc_phase == VIA_GC_MARKING && work < budget) {
+        if (vm->mark_stack_top) {
+            work += via_mark_references(
+                vm,
+                vm->mark_stack[--vm->mark_stack_top],
+                budget - work
+            );
+            continue;
+        }
+        via_mark_overflowed(vm);
+        work += via_sweep_compiled(vm);
+        vm->gc_phase = VIA_GC_SWEEPING;
+        vm->sweep_cursor = vm->heap_top / 64;
+    }
+    return work;
+}
+
+// Advances the collection cycle in progress by about budget units of marking
+// or sweeping work. Returns true once the cycle is complete.
+static via_bool via_gc_work(struct via_vm* vm, size_t budget) {
+    size_t work = via_gc_mark_work(vm, budget);
+
+    // Sweep a bitmap word of 64 slots at a time, skipping those where every
+    // value is live. Sweep downwards, so that the lowest free slots end up on
+    // top of the free slot stack.
+    while (vm->gc_phase == VIA_GC_SWEEPING && work < budget) {
+        if (vm->sweep_cursor < 0) {
+            via_gc_finish_cycle(vm);
+            break;
+        }
+        const via_int word = vm->sweep_cursor--;
+        uint64_t dead = vm->alloc_bits[word] & ~vm->mark_bits[word];
+        vm->mark_bits[word] = 0;
+        work++;
+        for (int bit = 63; dead; --bit) {
+            if ((dead >> bit) & 1) {
+                dead &= ~((uint64_t) 1 << bit);
+                via_free_slot(vm, word * 64 + bit);
+                work++;
+            }
+        }
+    }
+
+    return vm->gc_phase == VIA_GC_IDLE;
+}
+
+#ifdef VIA_ENABLE_BACKGROUND_SWEEP
+static via_int via_popcount(uint64_t bits) {
+    via_int count = 0;
+    for (; bits; bits &= bits - 1) {
+        ++count;
+    }
+    return count;
+}
+
+// Completes the marking of a full collection by handing the dead values over
+// to the sweeper thread. The VM takes the dead values off the heap right
+// away, and their slots once they have been freed. Returns false if the
+// sweep has to be done here after all.
+static via_bool via_sweep_in_background(struct via_vm* vm) {
+    struct via_sweeper* sweeper = vm->sweeper;
+    if (sweeper->cap < vm->heap_cap) {
+        uint64_t* new_dead_bits = via_realloc(
+            sweeper->dead_bits,
+            sizeof(uint64_t) * (vm->heap_cap / 64)
+        );
+        if (!new_dead_bits) {
+            return false;
+        }
+        sweeper->dead_bits = new_dead_bits;
+        via_int* new_queue = via_realloc(
+            sweeper->queue,
+            sizeof(via_int) * vm->heap_cap
+        );
+        if (!new_queue) {
+            return false;
+        }
+        sweeper->queue = new_queue;
+        sweeper->cap = vm->heap_cap;
+    }
+
+    // The young survivors are promoted while the mark bits tell them apart.
+    for (size_t i = 0; i < vm->nursery_count; ++i) {
+        const via_int slot = vm->nursery[i];
+        if (via_is_marked(vm, slot)) {
+            via_promote((struct via_value*) vm->heap[slot]);
+        }
+    }
+    vm->nursery_count = 0;
+
+    sweeper->dead_words = vm->heap_top / 64 + 1;
+    for (via_int word = 0; word < sweeper->dead_words; ++word) {
+        const uint64_t dead = vm->alloc_bits[word] & ~vm->mark_bits[word];
+        sweeper->dead_bits[word] = dead;
+        vm->alloc_bits[word] &= ~dead;
+        vm->mark_bits[word] = 0;
+        vm->heap_cells -= via_popcount(dead);
+    }
+    sweeper->heap = vm->heap;
+
+    pthread_mutex_lock(&sweeper->lock);
+    sweeper->busy = true;
+    pthread_cond_signal(&sweeper->wake);
+    pthread_mutex_unlock(&sweeper->lock);
+    return true;
+}
+#endif
+
+// Slab chunks that live values are evacuated into, in order.
+struct via_copy_space {
+    struct via_slab_chunk* chunks;
+    struct via_slab_chunk* alloc_chunk;
+    size_t alloc_index;
+};
+
+// Moves the value into to-space, unless it has been already, and returns its
+// new location. The heap slot of a moved value points to the copy, and its
+// mark bit is set.
+static const struct via_value* via_evacuate(
+    struct via_vm* vm,
+    struct via_copy_space* space,
+    const struct via_value* value
+) {
+    if (
+        !value || via_is_fixnum(value) || (value->flags & VIA_CELL_IMMORTAL)
+    ) {
+        return value;
+    }
+    if (via_is_marked(vm, value->slot)) {
+        return vm->heap[value->slot];
+    }
+
+    if (space->alloc_index == SLAB_CHUNK_CELLS) {
+        space->alloc_chunk = space->alloc_chunk->next;
+        space->alloc_index = 0;
+    }
+    struct via_value* copy =
+        &space->alloc_chunk->cells[space->alloc_index++];
+    *copy = *value;
+    via_promote(copy);
+    if (value->flags & VIA_CELL_COMPILED) {
+        // The compiled code table hashes by slot, and needs no rehashing.
+        via_move_compiled(vm, value, copy);
+    }
+
+    vm->heap[value->slot] = copy;
+    vm->mark_bits[value->slot / 64] |= (uint64_t) 1 << (value->slot % 64);
+    return copy;
+}
+
+// Evacuates the expressions of the code that a frame with the program counter
+// is running, which may be referred to from nowhere else.
+static void via_evacuate_running(
+    struct via_vm* vm,
+    struct via_copy_space* space,
+    const struct via_value* pc
+) {
+    if (!pc) {
+        return;
+    }
+    for (
+        size_t i = via_find_code_span(vm, pc->v_int);
+        i < vm->code_spans_count && vm->code_spans[i].addr <= pc->v_int;
+        ++i
+    ) {
+        via_evacuate(vm, space, vm->heap[vm->code_spans[i].slot]);
+    }
+}
+
+// Evacuates the references of a copy. The pairs of a list are copied and
+// scanned right away, one after the other, so that they end up interleaved
+// with their elements instead of spread out by the breadth first order. They
+// get scanned again, to no effect, once the scan reaches them.
+static void via_evacuate_references(
+    struct via_vm* vm,
+    struct via_copy_space* space,
+    struct via_value* value
+) {
+    if (value->flags & VIA_CELL_COMPILED) {
+        const struct via_compiled_code* code = via_find_compiled(vm, value);
+        for (size_t i = 0; code && i < code->consts_count; ++i) {
+            const via_int index = code->owned[i];
+            vm->consts[index] = via_evacuate(vm, space, vm->consts[index]);
+        }
+    }
     switch (value->type) {
     case VIA_V_PAIR:
     case VIA_V_PROC:
     case VIA_V_FORM:
-        via_mark((struct via_value*) value->v_car, generation);
-        via_mark((struct via_value*) value->v_cdr, generation);
+        for (;;) {
+            value->v_car = via_evacuate(vm, space, value->v_car);
+            const via_bool moved = !value->v_cdr
+                || via_is_fixnum(value->v_cdr)
+                || via_is_marked(vm, value->v_cdr->slot);
+            value->v_cdr = via_evacuate(vm, space, value->v_cdr);
+            if (moved || value->v_cdr->type != VIA_V_PAIR) {
+                break;
+            }
+            value = (struct via_value*) value->v_cdr;
+        }
         break;
     case VIA_V_FRAME:
+        via_evacuate_running(vm, space, value->v_arr[VIA_REG_PC]);
+        // Fall through.
     case VIA_V_ARRAY:
-        for (size_t i = 0; i < value->v_size; ++i) {
-            via_mark((struct via_value*) value->v_arr[i], generation);
+    case VIA_V_ENV:
+        for (via_int i = 0; i < value->v_size; ++i) {
+            value->v_arr[i] = via_evacuate(vm, space, value->v_arr[i]);
         }
         break;
+    default:
+        break;
     }
 }
 
-static void via_sweep(struct via_vm* vm) {
-    for (size_t i = 0; i < vm->heap_cap; ++i) {
-        if (vm->heap[i] && vm->heap[i]->generation != vm->generation) {
-            via_delete_value((struct via_value*) vm->heap[i]);
-            vm->heap[i] = NULL;
-            if (i < vm->heap_free) {
-                vm->heap_free = i;
+// Full collection that copies the live values breadth first into new slab
+// chunks (Cheney's algorithm), and releases the old chunks as a whole.
+// Returns false without collecting if to-space could not be allocated.
+static via_bool via_copy_collect(struct via_vm* vm) {
+#ifdef VIA_ENABLE_BACKGROUND_SWEEP
+    via_sweeper_wait(vm);
+#endif
+    // Reserve room for every value on the heap up front, as running out
+    // halfway through is not recoverable.
+    struct via_copy_space space = { NULL, NULL, 0 };
+    struct via_slab_chunk** tail = &space.chunks;
+    for (size_t i = 0; i < vm->heap_cells + 1; i += SLAB_CHUNK_CELLS) {
+        *tail = via_malloc(
+            sizeof(struct via_slab_chunk)
+                + sizeof(struct via_value) * SLAB_CHUNK_CELLS
+        );
+        if (!*tail) {
+            while (space.chunks) {
+                struct via_slab_chunk* next = space.chunks->next;
+                via_free(space.chunks);
+                space.chunks = next;
+            }
+            return false;
+        }
+        (*tail)->next = NULL;
+        tail = &(*tail)->next;
+    }
+    space.alloc_chunk = space.chunks;
+
+    via_forget_remembered(vm);
+    vm->nursery_count = 0;
+
+    // Evacuate the roots.
+    vm->acc = via_evacuate(vm, &space, vm->acc);
+    vm->ret = via_evacuate(vm, &space, vm->ret);
+    vm->regs = (struct via_value*) via_evacuate(vm, &space, vm->regs);
+    via_evacuate_running(vm, &space, via_reg_pc(vm));
+    for (size_t i = 0; i < vm->frames_top; ++i) {
+        for (size_t j = 0; j < VIA_REG_COUNT; ++j) {
+            vm->frames[i].regs[j] =
+                via_evacuate(vm, &space, vm->frames[i].regs[j]);
+        }
+        via_evacuate_running(vm, &space, vm->frames[i].regs[VIA_REG_PC]);
+    }
+    for (size_t i = 0; i < vm->stack_size; ++i) {
+        vm->stack[i] = via_evacuate(vm, &space, vm->stack[i]);
+    }
+    // The symbol table hashes by name, and needs no rehashing.
+    for (size_t i = 0; i < vm->symbols_cap; ++i) {
+        vm->symbols[i] = via_evacuate(vm, &space, vm->symbols[i]);
+    }
+    vm->globals = via_evacuate(vm, &space, vm->globals);
+    for (size_t i = 0; i < vm->roots_count; ++i) {
+        vm->roots[i] = via_evacuate(vm, &space, vm->roots[i]);
+    }
+    vm->stdin_handle = via_evacuate(vm, &space, vm->stdin_handle);
+    vm->stdout_handle = via_evacuate(vm, &space, vm->stdout_handle);
+    vm->stderr_handle = via_evacuate(vm, &space, vm->stderr_handle);
+    // Constants owned by compiled code are evacuated along with its
+    // expression.
+    for (size_t i = 0; i < vm->consts_count; ++i) {
+        if (!vm->consts_owned[i]) {
+            vm->consts[i] = via_evacuate(vm, &space, vm->consts[i]);
+        }
+    }
+
+    // Scan to-space in order, evacuating what the copies reference, until
+    // the scan catches up with the allocation.
+    struct via_slab_chunk* scan_chunk = space.chunks;
+    size_t scan_index = 0;
+    while (scan_chunk != space.alloc_chunk || scan_index < space.alloc_index) {
+        if (scan_index == SLAB_CHUNK_CELLS) {
+            scan_chunk = scan_chunk->next;
+            scan_index = 0;
+            continue;
+        }
+        via_evacuate_references(
+            vm,
+            &space,
+            &scan_chunk->cells[scan_index++]
+        );
+    }
+    via_sweep_compiled(vm);
+
+    // What was not evacuated is dead. Its cells go with the old chunks.
+    for (via_int word = vm->heap_top / 64; word >= 0; --word) {
+        uint64_t dead = vm->alloc_bits[word] & ~vm->mark_bits[word];
+        vm->mark_bits[word] = 0;
+        for (int bit = 63; dead; --bit) {
+            if ((dead >> bit) & 1) {
+                const via_int slot = word * 64 + bit;
+                dead &= ~((uint64_t) 1 << bit);
+                via_free_contents((struct via_value*) vm->heap[slot]);
+                via_clear_slot(vm, slot);
             }
         }
     }
+    while (vm->slab_chunks) {
+        struct via_slab_chunk* next = vm->slab_chunks->next;
+        via_free(vm->slab_chunks);
+        vm->slab_chunks = next;
+    }
+    while (space.alloc_chunk->next) {
+        struct via_slab_chunk* next = space.alloc_chunk->next->next;
+        via_free(space.alloc_chunk->next);
+        space.alloc_chunk->next = next;
+    }
+    vm->slab_chunks = space.chunks;
+
+    // Allocation continues right after the copies.
+    vm->slab_free = NULL;
+    for (size_t i = SLAB_CHUNK_CELLS; i > space.alloc_index; --i) {
+        space.alloc_chunk->cells[i - 1].v_car = vm->slab_free;
+        vm->slab_free = &space.alloc_chunk->cells[i - 1];
+    }
+
+    via_gc_finish_cycle(vm);
+    return true;
 }
 
 void via_garbage_collect(struct via_vm* vm) {
+    const uint64_t start = vm->gc_pause_hook ? via_gc_now() : 0;
+
+    // Complete any incremental cycle in progress before starting afresh.
+    if (vm->gc_phase != VIA_GC_IDLE) {
+        via_gc_work(vm, SIZE_MAX);
+    }
+    if (vm->collector != VIA_GC_COPYING || !via_copy_collect(vm)) {
+        via_gc_start_cycle(vm);
+#ifdef VIA_ENABLE_PARALLEL_MARK
+        if (vm->mark_pool && vm->heap_cells >= PARALLEL_MARK_MIN_CELLS) {
+            via_parallel_mark(vm);
+        }
+#endif
+#ifdef VIA_ENABLE_BACKGROUND_SWEEP
+        if (vm->sweeper) {
+            via_gc_mark_work(vm, SIZE_MAX);
+            if (via_sweep_in_background(vm)) {
+                via_gc_finish_cycle(vm);
+            }
+        }
+#endif
+        via_gc_work(vm, SIZE_MAX);
+    }
+
+    via_gc_report_pause(vm, VIA_GC_PAUSE_FULL, start);
+}
+
+via_bool via_gc_step(struct via_vm* vm, uint64_t budget_us) {
+    if (vm->collector == VIA_GC_COPYING) {
+        via_garbage_collect(vm);
+        return true;
+    }
+
+    const uint64_t start = via_gc_now();
+    const uint64_t deadline = start + budget_us * 1000;
+
+    if (vm->gc_phase == VIA_GC_IDLE) {
+        via_gc_start_cycle(vm);
+    }
+    via_bool done;
+    do {
+        done = via_gc_work(vm, GC_STEP_UNITS);
+    } while (!done && via_gc_now() < deadline);
+
+    via_gc_report_pause(vm, VIA_GC_PAUSE_STEP, start);
+    return done;
+}
+
+// Collects the values allocated since the last collection. Old values are
+// taken to be live and are not traced, so the work done is proportional to
+// the number of survivors, the size of the nursery and the remembered set.
+void via_collect_nursery(struct via_vm* vm) {
+    if (vm->gc_phase != VIA_GC_IDLE) {
+        // Values allocated during a full cycle are not young.
+        return;
+    }
+    if (vm->remembered_overflow) {
+        // Some old values referencing young ones went unrecorded.
+        via_garbage_collect(vm);
+        return;
+    }
+
+    const uint64_t start = vm->gc_pause_hook ? via_gc_now() : 0;
+
     // Marking.
 
-    vm->generation++;
-    via_mark((struct via_value*) vm->acc, vm->generation);
-    via_mark((struct via_value*) vm->ret, vm->generation);
-    for (size_t i = 0; i < VIA_REG_COUNT; ++i) {
-        via_mark((struct via_value*) vm->regs, vm->generation);
+    vm->mark_skip = VIA_CELL_OLD;
+    via_mark(vm, vm->acc);
+    via_mark(vm, vm->ret);
+    // Registers of the current frame may also be written to directly.
+    via_mark(vm, vm->regs);
+    via_mark_references(vm, vm->regs, SIZE_MAX);
+    via_mark(vm, NULL);
+    for (size_t i = 0; i < vm->frames_top; ++i) {
+        for (size_t j = 0; j < VIA_REG_COUNT; ++j) {
+            via_mark(vm, vm->frames[i].regs[j]);
+        }
+    }
+    for (size_t i = 0; i < vm->stack_size; ++i) {
+        via_mark(vm, vm->stack[i]);
     }
-    for (size_t i = 0; vm->stack[i] && i < vm->stack_size; ++i) {
-        via_mark((struct via_value*) vm->stack[i], vm->generation);
+    for (size_t i = 0; i < vm->remembered_count; ++i) {
+        const struct via_value* value = vm->remembered[i];
+        if (value->flags & VIA_CELL_OLD) {
+            via_mark_references(vm, value, SIZE_MAX);
+            via_mark(vm, NULL);
+        } else {
+            via_mark(vm, value);
+        }
     }
-    via_mark(vm->symbols, vm->generation);
+    via_mark_overflowed(vm);
+    via_forget_remembered(vm);
 
     // Sweeping.
 
-    via_sweep(vm);
+    via_sweep_nursery(vm);
+    vm->nursery_count = 0;
+
+    vm->minor_gc_count++;
+    vm->gc_requested = vm->gc_policy.enabled
+        && vm->heap_cells >= vm->gc_threshold;
+
+    via_gc_report_pause(vm, VIA_GC_PAUSE_MINOR, start);
+}
+
+// Collects at a safe point, doing a full collection only once the heap has
+// outgrown the threshold. With an incremental policy, the full collection is
+// spread over the following safe points.
+static void via_collect_requested(struct via_vm* vm) {
+    if (vm->gc_phase != VIA_GC_IDLE) {
+        const uint64_t start = vm->gc_pause_hook ? via_gc_now() : 0;
+        via_gc_work(
+            vm,
+            vm->gc_policy.step_cells ? vm->gc_policy.step_cells : GC_STEP_UNITS
+        );
+        via_gc_report_pause(vm, VIA_GC_PAUSE_STEP, start);
+    } else if (vm->heap_cells < vm->gc_threshold) {
+        via_collect_nursery(vm);
+    } else if (
+        vm->gc_policy.step_cells && vm->collector != VIA_GC_COPYING
+    ) {
+        const uint64_t start = vm->gc_pause_hook ? via_gc_now() : 0;
+        via_gc_start_cycle(vm);
+        vm->gc_requested = true;
+        via_gc_report_pause(vm, VIA_GC_PAUSE_STEP, start);
+    } else {
+        via_garbage_collect(vm);
+    }
+}
+
+static void via_remember(struct via_vm* vm, const struct via_value* value) {
+    if (vm->remembered_count == vm->remembered_cap) {
+        const size_t new_cap = vm->remembered_cap
+            ? vm->remembered_cap * 2
+            : DEFAULT_REMEMBERED_SIZE;
+        const struct via_value** new_remembered = via_realloc(
+            (struct via_value**) vm->remembered,
+            sizeof(struct via_value*) * new_cap
+        );
+        if (!new_remembered) {
+            // Fall back to a full collection next time.
+            vm->remembered_overflow = true;
+            return;
+        }
+        vm->remembered = new_remembered;
+        vm->remembered_cap = new_cap;
+    }
+    ((struct via_value*) value)->flags |= VIA_CELL_REMEMBERED;
+    vm->remembered[vm->remembered_count++] = value;
+}
+
+// Fixnums, which have no heap slot, get negative handles.
+via_int via_value_handle(const struct via_value* value) {
+    if (via_is_fixnum(value)) {
+        return -1 - (via_int) ((uintptr_t) value >> 1);
+    }
+    return value->slot;
+}
+
+const struct via_value* via_handle_value(struct via_vm* vm, via_int handle) {
+    if (handle < 0) {
+        return (const struct via_value*) (((uintptr_t) (-1 - handle) << 1) | 1);
+    }
+    return vm->heap[handle];
+}
+
+via_bool via_add_root(struct via_vm* vm, const struct via_value* value) {
+    if (
+        !value || via_is_fixnum(value) || (value->flags & VIA_CELL_IMMORTAL)
+    ) {
+        return true;
+    }
+    if (vm->roots_count == vm->roots_cap) {
+        const size_t new_cap = vm->roots_cap
+            ? vm->roots_cap * 2
+            : DEFAULT_ROOTS_SIZE;
+        const struct via_value** new_roots = via_realloc(
+            (struct via_value**) vm->roots,
+            sizeof(struct via_value*) * new_cap
+        );
+        if (!new_roots) {
+            return false;
+        }
+        vm->roots = new_roots;
+        vm->roots_cap = new_cap;
+    }
+    vm->roots[vm->roots_count++] = value;
+
+    // The value may be referenced from nowhere else by the time the next
+    // collection, or the rest of the one in progress, gets to it.
+    if (vm->gc_phase == VIA_GC_MARKING) {
+        via_mark_push(vm, value);
+    }
+    via_write_barrier(vm, NULL, NULL, value);
+    return true;
+}
+
+void via_remove_root(struct via_vm* vm, const struct via_value* value) {
+    for (size_t i = vm->roots_count; i > 0; --i) {
+        if (vm->roots[i - 1] == value) {
+            vm->roots[i - 1] = vm->roots[--vm->roots_count];
+            return;
+        }
+    }
+}
+
+void via_write_barrier(
+    struct via_vm* vm,
+    const struct via_value* container,
+    const struct via_value* previous,
+    const struct via_value* value
+) {
+    if (vm->gc_phase != VIA_GC_IDLE) {
+        // Keeps what was reachable when the cycle started from getting lost
+        // while marking, and thereby the black values from referencing white
+        // ones. Every survivor of the cycle is promoted.
+        if (vm->gc_phase == VIA_GC_MARKING) {
+            via_mark_push(vm, previous);
+        }
+        return;
+    }
+
+    if (!value || via_is_fixnum(value) || (value->flags & VIA_CELL_OLD)) {
+        return;
+    }
+    if (!container) {
+        if (!(value->flags & VIA_CELL_REMEMBERED)) {
+            via_remember(vm, value);
+        }
+    } else if (
+        (
+            container->flags
+                & (VIA_CELL_OLD | VIA_CELL_REMEMBERED | VIA_CELL_IMMORTAL)
+        ) == VIA_CELL_OLD
+    ) {
+        via_remember(vm, container);
+    }
+}
+
+void via_set_gc_policy(struct via_vm* vm, const struct via_gc_policy* policy) {
+    vm->gc_policy = *policy;
+    // Until the first full collection, nothing is known to have survived,
+    // and the heap may be mostly garbage.
+    vm->gc_threshold = vm->gc_survivors * policy->growth_factor;
+    if (vm->gc_threshold < policy->min_heap_cells) {
+        vm->gc_threshold = policy->min_heap_cells;
+    }
+    vm->nursery_limit = policy->nursery_cells
+        ? policy->nursery_cells
+        : SIZE_MAX;
+    vm->gc_requested = policy->enabled
+        && (vm->heap_cells >= vm->gc_threshold
+            || vm->nursery_count >= vm->nursery_limit
+            || vm->gc_phase != VIA_GC_IDLE);
+}
+
+struct via_gc_policy via_get_gc_policy(struct via_vm* vm) {
+    return vm->gc_policy;
+}
+
+void via_set_gc_pause_hook(
+    struct via_vm* vm,
+    via_gc_pause_hook hook,
+    void* user_data
+) {
+    vm->gc_pause_hook = hook;
+    vm->gc_pause_data = user_data;
 }
 
 void via_catch(
@@ -769,24 +2610,19 @@ void via_catch(
 ) {
     struct via_value* handler_frame = (struct via_value*) via_make_frame(vm);
     ((struct via_value*) handler_frame->v_arr[VIA_REG_PC])->v_int =
-        via_asm_label_lookup(
-            vm,
-            "eval-proc"
-        ); 
+        vm->routines.eval_proc;
     handler_frame->v_arr[VIA_REG_EXPR] = handler;
     handler_frame->v_arr[VIA_REG_PARN] = via_reg_parn(vm);
 
     via_set_exh(vm, handler_frame);
     via_set_expr(vm, expr);
-    via_reg_pc(vm)->v_int = via_asm_label_lookup(
-        vm,
-        "eval-proc"
-    ); 
+    via_reg_pc(vm)->v_int = vm->routines.eval_proc;
 }
 
 void via_throw(struct via_vm* vm, const struct via_value* exception) {
     vm->acc = via_reg_exh(vm);
     via_assume_frame(vm);
+    via_unwind_stack(vm, via_arg_base(vm));
     via_set_excn(vm, exception);
 }
 
@@ -825,18 +2661,16 @@ void via_default_exception_handler(struct via_vm* vm) {
 }
 
 const struct via_value* via_run_eval(struct via_vm* vm) {
-    via_reg_pc(vm)->v_int = via_asm_label_lookup(vm, "eval-proc");
+    // Start out in the outermost environment, and without a handler, rather
+    // than from where the previous run left the frame. Its handler would
+    // otherwise keep every earlier run alive.
+    via_set_env(vm, vm->globals);
+    via_set_exh(vm, NULL);
+    via_reg_pc(vm)->v_int = vm->routines.eval_proc;
     via_catch(
         vm,
         via_reg_expr(vm),
-        via_make_builtin(
-            vm,
-            via_bind(
-                vm,
-                "default-except-proc",
-                (via_bindable) via_default_exception_handler
-            )
-        )
+        via_make_builtin(vm, vm->routines.default_except_proc)
     );
     // Replace the current frame with the catch clause. 
     via_set_parn(vm, NULL);
@@ -844,151 +2678,333 @@ const struct via_value* via_run_eval(struct via_vm* vm) {
     return via_run(vm);
 }
 
+// The program counter is kept in a local variable while the dispatch loop is
+// running, and is only written back to the current frame when control may be
+// observed or transferred by something else than the loop itself (that is,
+// when snapping a frame, returning, or calling a bound function).
+#define SYNC_PC() (via_reg_pc(vm)->v_int = pc)
+
+// Hands control to any native code translated for the code at the program
+// counter, counting the branch towards making the code eligible otherwise.
+#ifdef VIA_ENABLE_JIT
+#define JIT_ENTER() (pc = via_jit_enter(vm, pc))
+#else
+#define JIT_ENTER() (void) 0
+#endif
+
+// Continue execution at TARGET. A control transfer that leaves the program
+// counter unchanged advances it by one, as is the case for every instruction.
+#define BRANCH(TARGET)\
+    do {\
+        const via_int target_ = (TARGET);\
+        pc = (target_ == pc) ? pc + 1 : target_;\
+        JIT_ENTER();\
+    } while (0)
+
+#ifdef VIA_THREADED_DISPATCH
+#define TARGET(OP) case VIA_OP_ ## OP: target_ ## OP
+#define TARGET_DEFAULT default: target_default
+#define DISPATCH()\
+    do {\
+        op = vm->program[pc];\
+        DDPRINTF("PC %04" VIA_FMTIx ": ", pc);\
+        COUNT_PAIR();\
+        goto *dispatch_table[op & 0xff];\
+    } while (0)
+#else
+#define TARGET(OP) case VIA_OP_ ## OP: target_ ## OP
+#define TARGET_DEFAULT default
+#define DISPATCH() goto process_state
+#endif
+
+// Counts the opcode about to be dispatched as following the previous one.
+#ifdef VIA_ENABLE_OPCODE_PAIRS
+#define COUNT_PAIR()\
+    do {\
+        if (vm->opcode_pairs && prev_op >= 0) {\
+            vm->opcode_pairs[(prev_op << 8) | (op & 0xff)]++;\
+        }\
+        prev_op = op & 0xff;\
+    } while (0)
+#else
+#define COUNT_PAIR() (void) 0
+#endif
+
+#define NEXT()\
+    do {\
+        ++pc;\
+        DISPATCH();\
+    } while (0)
+
+// Continues with the instruction following the first one of a fused
+// sequence, as if it had been dispatched.
+#define FUSED_NEXT(OP)\
+    do {\
+        op = vm->program[++pc];\
+        goto target_ ## OP;\
+    } while (0)
+
+#define RESUME()\
+    do {\
+        DDPRINTF("-------------\n");\
+        DISPATCH();\
+    } while (0)
+
+#define TYPE_PREDICATE(TYPE)\
+    (vm->acc = via_make_bool(vm, vm->acc && via_value_type(vm->acc) == TYPE))
+
+// Applies an operator to the value popped off the stack (in tmp) and the
+// accumulator, once they have turned out not to be a pair of fixnums with a
+// result. Pairs of floats are handled inline, and anything else the way the
+// procedure bound to the operator by default would handle it, exceptions
+// included.
+#define BINARY_OP(OP, OPERATOR, MAKE_FLOAT)\
+        if (\
+            tmp && vm->acc\
+                && via_value_type(tmp) == VIA_V_FLOAT\
+                && via_value_type(vm->acc) == VIA_V_FLOAT\
+        ) {\
+            vm->acc = MAKE_FLOAT(vm, tmp->v_float OPERATOR vm->acc->v_float);\
+            NEXT();\
+        }\
+        SYNC_PC();\
+        via_apply_operator(vm, VIA_OP_ ## OP, tmp, vm->acc);\
+        vm->acc = vm->ret;\
+        if (vm->gc_requested) {\
+            via_collect_requested(vm);\
+        }\
+        BRANCH(via_reg_pc(vm)->v_int);\
+        RESUME();
+
+// INT_OP(a, b, &result) computes the result for a pair of fixnums, and
+// evaluates to whether there is none in a via_int, like the
+// __builtin_*_overflow functions do. Such pairs are left to the slow path.
+#define ARITHMETIC(OP, OPERATOR, INT_OP)\
+    TARGET(OP):\
+        DDPRINTF(#OP "\n");\
+        tmp = via_pop(vm);\
+        if (\
+            via_is_fixnum(tmp) && via_is_fixnum(vm->acc)\
+                && !INT_OP(\
+                    via_value_int(tmp),\
+                    via_value_int(vm->acc),\
+                    &int_result\
+                )\
+        ) {\
+            vm->acc = via_make_int(vm, int_result);\
+            NEXT();\
+        }\
+        BINARY_OP(OP, OPERATOR, via_make_float)
+
+#define COMPARISON(OP, OPERATOR)\
+    TARGET(OP):\
+        DDPRINTF(#OP "\n");\
+        tmp = via_pop(vm);\
+        if (via_is_fixnum(tmp) && via_is_fixnum(vm->acc)) {\
+            vm->acc = via_make_bool(\
+                vm,\
+                via_value_int(tmp) OPERATOR via_value_int(vm->acc)\
+            );\
+            NEXT();\
+        }\
+        BINARY_OP(OP, OPERATOR, via_make_bool)
+
+// Divides the way the __builtin_*_overflow functions compute, failing on a
+// zero divisor as well, which the slow path turns into an exception.
+#define DIV_OVERFLOW(A, B, RESULT)\
+    (\
+        (B) == 0\
+            || ((A) == INT64_MIN && (B) == -1)\
+            || (*(RESULT) = (A) / (B), false)\
+    )
+
 const struct via_value* via_run(struct via_vm* vm) {
+#ifdef VIA_THREADED_DISPATCH
+    static void* const dispatch_table[256] = {
+        [0 ... 255] = &&target_default,
+        [VIA_OP_NOP] = &&target_NOP,
+        [VIA_OP_CAR] = &&target_CAR,
+        [VIA_OP_CDR] = &&target_CDR,
+        [VIA_OP_CALL] = &&target_CALL,
+        [VIA_OP_CALLACC] = &&target_CALLACC,
+        [VIA_OP_CALLB] = &&target_CALLB,
+        [VIA_OP_SET] = &&target_SET,
+        [VIA_OP_LOAD] = &&target_LOAD,
+        [VIA_OP_LOADNIL] = &&target_LOADNIL,
+        [VIA_OP_SETRET] = &&target_SETRET,
+        [VIA_OP_LOADRET] = &&target_LOADRET,
+        [VIA_OP_PAIRP] = &&target_PAIRP,
+        [VIA_OP_SYMBOLP] = &&target_SYMBOLP,
+        [VIA_OP_FORMP] = &&target_FORMP,
+        [VIA_OP_FRAMEP] = &&target_FRAMEP,
+        [VIA_OP_BUILTINP] = &&target_BUILTINP,
+        [VIA_OP_SKIPZ] = &&target_SKIPZ,
+        [VIA_OP_SNAP] = &&target_SNAP,
+        [VIA_OP_RETURN] = &&target_RETURN,
+        [VIA_OP_JMP] = &&target_JMP,
+        [VIA_OP_PUSH] = &&target_PUSH,
+        [VIA_OP_POP] = &&target_POP,
+        [VIA_OP_DROP] = &&target_DROP,
+        [VIA_OP_PUSHARG] = &&target_PUSHARG,
+        [VIA_OP_POPARG] = &&target_POPARG,
+        [VIA_OP_LOADK] = &&target_LOADK,
+        [VIA_OP_EQK] = &&target_EQK,
+        [VIA_OP_LOADL] = &&target_LOADL,
+        [VIA_OP_LOADG] = &&target_LOADG,
+        [VIA_OP_TYPESWITCH] = &&target_TYPESWITCH,
+        [VIA_OP_NATIVEP] = &&target_NATIVEP,
+        [VIA_OP_ADD] = &&target_ADD,
+        [VIA_OP_SUB] = &&target_SUB,
+        [VIA_OP_MUL] = &&target_MUL,
+        [VIA_OP_DIV] = &&target_DIV,
+        [VIA_OP_EQ] = &&target_EQ,
+        [VIA_OP_NEQ] = &&target_NEQ,
+        [VIA_OP_LT] = &&target_LT,
+        [VIA_OP_GT] = &&target_GT,
+        [VIA_OP_LTE] = &&target_LTE,
+        [VIA_OP_GTE] = &&target_GTE,
+        [VIA_OP_SKIPNT] = &&target_SKIPNT,
+        [VIA_OP_LOADKSET] = &&target_LOADKSET,
+        [VIA_OP_LOADKL] = &&target_LOADKL,
+        [VIA_OP_CALLBR] = &&target_CALLBR,
+        [VIA_OP_DEBUG] = &&target_DEBUG
+    };
+#endif
     const struct via_value* tmp;
-    struct via_value* val;
-    via_int old_pc;
+    via_int int_result;
+    via_int pc = via_reg_pc(vm)->v_int;
     via_int op;
     via_int frame = 0;
     void* data;
-    
+    struct via_lookup_cache* cache;
+    via_int type;
+#ifdef VIA_ENABLE_OPCODE_PAIRS
+    via_int prev_op = -1;
+#endif
+
+    JIT_ENTER();
+
 process_state:
-    op = vm->program[via_reg_pc(vm)->v_int];
-    old_pc = via_reg_pc(vm)->v_int;
-    DDPRINTF("PC %04" VIA_FMTIx ": ", via_reg_pc(vm)->v_int);
+    op = vm->program[pc];
+    DDPRINTF("PC %04" VIA_FMTIx ": ", pc);
+    COUNT_PAIR();
     switch (op & 0xff) {
-    case VIA_OP_NOP:
+    TARGET(NOP):
         DDPRINTF("NOP\n");
-        break;
-    case VIA_OP_CAR:
+        NEXT();
+    TARGET(CAR):
         DDPRINTF("CAR\n");
         vm->acc = vm->acc->v_car;
-        break;
-    case VIA_OP_CDR:
+        NEXT();
+    TARGET(CDR):
         DDPRINTF("CDR\n");
         vm->acc = vm->acc->v_cdr;
-        break;
-    case VIA_OP_CALL:
+        NEXT();
+    TARGET(CALL):
         DDPRINTF("CALL %04" VIA_FMTIx "\n", op >> 8);
-        via_reg_pc(vm)->v_int = op >> 8;
-        break;
-    case VIA_OP_CALLACC:
-        DDPRINTF("CALLACC (acc = %04" VIA_FMTIx ")\n", vm->acc->v_int);
-        via_reg_pc(vm)->v_int = vm->acc->v_int;
-        break;
-    case VIA_OP_CALLB:
+        BRANCH(op >> 8);
+        RESUME();
+    TARGET(CALLACC):
+        DDPRINTF(
+            "CALLACC (acc = %04" VIA_FMTIx ")\n",
+            via_value_int(vm->acc)
+        );
+        BRANCH(via_value_int(vm->acc));
+        RESUME();
+    TARGET(CALLB):
         DDPRINTF("CALLB %04" VIA_FMTIx "\n", op >> 8);
+        SYNC_PC();
         data = vm->bound_data[op >> 8];
         // Pass the VM instance as context by default.
         vm->bound[op >> 8](data ? data : vm);
-        break;
-    case VIA_OP_SET:
+        // Bound functions hold on to their temporary values only while they
+        // are running, which makes this a safe point for collecting garbage.
+        if (vm->gc_requested) {
+            via_collect_requested(vm);
+        }
+        // The bound function may have replaced the frame or altered its
+        // program counter.
+        BRANCH(via_reg_pc(vm)->v_int);
+        RESUME();
+    TARGET(SET):
         DDPRINTF(
             "SET %" VIA_FMTId " > %s\n",
             op >> 8,
             via_to_string(vm, vm->acc)->v_string
         );
+        via_write_barrier(vm, vm->regs, vm->regs->v_arr[op >> 8], vm->acc);
         vm->regs->v_arr[op >> 8] = vm->acc;
-        break;
-    case VIA_OP_LOAD:
+        NEXT();
+    TARGET(LOAD):
         DDPRINTF(
             "LOAD %" VIA_FMTId " < %s\n",
             op >> 8,
             via_to_string(vm, vm->regs->v_arr[op >> 8])->v_string
         );
         vm->acc = vm->regs->v_arr[op >> 8];
-        break;
-    case VIA_OP_LOADNIL:
+        NEXT();
+    TARGET(LOADNIL):
         DDPRINTF("LOADNIL\n");
         vm->acc = NULL;
-        break;
-    case VIA_OP_SETRET:
+        NEXT();
+    TARGET(SETRET):
         DDPRINTF("SETRET > %s\n", via_to_string(vm, vm->acc)->v_string);
         vm->ret = vm->acc;
-        break;
-    case VIA_OP_LOADRET:
+        NEXT();
+    TARGET(LOADRET):
         DDPRINTF("LOADRET < %s\n", via_to_string(vm, vm->ret)->v_string);
         vm->acc = vm->ret;
-        break;
-    case VIA_OP_PAIRP:
+        NEXT();
+    TARGET(PAIRP):
         DDPRINTF("PAIRP\n");
-        val = via_make_value(vm);
-        val->type = VIA_V_BOOL;
-        if (vm->acc) {
-            val->v_bool = (vm->acc->type == VIA_V_PAIR);
-        } else {
-            val->v_bool = false;
-        }
-        vm->acc = val;
-        break;
-    case VIA_OP_SYMBOLP:
+        TYPE_PREDICATE(VIA_V_PAIR);
+        NEXT();
+    TARGET(SYMBOLP):
         DDPRINTF("SYMBOLP\n");
-        val = via_make_value(vm);
-        val->type = VIA_V_BOOL;
-        if (vm->acc) {
-            val->v_bool = (vm->acc->type == VIA_V_SYMBOL);
-        } else {
-            val->v_bool = false;
-        }
-        vm->acc = val;
-        break;
-    case VIA_OP_BUILTINP:
+        TYPE_PREDICATE(VIA_V_SYMBOL);
+        NEXT();
+    TARGET(BUILTINP):
         DDPRINTF("BUILTINP\n");
-        val = via_make_value(vm);
-        val->type = VIA_V_BOOL;
-        if (vm->acc) {
-            val->v_bool = (vm->acc->type == VIA_V_BUILTIN);
-        } else {
-            val->v_bool = false;
-        }
-        vm->acc = val;
-        break;
-    case VIA_OP_FORMP:
+        TYPE_PREDICATE(VIA_V_BUILTIN);
+        NEXT();
+    TARGET(FORMP):
         DDPRINTF("FORMP\n");
-        val = via_make_value(vm);
-        val->type = VIA_V_BOOL;
-        if (vm->acc) {
-            val->v_bool = (vm->acc->type == VIA_V_FORM);
-        } else {
-            val->v_bool = false;
-        }
-        vm->acc = val;
-        break;
-    case VIA_OP_FRAMEP:
+        TYPE_PREDICATE(VIA_V_FORM);
+        NEXT();
+    TARGET(FRAMEP):
         DDPRINTF("FRAMEP\n");
-        val = via_make_value(vm);
-        val->type = VIA_V_BOOL;
-        if (vm->acc) {
-            val->v_bool = (vm->acc->type == VIA_V_FRAME);
-        } else {
-            val->v_bool = false;
-        }
-        vm->acc = val;
-        break;
-    case VIA_OP_SKIPZ:
+        TYPE_PREDICATE(VIA_V_FRAME);
+        NEXT();
+    TARGET(SKIPZ):
         DDPRINTF("SKIPZ\n");
-        if (vm->acc && vm->acc->v_int != 0) {
-            break;
+        if (vm->acc && via_value_int(vm->acc) != 0) {
+            NEXT();
         }
-        via_reg_pc(vm)->v_int += (op >> 8) + 1;
-        break;
-    case VIA_OP_SNAP:
+        BRANCH(pc + (op >> 8) + 1);
+        RESUME();
+    TARGET(SNAP):
         DDPRINTF("SNAP %" VIA_FMTId "\n", op >> 8);
-        val = (struct via_value*) via_make_frame(vm);
+        SYNC_PC();
+        via_push_frame(vm);
         DPRINTF("\tFrame: %" VIA_FMTId "\n", ++frame);
         DPRINTF(
             "\tExpr: %s\n",
             via_to_string(vm, via_reg_expr(vm))->v_string
         );
         DPRINTF("Environment: %p\n", via_reg_env(vm));
-        via_reg_pc(vm)->v_int += (op >> 8) + 1;
-        vm->regs = val; 
-        break;
-    case VIA_OP_RETURN:
+        // The parent frame resumes after the snapped block once the new frame
+        // returns, while execution proceeds into the block.
+        ((struct via_value*) via_reg_parn(vm)->v_arr[VIA_REG_PC])->v_int +=
+            (op >> 8) + 1;
+        NEXT();
+    TARGET(RETURN):
         DDPRINTF("RETURN\n");
+        SYNC_PC();
         if (!via_reg_parn(vm)) {
             return vm->ret;
         }
+        // Whatever the frame left on the stack goes with it.
+        via_unwind_stack(vm, via_arg_base(vm));
         vm->acc = via_reg_parn(vm);
         via_assume_frame(vm);
         DPRINTF("\tFrame: %" VIA_FMTId "\n", --frame);
@@ -1001,47 +3017,152 @@ process_state:
             via_to_string(vm, vm->ret)->v_string
         );
         DPRINTF("Environment: %p\n", via_reg_env(vm));
-        break;
-    case VIA_OP_JMP:
+        BRANCH(via_reg_pc(vm)->v_int);
+        RESUME();
+    TARGET(JMP):
         DDPRINTF("JMP %" VIA_FMTId "\n", op >> 8);
-        via_reg_pc(vm)->v_int += (op >> 8) + 1;
-        break;
-    case VIA_OP_PUSH:
+        BRANCH(pc + (op >> 8) + 1);
+        RESUME();
+    TARGET(PUSH):
         DDPRINTF("PUSH > %s\n", via_to_string(vm, vm->acc)->v_string);
         via_push(vm, vm->acc);
-        break;
-    case VIA_OP_POP:
+        NEXT();
+    TARGET(POP):
         tmp = via_pop(vm);
         DDPRINTF("POP < %s\n", via_to_string(vm, tmp)->v_string);
         vm->acc = tmp;
-        break;
-    case VIA_OP_DROP:
+        NEXT();
+    TARGET(DROP):
         DDPRINTF("DROP\n");
         (void) via_pop(vm);
-        break;
-    case VIA_OP_PUSHARG:
+        NEXT();
+    TARGET(PUSHARG):
         DDPRINTF("PUSHARG > %s\n", via_to_string(vm, vm->acc)->v_string);
         via_push_arg(vm, vm->acc);
-        break;
-    case VIA_OP_POPARG:
+        NEXT();
+    TARGET(POPARG):
         tmp = via_pop_arg(vm);
         DDPRINTF("POPARG < %s\n", via_to_string(vm, tmp)->v_string);
         vm->acc = tmp;
-        break;
-    case VIA_OP_DEBUG:
+        NEXT();
+    TARGET(LOADK):
+        DDPRINTF(
+            "LOADK %" VIA_FMTId " < %s\n",
+            op >> 8,
+            via_to_string(vm, vm->consts[op >> 8])->v_string
+        );
+        vm->acc = vm->consts[op >> 8];
+        NEXT();
+    TARGET(EQK):
+        DDPRINTF("EQK %" VIA_FMTId "\n", op >> 8);
+        vm->acc = via_make_bool(vm, vm->acc == vm->consts[op >> 8]);
+        NEXT();
+    TARGET(LOADL):
+        DDPRINTF("LOADL %" VIA_FMTId "\n", op >> 8);
+        tmp = via_reg_env(vm);
+        // The binding resolved by the compiler is only trusted while it binds
+        // the symbol in the accumulator, as the compiled code is shared by
+        // every application of the procedure body. Either way, the value ends
+        // up in the return register as well, like with lookup-proc.
+        if (
+            tmp->v_arr[VIA_ENV_PARENT]
+                && (op >> 8) < via_value_int(tmp->v_arr[VIA_ENV_COUNT])
+                && tmp->v_arr[VIA_ENV_BINDINGS + (op >> 8) * 2] == vm->acc
+        ) {
+            vm->ret = tmp->v_arr[VIA_ENV_BINDINGS + (op >> 8) * 2 + 1];
+            vm->acc = vm->ret;
+            NEXT();
+        }
+        SYNC_PC();
+        // Throws if the symbol is unbound.
+        via_env_lookup(vm);
+        vm->acc = vm->ret;
+        BRANCH(via_reg_pc(vm)->v_int);
+        RESUME();
+    TARGET(LOADG):
+        DDPRINTF("LOADG %" VIA_FMTId "\n", op >> 8);
+        // The cached slot is good for as long as the epoch stays the same,
+        // which it does unless the outermost environment is resized, or the
+        // symbol gets bound somewhere else.
+        cache = &vm->lookup_caches[op >> 8];
+        if (
+            cache->epoch == vm->lookup_epoch
+                || via_fill_lookup_cache(vm, cache)
+        ) {
+            vm->ret = vm->globals->v_arr[cache->slot];
+            vm->acc = vm->ret;
+            NEXT();
+        }
+        vm->acc = vm->consts[cache->symbol];
+        SYNC_PC();
+        // Throws if the symbol is unbound.
+        via_env_lookup(vm);
+        vm->acc = vm->ret;
+        BRANCH(via_reg_pc(vm)->v_int);
+        RESUME();
+    TARGET(TYPESWITCH):
+        DDPRINTF("TYPESWITCH %" VIA_FMTId "\n", op >> 8);
+        // The operand is the length of the table of jmp instructions that
+        // follows, indexed by the type of the accumulator (nil included).
+        // Types beyond the end of the table continue after it.
+        type = vm->acc ? via_value_type(vm->acc) : VIA_V_NIL;
+        if (type >= (op >> 8)) {
+            BRANCH(pc + (op >> 8) + 1);
+            RESUME();
+        }
+        // The jump is taken without dispatching it, as if fused.
+        pc += type;
+        FUSED_NEXT(JMP);
+    TARGET(NATIVEP):
+        DDPRINTF("NATIVEP %04" VIA_FMTIx "\n", op >> 8);
+        // Tells whether the accumulator holds a procedure with the builtin at
+        // the operand address as its body.
+        vm->acc = via_make_bool(
+            vm,
+            vm->acc
+                && via_value_type(vm->acc) == VIA_V_PROC
+                && vm->acc->v_car
+                && via_value_type(vm->acc->v_car) == VIA_V_BUILTIN
+                && via_value_int(vm->acc->v_car) == (op >> 8)
+        );
+        NEXT();
+    ARITHMETIC(ADD, +, __builtin_add_overflow)
+    ARITHMETIC(SUB, -, __builtin_sub_overflow)
+    ARITHMETIC(MUL, *, __builtin_mul_overflow)
+    ARITHMETIC(DIV, /, DIV_OVERFLOW)
+    COMPARISON(EQ, ==)
+    COMPARISON(NEQ, !=)
+    COMPARISON(LT, <)
+    COMPARISON(GT, >)
+    COMPARISON(LTE, <=)
+    COMPARISON(GTE, >=)
+    TARGET(SKIPNT):
+        DDPRINTF("SKIPNT %" VIA_FMTId "\n", op >> 8);
+        TYPE_PREDICATE(op >> 8);
+        FUSED_NEXT(SKIPZ);
+    TARGET(LOADKSET):
+        DDPRINTF("LOADKSET %" VIA_FMTId "\n", op >> 8);
+        vm->acc = vm->consts[op >> 8];
+        FUSED_NEXT(SET);
+    TARGET(LOADKL):
+        DDPRINTF("LOADKL %" VIA_FMTId "\n", op >> 8);
+        vm->acc = vm->consts[op >> 8];
+        FUSED_NEXT(LOADL);
+    TARGET(CALLBR):
+        DDPRINTF("CALLBR %04" VIA_FMTIx "\n", op >> 8);
+        // Runs the callb at the start of the routine right away, without
+        // dispatching it.
+        pc = op >> 8;
+        op = vm->program[pc];
+        goto target_CALLB;
+    TARGET(DEBUG):
         printf(
             "Register %" VIA_FMTId ": %s\n",
             op >> 8,
             via_to_string(vm, vm->regs->v_arr[op >> 8])->v_string
         );
-        break;
+        NEXT();
+    TARGET_DEFAULT:
+        NEXT();
     }
-
-    if (old_pc == via_reg_pc(vm)->v_int) {
-        (via_reg_pc(vm)->v_int)++;
-    } else {
-        DDPRINTF("-------------\n");
-    }
-    goto process_state;
 }
-
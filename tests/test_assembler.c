@@ -4,6 +4,8 @@
 #include <via/type-utils.h>
 #include <via/vm.h>
 
+#include <stdio.h>
+
 FIXTURE(test_assembler, "Assembler")
     struct via_vm* vm = via_create_vm();
     REQUIRE(vm);
@@ -66,7 +68,15 @@ FIXTURE(test_assembler, "Assembler")
             "            jmp foo\n"
             "@bar:\n"
             "    callb @bar\n"
-            "    set !exh";
+            "    set !exh\n"
+            "    loadk 3\n"
+            "    eqk 4\n"
+            "    loadl 2\n"
+            "    loadg 5\n"
+            "    typeswitch 2\n"
+            "    nativep foo\n"
+            "    add\n"
+            "    gte";
         const size_t initial_labels_count = vm->labels_count;
         struct via_assembly_result result = via_assemble(vm, source);
         const via_opcode expected[] = {
@@ -76,7 +86,15 @@ FIXTURE(test_assembler, "Assembler")
             VIA_OP_SNAP | (1 << 8),
             VIA_OP_JMP | (-5 << 8),
             VIA_OP_CALLB | ((result.addr + 5) << 8),
-            VIA_OP_SET | (VIA_REG_EXH << 8) 
+            VIA_OP_SET | (VIA_REG_EXH << 8),
+            VIA_OP_LOADK | (3 << 8),
+            VIA_OP_EQK | (4 << 8),
+            VIA_OP_LOADL | (2 << 8),
+            VIA_OP_LOADG | (5 << 8),
+            VIA_OP_TYPESWITCH | (2 << 8),
+            VIA_OP_NATIVEP | (result.addr << 8),
+            VIA_OP_ADD,
+            VIA_OP_GTE
         };
         REQUIRE(result.status == VIA_ASM_SUCCESS);
         for (int i = 0; i < sizeof(expected) / sizeof(via_opcode); ++i) {
@@ -87,6 +105,66 @@ FIXTURE(test_assembler, "Assembler")
         REQUIRE(vm->label_addrs[initial_labels_count] == result.addr);
     END_SECTION
 
+    SECTION("Label lookup")
+        // Enough labels to grow the label index a few times.
+        const int count = 1000;
+        char source[32];
+        via_int first_addr = -1;
+        for (int i = 0; i < count; ++i) {
+            snprintf(source, sizeof(source), "label-%d:\nnop", i);
+            const struct via_assembly_result result = via_assemble(vm, source);
+            if (!i) {
+                first_addr = result.addr;
+            }
+        }
+        const struct via_assembly_result redefined =
+            via_assemble(vm, "label-0:\nnop");
+
+        via_bool found = true;
+        for (int i = 0; i < count; ++i) {
+            snprintf(source, sizeof(source), "label-%d", i);
+            found = found
+                && via_asm_label_lookup(vm, source) == first_addr + i;
+        }
+
+        REQUIRE(redefined.status == VIA_ASM_SUCCESS);
+        REQUIRE(found);
+        // The first definition of a label takes precedence.
+        REQUIRE(via_asm_label_lookup(vm, "label-0") == first_addr);
+        REQUIRE(via_asm_label_lookup(vm, "label") == -1);
+        REQUIRE(
+            via_asm_label_lookup(vm, "eval-proc") == vm->routines.eval_proc
+        );
+    END_SECTION
+
+    SECTION("Superinstructions")
+        const char* source =
+            "    pairp\n"
+            "    skipz 1\n"
+            "    loadk 3\n"
+            "    set !expr\n"
+            "    loadk 4\n"
+            "    loadl 0\n"
+            "    call eval-proc\n"
+            "    call apply-proc";
+        struct via_assembly_result result = via_assemble(vm, source);
+        // The instructions following the first one of a sequence are kept.
+        const via_opcode expected[] = {
+            VIA_OP_SKIPNT | (VIA_V_PAIR << 8),
+            VIA_OP_SKIPZ | (1 << 8),
+            VIA_OP_LOADKSET | (3 << 8),
+            VIA_OP_SET | (VIA_REG_EXPR << 8),
+            VIA_OP_LOADKL | (4 << 8),
+            VIA_OP_LOADL | (0 << 8),
+            VIA_OP_CALL | (vm->routines.eval_proc << 8),
+            VIA_OP_CALLBR | (vm->routines.apply_proc << 8)
+        };
+        REQUIRE(result.status == VIA_ASM_SUCCESS);
+        for (int i = 0; i < sizeof(expected) / sizeof(via_opcode); ++i) {
+            REQUIRE(vm->program[result.addr + i] == expected[i]);
+        }
+    END_SECTION
+
     via_free_vm(vm);
 END_FIXTURE
 
@@ -0,0 +1,179 @@
+#include <testdrive.h>
+
+#include <via/compiler.h>
+#include <via/parse.h>
+#include <via/type-utils.h>
+#include <via/vm.h>
+
+#include <stdio.h>
+
+static const struct via_value* parse_expr(
+    struct via_vm* vm,
+    const char* source
+) {
+    return via_parse_ctx_program(via_parse(vm, source, NULL))->v_car;
+}
+
+static const struct via_value* run_compiled(
+    struct via_vm* vm,
+    const struct via_value* expr
+) {
+    const via_int addr = via_compile(vm, expr);
+    if (addr < 0) {
+        return NULL;
+    }
+    via_reg_pc(vm)->v_int = addr;
+    return via_run(vm);
+}
+
+FIXTURE(test_compiler, "Compiler")
+    struct via_vm* vm = via_create_vm();
+    REQUIRE(vm);
+
+    const struct via_value* result;
+    const struct via_value* expr;
+
+    SECTION("Literal value")
+        expr = via_make_int(vm, 42);
+        result = run_compiled(vm, expr);
+
+        REQUIRE(result == expr);
+    END_SECTION
+
+    SECTION("Symbol lookup")
+        const struct via_value* value = via_make_int(vm, 42);
+        via_env_set(vm, via_sym(vm, "test-symbol"), value);
+
+        result = run_compiled(vm, via_sym(vm, "test-symbol"));
+
+        REQUIRE(result == value);
+    END_SECTION
+
+    SECTION("Procedure application")
+        result = run_compiled(vm, parse_expr(vm, "((lambda (a b) b) 1 2)"));
+
+        REQUIRE(result);
+        REQUIRE(via_value_type(result) == VIA_V_INT);
+        REQUIRE(via_value_int(result) == 2);
+    END_SECTION
+
+    SECTION("Inlined forms")
+        result = run_compiled(
+            vm,
+            parse_expr(
+                vm,
+                "(begin (set! x 5) (if (and #t (or #f x)) (quote yes) 0))"
+            )
+        );
+
+        REQUIRE(result == via_sym(vm, "yes"));
+        REQUIRE(via_value_int(via_get(vm, "x")) == 5);
+    END_SECTION
+
+    SECTION("Shadowed form")
+        result = run_compiled(
+            vm,
+            parse_expr(vm, "((lambda (if) (if 1 2 3)) (lambda (a b c) c))")
+        );
+
+        REQUIRE(result);
+        REQUIRE(via_value_type(result) == VIA_V_INT);
+        REQUIRE(via_value_int(result) == 3);
+    END_SECTION
+
+    SECTION("Compiled code is reused")
+        expr = parse_expr(vm, "(if #t 1 2)");
+        const via_int addr = via_compile(vm, expr);
+
+        REQUIRE(addr >= 0);
+        REQUIRE(via_compile(vm, expr) == addr);
+    END_SECTION
+
+    SECTION("Code of dead expressions is dropped")
+        // Stop-the-world, incremental and copying full collections.
+        const struct {
+            struct via_vm_options options;
+            via_bool incremental;
+        } configs[] = {
+            { { .collector = VIA_GC_MARK_SWEEP }, false },
+            { { .collector = VIA_GC_MARK_SWEEP }, true },
+            {
+                { .allocator = VIA_ALLOC_SLAB, .collector = VIA_GC_COPYING },
+                false
+            }
+        };
+
+        via_bool bounded = true;
+        for (size_t i = 0; i < sizeof(configs) / sizeof(configs[0]); ++i) {
+            struct via_vm* gc_vm =
+                via_create_vm_with_options(&configs[i].options);
+            REQUIRE(gc_vm);
+
+            // Distinct scripts, each redefining a procedure and applying it.
+            // Past the first few, the code of those before it is reused.
+            size_t usage[5] = { 0 };
+            for (int n = 0; n < 1000; ++n) {
+                char source[64];
+                snprintf(
+                    source,
+                    sizeof(source),
+                    "(begin (set-proc! scale (x) (* x %d)) (scale 2))",
+                    n
+                );
+                via_set_expr(gc_vm, parse_expr(gc_vm, source));
+                result = via_run_eval(gc_vm);
+                if (configs[i].incremental) {
+                    while (!via_gc_step(gc_vm, 0)) {
+                    }
+                } else {
+                    via_garbage_collect(gc_vm);
+                }
+
+                bounded = bounded
+                    && result
+                    && via_value_int(result) == 2 * n;
+                if (n == 10) {
+                    usage[0] = gc_vm->heap_cells;
+                    usage[1] = gc_vm->compiled_count;
+                    usage[2] = gc_vm->write_cursor;
+                    usage[3] = gc_vm->consts_count;
+                    usage[4] = gc_vm->lookup_caches_count;
+                }
+            }
+
+            bounded = bounded
+                && gc_vm->heap_cells <= usage[0]
+                && gc_vm->compiled_count <= usage[1]
+                && (size_t) gc_vm->write_cursor <= usage[2]
+                && gc_vm->consts_count <= usage[3]
+                && gc_vm->lookup_caches_count <= usage[4];
+
+            via_free_vm(gc_vm);
+        }
+
+        REQUIRE(bounded);
+    END_SECTION
+
+    SECTION("Code run by a frame is kept")
+        // Once the application of the procedure is under way, only the
+        // frame running its body refers to it, as the body leaves neither the
+        // procedure nor itself in a register.
+        expr = parse_expr(
+            vm,
+            "((lambda () (begin (list (garbage-collect) 2))))"
+        );
+        via_set_expr(vm, expr);
+        result = via_run_eval(vm);
+
+        REQUIRE(result);
+        REQUIRE(via_value_type(result) == VIA_V_PAIR);
+        REQUIRE(via_value_int(result->v_cdr->v_car) == 2);
+    END_SECTION
+
+    via_free_vm(vm);
+END_FIXTURE
+
+int main(int argc, char** argv) {
+    return RUN_TEST(test_compiler);
+}
+
@@ -1,14 +1,18 @@
 #include <testdrive.h>
 
 #include <via/exceptions.h>
+#include <via/parse.h>
 #include <via/type-utils.h>
 #include <via/vm.h>
 
+#include <stdio.h>
+#include <string.h>
+
 static void test_add(struct via_vm* vm) {
     const struct via_value* a = via_get(vm, "a");
     const struct via_value* b = via_get(vm, "b");
 
-    vm->ret = via_make_int(vm, a->v_int - b->v_int);
+    vm->ret = via_make_int(vm, via_value_int(a) - via_value_int(b));
 }
 
 static void test_form(struct via_vm* vm) {
@@ -31,6 +35,42 @@ static void test_throw(struct via_vm* vm) {
     via_throw(vm, via_except_runtime_error(vm, "test"));
 }
 
+static void test_scratch(struct via_vm* vm) {
+    via_env_set(vm, via_sym(vm, "scratch"), via_arg(vm, 0));
+    vm->ret = via_reg_env(vm);
+}
+
+static void test_direct(struct via_vm* vm) {
+    vm->ret = via_make_pair(vm, via_reg_env(vm), via_arg(vm, 1));
+}
+
+// Builds a complete binary tree of pairs with shared integer leaves,
+// interleaved with garbage.
+static const struct via_value* make_tree(struct via_vm* vm, int depth) {
+    if (!depth) {
+        via_make_value(vm);
+        return via_make_int(vm, 1);
+    }
+    const struct via_value* left = make_tree(vm, depth - 1);
+    return via_make_pair(vm, left, make_tree(vm, depth - 1));
+}
+
+static via_int sum_tree(const struct via_value* tree) {
+    if (via_value_type(tree) == VIA_V_INT) {
+        return via_value_int(tree);
+    }
+    return sum_tree(tree->v_car) + sum_tree(tree->v_cdr);
+}
+
+static void count_pause(
+    struct via_vm* vm,
+    enum via_gc_pause_kind kind,
+    uint64_t duration_ns,
+    void* user_data
+) {
+    ++*(size_t*) user_data;
+}
+
 FIXTURE(test_eval, "Eval")
     struct via_vm* vm = via_create_vm();
     REQUIRE(vm);
@@ -38,11 +78,14 @@ FIXTURE(test_eval, "Eval")
     const struct via_value* result;
 
     SECTION("Literal value")
+        const size_t labels_count = vm->labels_count;
         via_set_expr(vm, via_make_int(vm, 0));
 
         result = via_run_eval(vm);
 
         REQUIRE(result == via_reg_expr(vm));
+        // Running leaves the program as it was.
+        REQUIRE(vm->labels_count == labels_count);
     END_SECTION
 
     SECTION("Symbol lookup")
@@ -56,6 +99,57 @@ FIXTURE(test_eval, "Eval")
         REQUIRE(result == value);
     END_SECTION
 
+    SECTION("Outermost environment")
+        // Enough bindings to grow the hash table a few times.
+        const size_t count = 5000;
+        char name[32];
+        for (size_t i = 0; i < count; ++i) {
+            snprintf(name, sizeof(name), "binding-%zu", i);
+            via_env_set(vm, via_sym(vm, name), via_make_int(vm, i));
+        }
+        // Rebinding replaces the value.
+        via_env_set(vm, via_sym(vm, "binding-0"), via_make_int(vm, -1));
+        via_collect_nursery(vm);
+        via_garbage_collect(vm);
+
+        via_bool bound = true;
+        for (size_t i = 1; i < count; ++i) {
+            snprintf(name, sizeof(name), "binding-%zu", i);
+            bound = bound && via_value_int(via_get(vm, name)) == (via_int) i;
+        }
+
+        REQUIRE(bound);
+        REQUIRE(via_value_int(via_get(vm, "binding-0")) == -1);
+        REQUIRE(via_value_type(via_get(vm, "binding")) == VIA_V_UNDEFINED);
+    END_SECTION
+
+    SECTION("Symbol interning")
+        // Enough symbols to grow the symbol table a few times.
+        const size_t count = 5000;
+        char name[32];
+        const struct via_value* first = via_sym(vm, "sym-0");
+        for (size_t i = 1; i < count; ++i) {
+            snprintf(name, sizeof(name), "sym-%zu", i);
+            via_sym(vm, name);
+        }
+        via_collect_nursery(vm);
+        via_garbage_collect(vm);
+
+        via_bool interned = true;
+        for (size_t i = 0; i < count; ++i) {
+            snprintf(name, sizeof(name), "sym-%zu", i);
+            const struct via_value* symbol = via_sym(vm, name);
+            interned = interned
+                && via_value_type(symbol) == VIA_V_SYMBOL
+                && strcmp(symbol->v_symbol, name) == 0
+                && symbol == via_sym(vm, name);
+        }
+
+        REQUIRE(interned);
+        REQUIRE(via_sym(vm, "sym-0") == first);
+        REQUIRE(via_sym(vm, "sym") != first);
+    END_SECTION
+
     SECTION("Procedure application")
         const struct via_value* proc = via_make_proc(
             vm,
@@ -77,8 +171,8 @@ FIXTURE(test_eval, "Eval")
 
         result = via_run_eval(vm);
 
-        REQUIRE(result->type == VIA_V_INT);
-        REQUIRE(result->v_int == 123);
+        REQUIRE(via_value_type(result) == VIA_V_INT);
+        REQUIRE(via_value_int(result) == 123);
     END_SECTION
     
     SECTION("Procedure application (builtin)")
@@ -104,8 +198,56 @@ FIXTURE(test_eval, "Eval")
 
         result = via_run_eval(vm);
 
-        REQUIRE(result->type == VIA_V_INT);
-        REQUIRE(result->v_int == 22);
+        REQUIRE(via_value_type(result) == VIA_V_INT);
+        REQUIRE(via_value_int(result) == 22);
+    END_SECTION
+
+    SECTION("Procedure application (direct builtin)")
+        via_register_proc(
+            vm,
+            "test-scratch",
+            "test-scratch-proc",
+            NULL,
+            (via_bindable) test_scratch
+        );
+        via_register_direct_proc(
+            vm,
+            "test-direct",
+            "test-direct-proc",
+            (via_bindable) test_direct
+        );
+
+        via_set_expr(
+            vm,
+            via_list(vm, via_sym(vm, "test-scratch"), via_make_int(vm, 1), NULL)
+        );
+        result = via_run_eval(vm);
+
+        // Other builtins get an environment of their own, even without
+        // formals, so what they bind stays out of the globals.
+        REQUIRE(via_value_type(result) == VIA_V_ENV);
+        REQUIRE(result != vm->globals);
+        REQUIRE(result->v_arr[VIA_ENV_PARENT] == vm->globals);
+        via_set_env(vm, vm->globals);
+        REQUIRE(via_value_type(via_get(vm, "scratch")) == VIA_V_UNDEFINED);
+
+        via_set_expr(
+            vm,
+            via_list(
+                vm,
+                via_sym(vm, "test-direct"),
+                via_make_int(vm, 1),
+                via_make_int(vm, 2),
+                NULL
+            )
+        );
+        result = via_run_eval(vm);
+
+        // Direct builtins run in the environment they close over, on the
+        // arguments left on the stack.
+        REQUIRE(via_value_type(result) == VIA_V_PAIR);
+        REQUIRE(result->v_car == vm->globals);
+        REQUIRE(via_value_int(result->v_cdr) == 2);
     END_SECTION
 
     SECTION("Special forms")
@@ -154,6 +296,49 @@ FIXTURE(test_eval, "Eval")
         REQUIRE(via_is_exception(vm, result));
     END_SECTION
 
+    SECTION("Frame stack")
+        SECTION("Deep recursion")
+            // Nests further than the frame stack holds, spilling it onto the
+            // heap.
+            via_set_expr(
+                vm,
+                via_parse_ctx_program(
+                    via_parse(
+                        vm,
+                        "(begin"
+                        "  (set-proc! depth (n)"
+                        "             (if (< n 1) 0 (+ 1 (depth (- n 1)))))"
+                        "  (depth 2000))",
+                        NULL
+                    )
+                )->v_car
+            );
+
+            result = via_run_eval(vm);
+
+            REQUIRE(via_value_int(result) == 2000);
+        END_SECTION
+
+        SECTION("Captured by exceptions")
+            via_register_proc(
+                vm,
+                "throw-proc",
+                "throw-proc",
+                NULL,
+                (via_bindable) test_throw
+            );
+            via_set_expr(vm, via_list(vm, via_sym(vm, "throw-proc"), NULL));
+
+            result = via_run_eval(vm);
+            via_garbage_collect(vm);
+
+            const struct via_value* frame = via_excn_frame(result);
+            REQUIRE(via_value_type(frame) == VIA_V_FRAME);
+            REQUIRE(vm->heap[frame->slot] == frame);
+            REQUIRE(!vm->frames_top);
+        END_SECTION
+    END_SECTION
+
     SECTION("Garbage collection")
         via_int start = vm->heap_top + 1;
         const struct via_value* foo = via_make_string(vm, "foo");
@@ -190,6 +375,276 @@ FIXTURE(test_eval, "Eval")
         REQUIRE(vm->heap[start + 2] == baz);
         REQUIRE(!vm->heap[start + 3]);
     END_SECTION
+
+    SECTION("Garbage collection of deep structures")
+        const size_t length = 10000000;
+        size_t live_cells;
+
+        SECTION("List")
+            const struct via_value* list = NULL;
+            for (size_t i = 0; i < length; ++i) {
+                list = via_make_pair(vm, NULL, list);
+            }
+            vm->acc = list;
+            via_garbage_collect(vm);
+            live_cells = vm->heap_cells;
+
+            vm->acc = NULL;
+            via_garbage_collect(vm);
+
+            REQUIRE(live_cells - vm->heap_cells == length);
+        END_SECTION
+
+        SECTION("Nested in car")
+            const struct via_value* nested = NULL;
+            for (size_t i = 0; i < length; ++i) {
+                nested = via_make_pair(vm, nested, NULL);
+            }
+            vm->acc = nested;
+            via_garbage_collect(vm);
+            live_cells = vm->heap_cells;
+
+            vm->acc = NULL;
+            via_garbage_collect(vm);
+
+            REQUIRE(live_cells - vm->heap_cells == length);
+        END_SECTION
+    END_SECTION
+
+    SECTION("Cell recycling")
+        via_garbage_collect(vm);
+        const struct via_value* disposable = via_make_string(vm, "test");
+        via_garbage_collect(vm);
+
+        // The slab allocator hands out the most recently released cell.
+        REQUIRE(via_make_value(vm) == disposable);
+    END_SECTION
+
+    SECTION("Shared values")
+        const size_t cells = vm->heap_cells;
+        const struct via_value* min = via_make_int(vm, VIA_FIXNUM_MIN);
+        const struct via_value* max = via_make_int(vm, VIA_FIXNUM_MAX);
+        const struct via_value* truth = via_make_bool(vm, true);
+
+        REQUIRE(via_is_fixnum(min));
+        REQUIRE(via_make_int(vm, -1) == via_make_int(vm, -1));
+        REQUIRE(via_make_bool(vm, true) == truth);
+        REQUIRE(via_make_bool(vm, false) != truth);
+        REQUIRE(vm->heap_cells == cells);
+        // Beyond the range of fixnums, integers are kept in cells.
+        REQUIRE(!via_is_fixnum(via_make_int(vm, VIA_FIXNUM_MAX + 1)));
+
+        vm->acc = via_make_pair(vm, min, max);
+        via_garbage_collect(vm);
+        via_collect_nursery(vm);
+
+        REQUIRE(via_value_type(vm->acc->v_car) == VIA_V_INT);
+        REQUIRE(via_value_int(vm->acc->v_car) == VIA_FIXNUM_MIN);
+        REQUIRE(via_value_int(vm->acc->v_cdr) == VIA_FIXNUM_MAX);
+        REQUIRE(truth->v_bool);
+        REQUIRE(via_handle_value(vm, via_value_handle(min)) == min);
+        REQUIRE(via_handle_value(vm, via_value_handle(max)) == max);
+        vm->acc = NULL;
+    END_SECTION
+
+    SECTION("Minor collection")
+        // Promote everything allocated so far.
+        via_garbage_collect(vm);
+        const size_t old_cells = vm->heap_cells;
+        struct via_value* container = (struct via_value*) via_make_pair(
+            vm,
+            NULL,
+            NULL
+        );
+        vm->acc = container;
+        via_garbage_collect(vm);
+        vm->acc = NULL;
+        REQUIRE(container->flags & VIA_CELL_OLD);
+
+        for (size_t i = 0; i < 100; ++i) {
+            via_make_float(vm, i);
+        }
+        const struct via_value* young = via_make_float(vm, 42);
+        via_write_barrier(vm, container, container->v_car, young);
+        container->v_car = young;
+        const struct via_value* rooted = via_make_float(vm, 43);
+        vm->ret = rooted;
+
+        via_collect_nursery(vm);
+
+        REQUIRE(vm->minor_gc_count == 1);
+        // The old container is not traced, and survives until the next full
+        // collection along with the young value it references.
+        REQUIRE(vm->heap_cells == old_cells + 3);
+        REQUIRE(young->v_float == 42);
+        REQUIRE(young->flags & VIA_CELL_OLD);
+        REQUIRE(rooted->flags & VIA_CELL_OLD);
+        REQUIRE(!(container->flags & VIA_CELL_REMEMBERED));
+    END_SECTION
+
+    SECTION("Incremental collection")
+        const size_t length = 10000;
+        size_t pauses = 0;
+        via_set_gc_pause_hook(vm, count_pause, &pauses);
+        via_garbage_collect(vm);
+
+        const struct via_value* list = NULL;
+        for (size_t i = 0; i < length; ++i) {
+            list = via_make_pair(vm, via_make_int(vm, i), list);
+        }
+        vm->acc = via_make_pair(vm, list, NULL);
+        for (size_t i = 0; i < length; ++i) {
+            via_make_value(vm);
+        }
+        const size_t cells = vm->heap_cells;
+        const size_t gc_count = vm->gc_count;
+
+        REQUIRE(!via_gc_step(vm, 0));
+        REQUIRE(vm->gc_phase == VIA_GC_MARKING);
+
+        // Move the list out of the container, which only the write barrier
+        // gets to know about.
+        struct via_value* container = (struct via_value*) vm->acc;
+        vm->ret = via_make_pair(vm, list, NULL);
+        via_write_barrier(vm, container, container->v_car, NULL);
+        container->v_car = NULL;
+        vm->acc = NULL;
+
+        while (!via_gc_step(vm, 0)) {
+        }
+
+        REQUIRE(vm->gc_phase == VIA_GC_IDLE);
+        REQUIRE(vm->gc_count == gc_count + 1);
+        REQUIRE(pauses > 2);
+        // The container only goes with the next cycle.
+        REQUIRE(vm->heap_cells == cells - length + 1);
+        size_t i = length;
+        via_bool intact = true;
+        for (; list; list = list->v_cdr) {
+            intact = intact && via_value_int(list->v_car) == (via_int) --i;
+        }
+        REQUIRE(intact);
+        REQUIRE(i == 0);
+    END_SECTION
+
+    SECTION("Copying collection")
+        const struct via_vm_options options = {
+            VIA_ALLOC_SLAB,
+            VIA_GC_COPYING
+        };
+        struct via_vm* copying_vm = via_create_vm_with_options(&options);
+        REQUIRE(copying_vm);
+
+        const size_t length = 1000;
+        const struct via_value* list = NULL;
+        for (size_t i = 0; i < length; ++i) {
+            list = via_make_pair(
+                copying_vm,
+                via_make_float(copying_vm, i),
+                list
+            );
+            via_make_value(copying_vm);
+        }
+        copying_vm->acc = list;
+        const via_int handle = via_value_handle(list);
+        via_garbage_collect(copying_vm);
+        const size_t cells = copying_vm->heap_cells;
+
+        // The list moved, and is laid out with every pair followed by its
+        // element, apart from where a slab chunk ends.
+        list = copying_vm->acc;
+        REQUIRE(via_handle_value(copying_vm, handle) == list);
+        size_t i = length;
+        via_bool intact = true;
+        size_t sequential = 0;
+        for (; list->v_cdr; list = list->v_cdr) {
+            intact = intact && list->v_car->v_float == --i;
+            sequential += list->v_car == list + 1;
+        }
+        REQUIRE(intact);
+        REQUIRE(sequential > length * 9 / 10);
+        REQUIRE(i == 1);
+
+        copying_vm->acc = NULL;
+        via_garbage_collect(copying_vm);
+        REQUIRE(cells - copying_vm->heap_cells == length * 2);
+
+        via_free_vm(copying_vm);
+    END_SECTION
+
+    SECTION("Parallel marking")
+        const struct via_vm_options options = {
+            VIA_ALLOC_SLAB,
+            VIA_GC_MARK_SWEEP,
+            4
+        };
+        struct via_vm* parallel_vm = via_create_vm_with_options(&options);
+        REQUIRE(parallel_vm);
+
+        const int depth = 17;
+        const size_t leaves = (size_t) 1 << depth;
+        via_garbage_collect(parallel_vm);
+        const size_t cells = parallel_vm->heap_cells;
+
+        parallel_vm->acc = make_tree(parallel_vm, depth);
+        via_garbage_collect(parallel_vm);
+
+        // Only the garbage is gone.
+        REQUIRE(parallel_vm->heap_cells == cells + leaves - 1);
+        REQUIRE(sum_tree(parallel_vm->acc) == (via_int) leaves);
+
+        parallel_vm->acc = NULL;
+        via_garbage_collect(parallel_vm);
+        REQUIRE(parallel_vm->heap_cells == cells);
+
+        via_free_vm(parallel_vm);
+    END_SECTION
+
+    SECTION("Background sweeping")
+        const struct via_vm_options options = {
+            VIA_ALLOC_SLAB,
+            VIA_GC_MARK_SWEEP,
+            0,
+            true
+        };
+        struct via_vm* sweeping_vm = via_create_vm_with_options(&options);
+        REQUIRE(sweeping_vm);
+
+        const size_t length = 100000;
+        via_garbage_collect(sweeping_vm);
+        const size_t cells = sweeping_vm->heap_cells;
+
+        const struct via_value* list = NULL;
+        for (size_t i = 0; i < length; ++i) {
+            list = via_make_pair(
+                sweeping_vm,
+                via_make_float(sweeping_vm, i),
+                list
+            );
+            via_make_string(sweeping_vm, "garbage");
+        }
+        sweeping_vm->acc = list;
+        via_garbage_collect(sweeping_vm);
+
+        // The garbage is off the heap as soon as the collection returns,
+        // while the freeing goes on in the background.
+        REQUIRE(sweeping_vm->heap_cells == cells + length * 2);
+        for (size_t i = 0; i < length; ++i) {
+            via_make_string(sweeping_vm, "more garbage");
+        }
+        via_garbage_collect(sweeping_vm);
+        REQUIRE(sweeping_vm->heap_cells == cells + length * 2);
+
+        size_t i = length;
+        via_bool intact = true;
+        for (; list; list = list->v_cdr) {
+            intact = intact && list->v_car->v_float == --i;
+        }
+        REQUIRE(intact);
+        REQUIRE(i == 0);
+
+        via_free_vm(sweeping_vm);
+    END_SECTION
     via_free_vm(vm);
 END_FIXTURE
 
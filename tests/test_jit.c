@@ -0,0 +1,113 @@
+#include <testdrive.h>
+
+#include <via/assembler.h>
+#include <via/jit.h>
+#include <via/type-utils.h>
+#include <via/vm.h>
+
+FIXTURE(test_jit, "JIT")
+    struct via_vm* vm = via_create_vm();
+    REQUIRE(vm);
+
+    // Translate everything on first entry.
+    vm->jit_threshold = 0;
+
+    const struct via_value* result;
+    struct via_value* foo = via_make_value(vm);
+    struct via_value* bar = via_make_value(vm);
+
+    const char* source =
+        "jit-test-entry:\n"
+        "    call jit-test-body\n"
+        "jit-test-body:\n"
+        "    load !expr\n"
+        "    pairp\n"
+        "    skipz @not-pair\n"
+        "    load !expr\n"
+        "    car\n"
+        "    setret\n"
+        "    return\n"
+        "@not-pair:\n"
+        "    loadnil\n"
+        "    setret\n"
+        "    return";
+    struct via_assembly_result asm_result = via_assemble(vm, source);
+    REQUIRE(asm_result.status == VIA_ASM_SUCCESS);
+    const via_int body = via_asm_label_lookup(vm, "jit-test-body");
+
+    SECTION("Translated block")
+        via_set_expr(vm, via_make_pair(vm, foo, bar));
+        via_reg_pc(vm)->v_int = asm_result.addr;
+        result = via_run(vm);
+
+        REQUIRE(result == foo);
+        REQUIRE(vm->jit_blocks[body]);
+        REQUIRE(vm->jit_blocks[body]->code);
+
+        SECTION("Conditional exit")
+            via_set_expr(vm, foo);
+            via_reg_pc(vm)->v_int = asm_result.addr;
+            result = via_run(vm);
+
+            REQUIRE(result == NULL);
+        END_SECTION
+
+        SECTION("Overwritten code")
+            vm->program[body + 4] = VIA_OP_CDR;
+            via_reg_pc(vm)->v_int = asm_result.addr;
+            result = via_run(vm);
+
+            REQUIRE(result == bar);
+        END_SECTION
+    END_SECTION
+
+    SECTION("Fixnum condition")
+        const char* skipz_source =
+            "jit-skipz-entry:\n"
+            "    call jit-skipz-body\n"
+            "jit-skipz-body:\n"
+            "    load !expr\n"
+            "    skipz @zero\n"
+            "    load !expr\n"
+            "    setret\n"
+            "    return\n"
+            "@zero:\n"
+            "    loadnil\n"
+            "    setret\n"
+            "    return";
+        asm_result = via_assemble(vm, skipz_source);
+        REQUIRE(asm_result.status == VIA_ASM_SUCCESS);
+        const via_int skipz_body = via_asm_label_lookup(vm, "jit-skipz-body");
+
+        const struct via_value* seven = via_make_int(vm, 7);
+        via_set_expr(vm, seven);
+        via_reg_pc(vm)->v_int = asm_result.addr;
+        result = via_run(vm);
+
+        REQUIRE(result == seven);
+        REQUIRE(vm->jit_blocks[skipz_body]->code);
+
+        via_set_expr(vm, via_make_int(vm, 0));
+        via_reg_pc(vm)->v_int = asm_result.addr;
+        result = via_run(vm);
+
+        REQUIRE(result == NULL);
+    END_SECTION
+
+    SECTION("Untranslatable block")
+        vm->program[body] = VIA_OP_RETURN;
+        vm->ret = foo;
+        via_reg_pc(vm)->v_int = asm_result.addr;
+        result = via_run(vm);
+
+        REQUIRE(result == foo);
+        REQUIRE(vm->jit_blocks[body]);
+        REQUIRE(!vm->jit_blocks[body]->code);
+    END_SECTION
+
+    via_free_vm(vm);
+END_FIXTURE
+
+int main(int argc, char** argv) {
+    return RUN_TEST(test_jit);
+}
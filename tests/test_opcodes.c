@@ -1,5 +1,7 @@
 #include <testdrive.h>
 
+#include <via/assembler.h>
+#include <via/compiler.h>
 #include <via/type-utils.h>
 #include <via/vm.h>
 
@@ -114,6 +116,14 @@ FIXTURE(test_opcodes, "Opcodes")
             REQUIRE(builtin_called);
             REQUIRE(via_reg_pc(vm)->v_int == test_addr + 2);
         END_SECTION
+
+        SECTION("Fused")
+            vm->program[test_addr] = VIA_OP_CALLBR | (bound << 8);
+            result = via_run(vm);
+
+            REQUIRE(builtin_called);
+            REQUIRE(via_reg_pc(vm)->v_int == bound + 1);
+        END_SECTION
     END_SECTION
 
     SECTION("SET")
@@ -241,6 +251,153 @@ FIXTURE(test_opcodes, "Opcodes")
         END_SECTION
     END_SECTION
 
+    SECTION("TYPESWITCH")
+        // Nil and pairs jump past the table, anything else falls through it.
+        vm->program[test_addr] = VIA_OP_TYPESWITCH | ((VIA_V_PAIR + 1) << 8);
+        for (via_int type = 0; type <= VIA_V_PAIR; ++type) {
+            const via_int offset = (type == VIA_V_NIL || type == VIA_V_PAIR)
+                ? VIA_V_PAIR - type + 1
+                : VIA_V_PAIR - type;
+            vm->program[test_addr + 1 + type] = VIA_OP_JMP | (offset << 8);
+        }
+        const via_int end = test_addr + VIA_V_PAIR + 2;
+        vm->program[end] = VIA_OP_RETURN;
+        vm->program[end + 1] = VIA_OP_RETURN;
+
+        SECTION("Nil")
+            vm->acc = NULL;
+            result = via_run(vm);
+
+            REQUIRE(via_reg_pc(vm)->v_int == end + 1);
+            REQUIRE(vm->acc == NULL);
+        END_SECTION
+
+        SECTION("In table")
+            vm->acc = via_make_pair(vm, foo, bar);
+            result = via_run(vm);
+
+            REQUIRE(via_reg_pc(vm)->v_int == end + 1);
+        END_SECTION
+
+        SECTION("Elsewhere in table")
+            vm->acc = via_make_int(vm, 1);
+            result = via_run(vm);
+
+            REQUIRE(via_reg_pc(vm)->v_int == end);
+        END_SECTION
+
+        SECTION("Past table")
+            vm->acc = via_sym(vm, "typeswitch-test");
+            result = via_run(vm);
+
+            REQUIRE(via_reg_pc(vm)->v_int == end);
+        END_SECTION
+    END_SECTION
+
+    SECTION("SKIPNT")
+        vm->program[test_addr] = VIA_OP_SKIPNT | (VIA_V_PAIR << 8);
+        vm->program[test_addr + 1] = VIA_OP_SKIPZ | (1 << 8);
+        vm->program[test_addr + 2] = VIA_OP_RETURN;
+        vm->program[test_addr + 3] = VIA_OP_RETURN;
+
+        SECTION("Type")
+            vm->acc = via_make_pair(vm, foo, bar);
+            result = via_run(vm);
+
+            REQUIRE(via_reg_pc(vm)->v_int == test_addr + 2);
+            REQUIRE(vm->acc == via_make_bool(vm, true));
+        END_SECTION
+
+        SECTION("Other type")
+            vm->acc = foo;
+            result = via_run(vm);
+
+            REQUIRE(via_reg_pc(vm)->v_int == test_addr + 3);
+            REQUIRE(vm->acc == via_make_bool(vm, false));
+        END_SECTION
+    END_SECTION
+
+    SECTION("NATIVEP")
+        const via_int addr = via_asm_label_lookup(vm, "add-proc");
+        REQUIRE(addr >= 0);
+        vm->program[test_addr] = VIA_OP_NATIVEP | (addr << 8);
+
+        SECTION("Builtin")
+            vm->acc = via_get(vm, "+");
+            result = via_run(vm);
+
+            REQUIRE(vm->acc == via_make_bool(vm, true));
+        END_SECTION
+
+        SECTION("Other procedure")
+            vm->acc = via_get(vm, "-");
+            result = via_run(vm);
+
+            REQUIRE(vm->acc == via_make_bool(vm, false));
+        END_SECTION
+
+        SECTION("Not a procedure")
+            vm->acc = foo;
+            result = via_run(vm);
+
+            REQUIRE(vm->acc == via_make_bool(vm, false));
+        END_SECTION
+    END_SECTION
+
+    SECTION("ADD")
+        vm->program[test_addr] = VIA_OP_ADD;
+
+        SECTION("Fixnums")
+            via_push(vm, via_make_int(vm, 40));
+            vm->acc = via_make_int(vm, 2);
+            result = via_run(vm);
+
+            REQUIRE(via_reg_pc(vm)->v_int == test_addr + 1);
+            REQUIRE(via_value_type(vm->acc) == VIA_V_INT);
+            REQUIRE(via_value_int(vm->acc) == 42);
+        END_SECTION
+
+        SECTION("Floats")
+            via_push(vm, via_make_float(vm, 1.5));
+            vm->acc = via_make_float(vm, 2.25);
+            result = via_run(vm);
+
+            REQUIRE(via_value_type(vm->acc) == VIA_V_FLOAT);
+            REQUIRE(vm->acc->v_float == 3.75);
+        END_SECTION
+
+        SECTION("Mixed")
+            via_push(vm, via_make_int(vm, 1));
+            vm->acc = via_make_float(vm, 0.5);
+            result = via_run(vm);
+
+            REQUIRE(via_reg_pc(vm)->v_int == test_addr + 1);
+            REQUIRE(via_value_type(vm->acc) == VIA_V_FLOAT);
+            REQUIRE(vm->acc->v_float == 1.5);
+        END_SECTION
+    END_SECTION
+
+    SECTION("LT")
+        vm->program[test_addr] = VIA_OP_LT;
+
+        SECTION("Fixnums")
+            via_push(vm, via_make_int(vm, 2));
+            vm->acc = via_make_int(vm, 1);
+            result = via_run(vm);
+
+            REQUIRE(vm->acc == via_make_bool(vm, false));
+        END_SECTION
+
+        SECTION("Strings")
+            via_push(vm, via_make_string(vm, "a"));
+            vm->acc = via_make_string(vm, "b");
+            result = via_run(vm);
+
+            REQUIRE(via_reg_pc(vm)->v_int == test_addr + 1);
+            REQUIRE(vm->acc == via_make_bool(vm, true));
+        END_SECTION
+    END_SECTION
+
     SECTION("SKIPZ")
         vm->program[test_addr + 3] = VIA_OP_RETURN;
         vm->program[test_addr] = VIA_OP_SKIPZ | (2 << 8);
@@ -259,6 +416,20 @@ FIXTURE(test_opcodes, "Opcodes")
 
             REQUIRE(via_reg_pc(vm)->v_int == test_addr + 1);
         END_SECTION
+
+        SECTION("Fixnum zero")
+            vm->acc = via_make_int(vm, 0);
+            result = via_run(vm);
+
+            REQUIRE(via_reg_pc(vm)->v_int == test_addr + 3);
+        END_SECTION
+
+        SECTION("Fixnum not zero")
+            vm->acc = via_make_int(vm, -1);
+            result = via_run(vm);
+
+            REQUIRE(via_reg_pc(vm)->v_int == test_addr + 1);
+        END_SECTION
     END_SECTION
 
     SECTION("PUSH & POP")
@@ -321,18 +492,115 @@ FIXTURE(test_opcodes, "Opcodes")
         vm->program[test_addr] = VIA_OP_PUSHARG;
         result = via_run(vm);
 
-        REQUIRE(via_reg_args(vm)->type == VIA_V_PAIR);
-        REQUIRE(via_reg_args(vm)->v_car == foo);
-        REQUIRE(via_reg_args(vm)->v_cdr == NULL);
+        REQUIRE(via_arg_count(vm) == 1);
+        REQUIRE(via_arg(vm, 0) == foo);
         
         SECTION("POPARG")
             vm->acc = bar;
             via_reg_pc(vm)->v_int = test_addr;
-            vm->program[test_addr] = VIA_OP_POPARG;
+            vm->program[test_addr] = VIA_OP_PUSHARG;
+            vm->program[test_addr + 1] = VIA_OP_POPARG;
+            vm->program[test_addr + 2] = VIA_OP_RETURN;
             result = via_run(vm);
 
             REQUIRE(vm->acc == foo);
-            REQUIRE(via_reg_args(vm) == NULL);
+            REQUIRE(via_arg_count(vm) == 1);
+            REQUIRE(via_arg(vm, 0) == bar);
+        END_SECTION
+    END_SECTION
+
+    SECTION("LOADK")
+        const via_int index = via_add_const(vm, foo);
+        vm->program[test_addr] = VIA_OP_LOADK | (index << 8);
+        result = via_run(vm);
+
+        REQUIRE(vm->acc == foo);
+    END_SECTION
+
+    SECTION("EQK")
+        const via_int index = via_add_const(vm, foo);
+        vm->program[test_addr] = VIA_OP_EQK | (index << 8);
+
+        SECTION("Is equal")
+            vm->acc = foo;
+            result = via_run(vm);
+
+            REQUIRE(vm->acc->type == VIA_V_BOOL);
+            REQUIRE(vm->acc->v_bool);
+        END_SECTION
+
+        SECTION("Is not equal")
+            vm->acc = bar;
+            result = via_run(vm);
+
+            REQUIRE(vm->acc->type == VIA_V_BOOL);
+            REQUIRE(!vm->acc->v_bool);
+        END_SECTION
+    END_SECTION
+
+    SECTION("LOADL")
+        via_set_env(vm, via_make_env(vm, via_reg_env(vm)));
+        via_env_set(vm, via_sym(vm, "a"), foo);
+        via_env_set(vm, via_sym(vm, "b"), bar);
+        vm->acc = via_sym(vm, "a");
+
+        SECTION("Resolved")
+            vm->program[test_addr] = VIA_OP_LOADL | (0 << 8);
+            result = via_run(vm);
+
+            REQUIRE(vm->acc == foo);
+            REQUIRE(vm->ret == foo);
+        END_SECTION
+
+        SECTION("Resolved elsewhere")
+            vm->program[test_addr] = VIA_OP_LOADL | (1 << 8);
+            result = via_run(vm);
+
+            REQUIRE(vm->acc == foo);
+            REQUIRE(vm->ret == foo);
+        END_SECTION
+
+        SECTION("Fused")
+            const via_int symbol = via_add_const(vm, via_sym(vm, "b"));
+            vm->program[test_addr] = VIA_OP_LOADKL | (symbol << 8);
+            vm->program[test_addr + 1] = VIA_OP_LOADL | (1 << 8);
+            vm->program[test_addr + 2] = VIA_OP_RETURN;
+            result = via_run(vm);
+
+            REQUIRE(vm->acc == bar);
+            REQUIRE(via_reg_pc(vm)->v_int == test_addr + 2);
+        END_SECTION
+    END_SECTION
+
+    SECTION("LOADG")
+        const struct via_value* symbol = via_sym(vm, "loadg-test");
+        via_env_set(vm, symbol, foo);
+        const via_int cache = via_add_lookup_cache(vm, symbol);
+        vm->program[test_addr] = VIA_OP_LOADG | (cache << 8);
+        result = via_run(vm);
+
+        REQUIRE(vm->acc == foo);
+        REQUIRE(vm->ret == foo);
+        REQUIRE(vm->lookup_caches[cache].epoch == vm->lookup_epoch);
+
+        SECTION("Redefined")
+            via_env_set(vm, symbol, bar);
+            via_reg_pc(vm)->v_int = test_addr;
+            result = via_run(vm);
+
+            REQUIRE(vm->acc == bar);
+            REQUIRE(vm->ret == bar);
+        END_SECTION
+
+        SECTION("Shadowed")
+            via_set_env(vm, via_make_env(vm, via_reg_env(vm)));
+            via_env_set(vm, symbol, bar);
+            via_reg_pc(vm)->v_int = test_addr;
+            result = via_run(vm);
+
+            REQUIRE(vm->lookup_caches[cache].epoch != vm->lookup_epoch);
+            REQUIRE(vm->acc == bar);
+            REQUIRE(vm->ret == bar);
         END_SECTION
     END_SECTION
 
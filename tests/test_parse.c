@@ -21,8 +21,8 @@ FIXTURE(test_parsing, "Parsing")
             REQUIRE(result);
 
             expr = via_parse_ctx_program(result); 
-            REQUIRE(expr->v_car->type == VIA_V_INT);
-            REQUIRE(expr->v_car->v_int == 123);
+            REQUIRE(via_value_type(expr->v_car) == VIA_V_INT);
+            REQUIRE(via_value_int(expr->v_car) == 123);
         END_SECTION
         
         SECTION("Negative int")
@@ -32,8 +32,8 @@ FIXTURE(test_parsing, "Parsing")
             REQUIRE(result);
 
             expr = via_parse_ctx_program(result); 
-            REQUIRE(expr->v_car->type == VIA_V_INT);
-            REQUIRE(expr->v_car->v_int == -123);
+            REQUIRE(via_value_type(expr->v_car) == VIA_V_INT);
+            REQUIRE(via_value_int(expr->v_car) == -123);
         END_SECTION
         
         SECTION("float")
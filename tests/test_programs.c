@@ -2,9 +2,11 @@
 
 #include <via/exceptions.h>
 #include <via/parse.h>
+#include <via/type-utils.h>
 #include <via/vm.h>
 
 #include <math.h>
+#include <string.h>
 
 FIXTURE(test_programs, "Programs")
     struct via_vm* vm = via_create_vm();
@@ -40,7 +42,7 @@ FIXTURE(test_programs, "Programs")
         result = via_run_eval(vm);
 
         REQUIRE(result);
-        REQUIRE(result->v_int == 12);
+        REQUIRE(via_value_int(result) == 12);
     END_SECTION
 
     SECTION("Conditional")
@@ -55,7 +57,7 @@ FIXTURE(test_programs, "Programs")
         result = via_run_eval(vm);
 
         REQUIRE(result);
-        REQUIRE(result->v_int == 34);
+        REQUIRE(via_value_int(result) == 34);
     END_SECTION
 
     SECTION("Arithmetics")
@@ -113,7 +115,7 @@ FIXTURE(test_programs, "Programs")
         result = via_run_eval(vm);
 
         REQUIRE(result);
-        REQUIRE(result->v_int == 120);
+        REQUIRE(via_value_int(result) == 120);
     END_SECTION
 
     SECTION("Arithmetics type error")
@@ -163,8 +165,8 @@ FIXTURE(test_programs, "Programs")
         result = via_run_eval(vm);
 
         REQUIRE(result);
-        REQUIRE(result->type == VIA_V_INT);
-        REQUIRE(result->v_int == 50);
+        REQUIRE(via_value_type(result) == VIA_V_INT);
+        REQUIRE(via_value_int(result) == 50);
     END_SECTION
 
     SECTION("'let*' syntax form")
@@ -181,8 +183,8 @@ FIXTURE(test_programs, "Programs")
         result = via_run_eval(vm);
 
         REQUIRE(result);
-        REQUIRE(result->type == VIA_V_INT);
-        REQUIRE(result->v_int == 75);
+        REQUIRE(via_value_type(result) == VIA_V_INT);
+        REQUIRE(via_value_int(result) == 75);
     END_SECTION
 
     SECTION("Bundled native forms and procedures")
@@ -199,8 +201,8 @@ FIXTURE(test_programs, "Programs")
         result = via_run_eval(vm);
 
         REQUIRE(result);
-        REQUIRE(result->type == VIA_V_INT);
-        REQUIRE(result->v_int == 6);
+        REQUIRE(via_value_type(result) == VIA_V_INT);
+        REQUIRE(via_value_int(result) == 6);
     END_SECTION
 
     SECTION("Tail calls")
@@ -222,8 +224,399 @@ FIXTURE(test_programs, "Programs")
         result = via_run_eval(vm);
 
         REQUIRE(result);
-        REQUIRE(result->type == VIA_V_INT);
-        REQUIRE(result->v_int == 0);
+        REQUIRE(via_value_type(result) == VIA_V_INT);
+        REQUIRE(via_value_int(result) == 0);
+    END_SECTION
+
+    SECTION("Rest arguments")
+        const char* source =
+        "(begin"
+        "  (set-proc! rest (first others) others)"
+        "  (rest 1 2 3))";
+
+        result = via_parse(vm, source, NULL);
+
+        REQUIRE(result);
+
+        expr = via_parse_ctx_program(result);
+        via_set_expr(vm, expr->v_car);
+
+        result = via_run_eval(vm);
+
+        REQUIRE(result);
+        REQUIRE(result->type == VIA_V_PAIR);
+        REQUIRE(via_value_int(result->v_car) == 2);
+        REQUIRE(via_value_int(result->v_cdr->v_car) == 3);
+        REQUIRE(!result->v_cdr->v_cdr);
+    END_SECTION
+
+    SECTION("Lexical scopes")
+        const char* source =
+        "(begin"
+        "  (set! x 1)"
+        "  (set-proc! scope (x y)"
+        "             (begin"
+        "               (set! z (+ x y))"
+        "               (set! w (* z 2))"
+        "               (set! x 10)"
+        "               (list x y z w)))"
+        "  (set! counter (let ((n 5)) (lambda () n)))"
+        "  (list (scope 2 3) x (counter)))";
+
+        result = via_parse(vm, source, NULL);
+
+        REQUIRE(result);
+
+        expr = via_parse_ctx_program(result);
+        via_set_expr(vm, expr->v_car);
+
+        result = via_run_eval(vm);
+
+        // Bindings made by set! within a procedure stay local to it.
+        REQUIRE(result);
+        REQUIRE(result->type == VIA_V_PAIR);
+        const struct via_value* local = result->v_car;
+        REQUIRE(via_value_int(local->v_car) == 10);
+        REQUIRE(via_value_int(local->v_cdr->v_car) == 3);
+        REQUIRE(via_value_int(local->v_cdr->v_cdr->v_car) == 5);
+        REQUIRE(via_value_int(local->v_cdr->v_cdr->v_cdr->v_car) == 10);
+        REQUIRE(via_value_int(result->v_cdr->v_car) == 1);
+        REQUIRE(via_value_int(result->v_cdr->v_cdr->v_car) == 5);
+        REQUIRE(via_value_type(via_get(vm, "z")) == VIA_V_UNDEFINED);
+    END_SECTION
+
+    SECTION("Cached global lookups")
+        const char* source =
+        "(begin"
+        "  (set! g 1)"
+        "  (set-proc! get-g (shadow)"
+        "             (begin"
+        "               (if shadow (set! g 10) shadow)"
+        "               g))"
+        "  (set! before (get-g #f))"
+        "  (set! g 2)"
+        "  (list before (get-g #f) (get-g #t) (get-g #f)))";
+
+        result = via_parse(vm, source, NULL);
+
+        REQUIRE(result);
+
+        expr = via_parse_ctx_program(result);
+        via_set_expr(vm, expr->v_car);
+
+        result = via_run_eval(vm);
+
+        // The lookup of g in get-g sees the global being redefined, and then
+        // being shadowed by the procedure itself.
+        REQUIRE(result);
+        REQUIRE(result->type == VIA_V_PAIR);
+        REQUIRE(via_value_int(result->v_car) == 1);
+        REQUIRE(via_value_int(result->v_cdr->v_car) == 2);
+        REQUIRE(via_value_int(result->v_cdr->v_cdr->v_car) == 10);
+        REQUIRE(via_value_int(result->v_cdr->v_cdr->v_cdr->v_car) == 2);
+    END_SECTION
+
+    SECTION("Two runs in a row")
+        expr = via_parse_ctx_program(
+            via_parse(
+                vm,
+                "(begin (set-proc! scale (x) (* x 2)) (scale 2))",
+                NULL
+            )
+        );
+        via_set_expr(vm, expr->v_car);
+        result = via_run_eval(vm);
+
+        REQUIRE(via_value_int(result) == 4);
+
+        // The second run starts out from the outermost environment, rather
+        // than from the procedure the first one ended in, or from an
+        // environment set in between.
+        const struct via_value* env = via_make_env(vm, vm->globals);
+        via_set_env(vm, env);
+        expr = via_parse_ctx_program(
+            via_parse(vm, "(begin (set! offset 1) (scale offset))", NULL)
+        );
+        via_set_expr(vm, expr->v_car);
+        result = via_run_eval(vm);
+
+        REQUIRE(via_value_int(result) == 2);
+        REQUIRE(via_value_int(env->v_arr[VIA_ENV_COUNT]) == 0);
+        via_set_env(vm, vm->globals);
+        REQUIRE(via_value_int(via_get(vm, "offset")) == 1);
+        // Nor does it leave the handler of the first run in place.
+        REQUIRE(!via_reg_exh(vm)->v_arr[VIA_REG_EXH]);
+    END_SECTION
+
+    SECTION("Native operators")
+        const char* source =
+        "(begin"
+        "  (set-proc! add (a b) (+ a b))"
+        "  (set-proc! less (a b) (if (< a b) 1 2))"
+        "  (set! before (add 1 2))"
+        "  (set! floats (add 1.5 2))"
+        "  (set! + (lambda (a b) (list a b)))"
+        "  (list before floats (add 1 2) (less 1 2)))";
+
+        result = via_parse(vm, source, NULL);
+
+        REQUIRE(result);
+
+        expr = via_parse_ctx_program(result);
+        via_set_expr(vm, expr->v_car);
+
+        result = via_run_eval(vm);
+
+        // The addition in add is applied as the procedure bound to + once it
+        // has been redefined.
+        REQUIRE(result);
+        REQUIRE(result->type == VIA_V_PAIR);
+        REQUIRE(via_value_int(result->v_car) == 3);
+        REQUIRE(via_value_type(result->v_cdr->v_car) == VIA_V_FLOAT);
+        REQUIRE(result->v_cdr->v_car->v_float == 3.5);
+        REQUIRE(via_value_type(result->v_cdr->v_cdr->v_car) == VIA_V_PAIR);
+        REQUIRE(via_value_int(result->v_cdr->v_cdr->v_car->v_car) == 1);
+        REQUIRE(via_value_int(result->v_cdr->v_cdr->v_cdr->v_car) == 1);
+    END_SECTION
+
+    SECTION("Native operator type error")
+        const char* source =
+        "(begin"
+        "  (set-proc! add (a b) (+ a b))"
+        "  (add 43 \"test\"))";
+
+        result = via_parse(vm, source, NULL);
+
+        REQUIRE(result);
+
+        expr = via_parse_ctx_program(result);
+        via_set_expr(vm, expr->v_car);
+
+        result = via_run_eval(vm);
+
+        REQUIRE(result);
+        REQUIRE(via_is_exception(vm, result));
+    END_SECTION
+
+    SECTION("Native operator overflow")
+        const char* sources[] = {
+            "(begin (set-proc! div (a b) (/ a b)) (div 1 0))",
+            "(begin"
+            "  (set-proc! div (a b) (/ a b))"
+            "  (div (* -4611686018427387904 2) -1))",
+            "(begin (set-proc! mul (a b) (* a b)) (mul 4611686018427387903 4))",
+            "(begin (set-proc! add (a b) (+ a b)) (add 4611686018427387903 "
+            "  (* 4611686018427387903 2)))",
+            "(% 1 0)"
+        };
+        const char* messages[] = {
+            "Division by zero",
+            "Integer overflow",
+            "Integer overflow",
+            "Integer overflow",
+            "Division by zero"
+        };
+
+        via_bool thrown = true;
+        for (size_t i = 0; i < sizeof(sources) / sizeof(*sources); ++i) {
+            result = via_parse(vm, sources[i], NULL);
+            expr = via_parse_ctx_program(result);
+            via_set_expr(vm, expr->v_car);
+
+            result = via_run_eval(vm);
+            thrown = thrown
+                && via_is_exception(vm, result)
+                && strcmp(via_excn_message(result)->v_string, messages[i]) == 0;
+        }
+        REQUIRE(thrown);
+
+        // Results that only leave the fixnum range are still exact.
+        result = via_parse(
+            vm,
+            "(begin"
+            "  (set-proc! add (a b) (+ a b))"
+            "  (add 4611686018427387903 1))",
+            NULL
+        );
+        expr = via_parse_ctx_program(result);
+        via_set_expr(vm, expr->v_car);
+
+        result = via_run_eval(vm);
+
+        REQUIRE(via_value_type(result) == VIA_V_INT);
+        REQUIRE(via_value_int(result) == VIA_FIXNUM_MAX + 1);
+    END_SECTION
+
+    SECTION("Standard stream handles")
+        const char* source =
+        "(begin"
+        "  (set! same (= (file-stdout) (file-stdout)))"
+        "  (list same (catch file-stdout-object #f)))";
+
+        result = via_parse(vm, source, NULL);
+
+        REQUIRE(result);
+
+        expr = via_parse_ctx_program(result);
+        via_set_expr(vm, expr->v_car);
+
+        result = via_run_eval(vm);
+
+        // The handle is made once, and not bound in the environment.
+        REQUIRE(result);
+        REQUIRE(result->type == VIA_V_PAIR);
+        REQUIRE(result->v_car->v_bool);
+        REQUIRE(!result->v_cdr->v_car->v_bool);
+    END_SECTION
+
+    SECTION("Exception caught among arguments")
+        const char* source = "(list 1 (catch (list 5 (car 2)) 3) 4)";
+
+        result = via_parse(vm, source, NULL);
+
+        REQUIRE(result);
+
+        expr = via_parse_ctx_program(result);
+        via_set_expr(vm, expr->v_car);
+
+        result = via_run_eval(vm);
+
+        // The arguments pushed by the failed application are dropped.
+        REQUIRE(result);
+        REQUIRE(via_value_int(result->v_car) == 1);
+        REQUIRE(via_value_int(result->v_cdr->v_car) == 3);
+        REQUIRE(via_value_int(result->v_cdr->v_cdr->v_car) == 4);
+        REQUIRE(!result->v_cdr->v_cdr->v_cdr);
+        REQUIRE(!via_reg_sptr(vm)->v_int);
+    END_SECTION
+
+    SECTION("Automatic garbage collection")
+        const char* source =
+        "(begin"
+        "  (set-proc! build (num acc)"
+        "             (if (= num 0)"
+        "                 acc"
+        "                 (build (- num 1) (cons num acc))))"
+        "  (set-proc! iterate (num)"
+        "             (if (= num 0)"
+        "                 (build 100 ())"
+        "                 (begin (build 100 ()) (iterate (- num 1)))))"
+        "  (iterate 200))";
+
+        // Stop-the-world, incremental and copying full collections.
+        const struct {
+            struct via_vm_options options;
+            struct via_gc_policy policy;
+        } configs[] = {
+            {
+                { .collector = VIA_GC_MARK_SWEEP },
+                {
+                    .enabled = true,
+                    .growth_factor = 1.5,
+                    .min_heap_cells = 4096
+                }
+            },
+            {
+                { .collector = VIA_GC_MARK_SWEEP },
+                {
+                    .enabled = true,
+                    .growth_factor = 1.5,
+                    .min_heap_cells = 4096,
+                    .step_cells = 256
+                }
+            },
+            {
+                { .collector = VIA_GC_COPYING },
+                {
+                    .enabled = true,
+                    .growth_factor = 1.5,
+                    .min_heap_cells = 4096
+                }
+            }
+        };
+
+        via_bool collected = true;
+        for (size_t i = 0; i < sizeof(configs) / sizeof(configs[0]); ++i) {
+            struct via_vm* gc_vm =
+                via_create_vm_with_options(&configs[i].options);
+            REQUIRE(gc_vm);
+            via_set_gc_policy(gc_vm, &configs[i].policy);
+
+            expr = via_parse_ctx_program(via_parse(gc_vm, source, NULL));
+            via_set_expr(gc_vm, expr->v_car);
+
+            const size_t gc_count = gc_vm->gc_count;
+            result = via_run_eval(gc_vm);
+
+            collected = collected
+                && via_get_gc_policy(gc_vm).min_heap_cells == 4096
+                && gc_vm->gc_count > gc_count
+                && result
+                && result->type == VIA_V_PAIR
+                && via_value_int(result->v_car) == 1
+                && via_value_int(result->v_cdr->v_car) == 2;
+
+            via_free_vm(gc_vm);
+        }
+
+        REQUIRE(collected);
+    END_SECTION
+
+    SECTION("Rooted values")
+        const struct via_vm_options options = {
+            .allocator = VIA_ALLOC_SLAB,
+            .collector = VIA_GC_COPYING
+        };
+        struct via_vm* copying_vm = via_create_vm_with_options(&options);
+        REQUIRE(copying_vm);
+        struct via_vm* vms[] = { vm, copying_vm };
+        const struct via_gc_policy policy = {
+            .enabled = true,
+            .growth_factor = 1.5,
+            .min_heap_cells = 4096,
+            .nursery_cells = 256
+        };
+
+        via_bool kept_alive = true;
+        for (size_t i = 0; i < sizeof(vms) / sizeof(vms[0]); ++i) {
+            via_set_gc_policy(vms[i], &policy);
+
+            expr = via_parse_ctx_program(
+                via_parse(vms[i], "(list 1 2 3)", NULL)
+            );
+            via_set_expr(vms[i], expr->v_car);
+            result = via_run_eval(vms[i]);
+            via_add_root(vms[i], result);
+            const via_int handle = via_value_handle(result);
+
+            // A later run that allocates plenty, and collections after it.
+            expr = via_parse_ctx_program(
+                via_parse(
+                    vms[i],
+                    "(begin"
+                    "  (set-proc! build (num acc)"
+                    "             (if (= num 0)"
+                    "                 acc"
+                    "                 (build (- num 1) (cons num acc))))"
+                    "  (build 5000 ()))",
+                    NULL
+                )
+            );
+            via_set_expr(vms[i], expr->v_car);
+            via_run_eval(vms[i]);
+            via_garbage_collect(vms[i]);
+
+            result = via_handle_value(vms[i], handle);
+            kept_alive = kept_alive
+                && result
+                && via_value_int(result->v_car) == 1
+                && via_value_int(result->v_cdr->v_car) == 2
+                && via_value_int(result->v_cdr->v_cdr->v_car) == 3;
+            via_remove_root(vms[i], result);
+        }
+        via_free_vm(copying_vm);
+
+        REQUIRE(kept_alive);
     END_SECTION
 
     SECTION("Numeric type conversions")
@@ -240,12 +633,12 @@ FIXTURE(test_programs, "Programs")
 
             REQUIRE(result);
             REQUIRE(result->type == VIA_V_PAIR);
-            REQUIRE(result->v_car->type == VIA_V_INT);
-            REQUIRE(result->v_car->v_int == 1);
-            REQUIRE(result->v_cdr->v_car->type == VIA_V_INT);
-            REQUIRE(result->v_cdr->v_car->v_int == 1);
-            REQUIRE(result->v_cdr->v_cdr->v_car->type == VIA_V_INT);
-            REQUIRE(result->v_cdr->v_cdr->v_car->v_int == 1);
+            REQUIRE(via_value_type(result->v_car) == VIA_V_INT);
+            REQUIRE(via_value_int(result->v_car) == 1);
+            REQUIRE(via_value_type(result->v_cdr->v_car) == VIA_V_INT);
+            REQUIRE(via_value_int(result->v_cdr->v_car) == 1);
+            REQUIRE(via_value_type(result->v_cdr->v_cdr->v_car) == VIA_V_INT);
+            REQUIRE(via_value_int(result->v_cdr->v_cdr->v_car) == 1);
         END_SECTION
     END_SECTION
 
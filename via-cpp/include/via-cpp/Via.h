@@ -9,6 +9,8 @@
 #include <memory>
 #include <string>
 #include <string_view>
+#include <tuple>
+#include <utility>
 
 namespace via {
     class Vm;
@@ -25,11 +27,14 @@ namespace via {
     template <typename Type>
     const auto encode = TypeMapper<Type>::encode;
 
+    // A value either borrowed from the VM, which is only safe to use until
+    // the VM runs again, or rooted in it, which keeps it alive until the
+    // Value is destroyed. Rooted values must not outlive their VM.
     struct Value {
         Value() = default;
 
         Value(const Value& other)
-            : value(other.value)
+            : Value(other.vm, other.get())
         {
         }
 
@@ -38,36 +43,80 @@ namespace via {
         {
         }
 
+        Value(via_vm* vm, const via_value* value)
+            : value(value)
+        {
+            // Nil, fixnums and immortal values need no root.
+            if (vm && value && !via_is_fixnum(value)
+                    && !(value->flags & VIA_CELL_IMMORTAL)
+                    && via_add_root(vm, value)) {
+                this->vm = vm;
+                handle = via_value_handle(value);
+            }
+        }
+
         Value(Value&& other)
-            : value(other.value)
+            : value(other.value), vm(other.vm), handle(other.handle)
         {
+            other.vm = nullptr;
         }
 
-        virtual ~Value() = default;
+        virtual ~Value()
+        {
+            release();
+        }
 
         virtual const Value& operator =(const Value& other)
         {
-            value = other.value;
+            if (this != &other) {
+                release();
+                *this = Value(other);
+            }
             return *this;
         }
 
         virtual const Value& operator =(Value&& other)
         {
-            value = other.value;
+            if (this != &other) {
+                release();
+                value = other.value;
+                vm = other.vm;
+                handle = other.handle;
+                other.vm = nullptr;
+            }
             return *this;
         }
 
-        virtual const via_value* operator->() const { return value; }
+        virtual const via_value* operator->() const { return get(); }
 
-        virtual operator const via_value*() const  { return value; }
+        virtual operator const via_value*() const  { return get(); }
         
         virtual bool operator==(const Value& rhs) const
         {
-            return value == rhs.value;
+            return get() == rhs.get();
         }
 
     protected:
+        // Rooted values are found through their handles, as collections may
+        // move them.
+        const via_value* get() const
+        {
+            return vm ? via_handle_value(vm, handle) : value;
+        }
+
         const via_value* value = nullptr;
+
+    private:
+        void release()
+        {
+            if (vm) {
+                via_remove_root(vm, get());
+                vm = nullptr;
+            }
+        }
+
+        via_vm* vm = nullptr;
+        via_int handle = 0;
     };
 
     class Vm {
@@ -78,6 +127,11 @@ namespace via {
         {
         }
 
+        explicit Vm(const via_vm_options& options)
+            : vm(via_create_vm_with_options(&options), via_free_vm)
+        {
+        }
+
         Vm(const Vm& other) = delete;
 
         Vm(Vm&& other)
@@ -117,9 +171,8 @@ namespace via {
                     [](void* data) {
                         auto& [self, anyFunc] = *reinterpret_cast<Bound*>(data);
                         auto f = std::any_cast<decltype(func)>(anyFunc);
-                        auto args = std::make_tuple(
-                                TypeMapper<Args>::decode(self,
-                                    via_pop_arg(self.vm.get()))...);
+                        auto args = decodeArgs<Args...>(self,
+                                std::index_sequence_for<Args...>());
                         self.returnValue(std::apply(f, args));
                     }, contexts.back().get());
         }
@@ -143,10 +196,20 @@ namespace via {
         {
             via_set_expr(vm.get(), via_parse_ctx_program(
                         via_parse(vm.get(), program.c_str(), nullptr))->v_car);
-            return via_run_eval(vm.get());
+            return Value(vm.get(), via_run_eval(vm.get()));
         }
 
     private:
+        // Decodes the arguments of a bound procedure by index, leaving them on
+        // the stack.
+        template <typename... Args, std::size_t... Indices>
+        static std::tuple<Args...> decodeArgs(Vm& self,
+                std::index_sequence<Indices...>)
+        {
+            return { TypeMapper<Args>::decode(self,
+                    via_arg(self.vm.get(), Indices))... };
+        }
+
         std::unique_ptr<via_vm, void(*)(via_vm*)> vm;
         std::vector<std::unique_ptr<Bound>> contexts;
     };
@@ -159,7 +222,7 @@ namespace via {
         {
         }
         
-        operator std::string_view() { return value->v_symbol; }
+        operator std::string_view() { return get()->v_symbol; }
     };
 
     template <typename Type>
@@ -190,18 +253,20 @@ namespace via {
         {
         }
 
-        Value car() const { return value->v_car; }
-        Value cdr() const { return value->v_cdr; }
+        Value car() const { return get()->v_car; }
+        Value cdr() const { return get()->v_cdr; }
         
-        const Value& car(const Value& vCar)
+        const Value& car(Vm& vm, const Value& vCar)
         {
-            const_cast<via_value*>(value)->v_car = vCar;
+            via_write_barrier(vm, get(), get()->v_car, vCar);
+            const_cast<via_value*>(get())->v_car = vCar;
             return vCar;
         }
 
-        const Value& cdr(const Value& vCdr)
+        const Value& cdr(Vm& vm, const Value& vCdr)
         {
-            const_cast<via_value*>(value)->v_cdr = vCdr;
+            via_write_barrier(vm, get(), get()->v_cdr, vCdr);
+            const_cast<via_value*>(get())->v_cdr = vCdr;
             return vCdr;
         }
     };
@@ -226,7 +291,7 @@ namespace via {
 
         static via_int decode(Vm&, Value value)
         {
-            return value->v_int;
+            return via_value_int(value);
         }
 
         static Value encode(Vm& vm, via_int value)
@@ -350,7 +415,7 @@ namespace via {
             Pair start(vm, via::encode<Type>(vm, *it++), nullptr);
             auto cursor = start;
             for (const auto& elem = *it; it != source.end(); ++it) {
-                cursor.cdr(Pair(vm, via::encode<Type>(vm, elem), nullptr));
+                cursor.cdr(vm, Pair(vm, via::encode<Type>(vm, elem), nullptr));
                 cursor = cursor.cdr();
             }
 